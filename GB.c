@@ -0,0 +1,7313 @@
+// GB.c - Emulator core, see GB.h for the library API
+
+#include "GB.h"
+
+#include <math.h>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Vector kernels for the PPU, define GB_NO_SIMD to use the scalar ones
+#if defined(__SSE2__) && !defined(GB_NO_SIMD)
+#include <emmintrin.h>
+#define GB_SIMD_SSE2
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#define GB_SIMD_SSSE3
+#endif
+#elif defined(__ARM_NEON) && defined(__aarch64__) && !defined(GB_NO_SIMD)
+#include <arm_neon.h>
+#define GB_SIMD_NEON
+#endif
+
+void ReleaseRom(uint8_t *rom);
+void FlushBlocks(GB *gb);
+void MaterializeFlags(GB *gb);
+bool IsWatchedPage(GB *gb, uint8_t page, uint8_t type);
+bool IsBreakpoint(GB *gb, uint16_t addr);
+bool CheckBreakpoint(GB *gb);
+void CheckWatchpoint(GB *gb, uint16_t addr, uint8_t type, uint8_t val);
+uint8_t ReadWatched(GB *gb, uint16_t addr);
+void FreeCartRam(GB *gb);
+void FlushSaveFile(GB *gb);
+void SyncRTC(GB *gb);
+bool IsCGBRegister(uint16_t addr);
+uint8_t ReadCGB(GB *gb, uint16_t addr);
+void WriteCGB(GB *gb, uint16_t addr, uint8_t val);
+
+// GB is allocated aligned to GB_CACHE_LINE, see CreateGB
+#ifndef WIN32
+#define FreeGB(gb) free(gb)
+#else
+#define FreeGB(gb) _aligned_free(gb)
+#endif
+
+void DestroyGB(GB *gb)
+{
+    printf("Destroying GB\n");
+    if (gb != NULL)
+    {
+        if (gb->cart != NULL)
+        {
+            ReleaseRom(gb->cart);
+        }
+
+        if (gb->bootRom != NULL)
+        {
+            ReleaseRom(gb->bootRom);
+        }
+
+        FreeCartRam(gb);
+
+#ifdef GB_PROFILE
+        free(gb->profile);
+#endif
+
+        free(gb->synth);
+        free(gb->blocks);
+        free(gb->trace);
+        free(gb->debugger);
+        FreeGB(gb);
+    }
+}
+
+// The hot CPU state has to fit the first cache line
+_Static_assert(offsetof(GB, readPages) == GB_CACHE_LINE,
+               "hot GB fields don't fill one cache line");
+
+GB *CreateGB()
+{
+    // aligned_alloc needs a multiple of the alignment
+    size_t size = (sizeof(GB) + GB_CACHE_LINE - 1) & ~(GB_CACHE_LINE - 1);
+
+#ifndef WIN32
+    GB *gb = aligned_alloc(GB_CACHE_LINE, size);
+#else
+    GB *gb = _aligned_malloc(size, GB_CACHE_LINE);
+#endif
+    if (gb == NULL)
+    {
+        return NULL;
+    }
+    memset(gb, 0, size);
+
+    memset(gb->tileDirty, true, sizeof(gb->tileDirty));
+    gb->spritesDirty = true;
+
+    // Without the cache everything is interpreted, which is just slower
+    GB_SetBlockCache(gb, true);
+
+#ifdef GB_PROFILE
+    gb->profile = calloc(1, sizeof(Profile));
+    if (gb->profile == NULL)
+    {
+        FreeGB(gb);
+        return NULL;
+    }
+#endif
+
+    return gb;
+}
+
+// Copies the mapped read pages into the page table, leaving out the pages
+// holding read watchpoints so their reads go to the debugger
+void ApplyReadWatches(GB *gb)
+{
+    memcpy(gb->readPages, gb->mappedReadPages, sizeof(gb->readPages));
+
+    if (gb->debugger != NULL)
+    {
+        for (int page = 0; page < 0x100; ++page)
+        {
+            if (IsWatchedPage(gb, page, GB_WATCH_READ))
+            {
+                gb->readPages[page] = NULL;
+            }
+        }
+    }
+}
+
+// Copies the mapped write pages into the page table. While writes are
+// tracked for snapshots, pages that are still clean stay NULL so their first
+// write goes to the slow path and marks them dirty. So do pages holding
+// decoded blocks, their first write drops the blocks, and pages holding
+// write watchpoints.
+void ApplyWriteTracking(GB *gb)
+{
+    for (int page = 0; page < 0x100; ++page)
+    {
+        int16_t id = gb->pageIds[page];
+
+        gb->writePages[page] = gb->mappedPages[page];
+
+        if (id >= 0 &&
+            ((gb->trackWrites && !gb->dirtyPages[id]) || gb->codePages[id]))
+        {
+            gb->writePages[page] = NULL;
+        }
+
+        if (gb->debugger != NULL && IsWatchedPage(gb, page, GB_WATCH_WRITE))
+        {
+            gb->writePages[page] = NULL;
+        }
+    }
+}
+
+// Drops the blocks decoded from a page before it's written
+void InvalidateCode(GB *gb, int16_t id)
+{
+    gb->codeGenerations[id] += 1;
+    gb->codePages[id] = false;
+
+    ApplyWriteTracking(gb);
+}
+
+// Points the ROM and cartridge RAM pages at the current banks, called by the
+// controllers after every bank switch
+void MapCart(GB *gb)
+{
+    uint32_t bank0Base = gb->romBank0 * 0x4000;
+    uint32_t bankBase  = gb->romBank * 0x4000;
+
+    for (int page = 0x00; page < 0x40; ++page)
+    {
+        gb->mappedReadPages[page] =
+            &gb->cart[(bank0Base + (page << 8)) % gb->cartSize];
+        gb->mappedReadPages[page + 0x40] =
+            &gb->cart[(bankBase + (page << 8)) % gb->cartSize];
+
+        gb->mappedPages[page]        = NULL;
+        gb->mappedPages[page + 0x40] = NULL;
+        gb->pageIds[page]            = -1;
+        gb->pageIds[page + 0x40]     = -1;
+    }
+
+    // The CGB boot ROM leaves the cartridge header at 0x100-0x1FF visible
+    if (gb->io[IO_BOOT - IO_BASE] == 0)
+    {
+        gb->mappedReadPages[0x00] = gb->bootRom;
+
+        for (int page = 0x02; gb->cgb && page < (gb->bootRomSize >> 8);
+             ++page)
+        {
+            gb->mappedReadPages[page] = &gb->bootRom[page << 8];
+        }
+    }
+
+    // Banks past the controller's RAM banks select its registers
+    bool mapRam = gb->mbc->directRam && gb->ramEnabled &&
+                  gb->cartRamSize > 0 && gb->ramBank < gb->mbc->ramBanks;
+
+    uint32_t ramBase = gb->ramBank * 0x2000;
+    for (int page = 0xA0; page < 0xC0; ++page)
+    {
+        uint8_t *ram = NULL;
+        int16_t  id  = -1;
+
+        if (mapRam)
+        {
+            uint32_t offset =
+                (ramBase + ((page - 0xA0) << 8)) % gb->cartRamSize;
+
+            ram = &gb->cartRam[offset];
+            id  = DIRTY_MEM_PAGES + (offset >> 8);
+        }
+
+        gb->mappedReadPages[page] = ram;
+        gb->mappedPages[page]     = ram;
+        gb->pageIds[page]         = id;
+    }
+
+    ApplyReadWatches(gb);
+    ApplyWriteTracking(gb);
+}
+
+// VRAM bank selected by VBK, always 0 on a DMG
+uint8_t GetVRAMBank(GB *gb)
+{
+    return gb->cgb ? gb->io[IO_VBK - IO_BASE] & 1 : 0;
+}
+
+// WRAM bank at 0xD000-0xDFFF selected by SVBK, bank 0 selects 1 as well
+uint8_t GetWRAMBank(GB *gb)
+{
+    uint8_t bank = gb->cgb ? gb->io[IO_SVBK - IO_BASE] & 0x7 : 1;
+    return bank > 0 ? bank : 1;
+}
+
+// Points the VRAM and WRAM pages at the current banks. A bank switch only
+// repoints the pages, blocks decoded from the old bank no longer match
+// readPages and aren't run.
+void MapRamBanks(GB *gb)
+{
+    // VRAM bank b has dirty page ids b * 0x20 onwards, WRAM offset o
+    // DIRTY_VRAM_PAGES + (o >> 8)
+    uint32_t vramBase = GetVRAMBank(gb) * VRAM_SIZE;
+    for (int page = 0x80; page < 0xA0; ++page)
+    {
+        uint32_t offset = vramBase + ((page - 0x80) << 8);
+
+        gb->mappedReadPages[page] = &gb->vram[offset];
+        gb->mappedPages[page]     = gb->mappedReadPages[page];
+        gb->pageIds[page]         = offset >> 8;
+    }
+
+    // 0xE000-0xFDFF echoes 0xC000-0xDDFF
+    uint32_t wramBase = GetWRAMBank(gb) * WRAM_BANK_SIZE;
+    for (int page = 0xC0; page < 0xFE; ++page)
+    {
+        uint8_t  index  = (page - 0xC0) & 0x1F;
+        uint32_t offset = index < 0x10 ? index << 8
+                                       : wramBase + ((index - 0x10) << 8);
+
+        gb->mappedReadPages[page] = &gb->wram[offset];
+        gb->mappedPages[page]     = gb->mappedReadPages[page];
+        gb->pageIds[page]         = DIRTY_VRAM_PAGES + (offset >> 8);
+    }
+
+    // Tile data writes invalidate the tile cache
+    for (int page = 0x80; page < (VRAM_TILES_END >> 8); ++page)
+    {
+        gb->mappedPages[page] = NULL;
+    }
+
+    ApplyReadWatches(gb);
+    ApplyWriteTracking(gb);
+}
+
+// Rebuilds the page tables, needs to be called whenever the boot ROM is
+// unmapped
+void MapMemory(GB *gb)
+{
+    FlushBlocks(gb);
+
+    // OAM and the I/O registers are never mapped, they live in smaller
+    // arrays than a page. OAM writes invalidate the sprite lists.
+    for (int page = OAM_BASE >> 8; page < 0x100; ++page)
+    {
+        gb->mappedReadPages[page] = NULL;
+        gb->mappedPages[page]     = NULL;
+        gb->pageIds[page]         = -1;
+    }
+
+    MapRamBanks(gb);
+    MapCart(gb);
+}
+
+//-------------Scheduler-------------
+// Everything that isn't the CPU happens at a known cycle (next PPU mode
+// change or line, next TIMA overflow, next serial bit). Each source keeps a
+// timestamp in gb->events and StepGB only calls RunEvents once the earliest
+// one is due. Registers whose value depends on elapsed time (DIV, TIMA) are
+// computed when they are read.
+
+void ScheduleEvent(GB *gb, uint8_t event, uint64_t when)
+{
+    gb->events[event] = when;
+
+    gb->nextEvent = EVENT_NEVER;
+    for (int i = 0; i < EVENT_COUNT; ++i)
+    {
+        if (gb->events[i] < gb->nextEvent)
+        {
+            gb->nextEvent = gb->events[i];
+        }
+    }
+}
+
+// CPU cycles taking as long as the given PPU cycles. The timer, serial
+// port and OAM DMA are clocked by the CPU, the PPU and APU at the same rate
+// in both speeds.
+uint64_t GetPPUCycles(GB *gb, uint64_t cycles)
+{
+    return cycles << gb->doubleSpeed;
+}
+
+// CPU cycles per second
+uint64_t GetClockRate(GB *gb)
+{
+    return (uint64_t)CPU_CLOCK << gb->doubleSpeed;
+}
+
+// CPU cycles between frame sequencer steps, which follows a higher divider
+// bit in double speed
+uint64_t GetAPUFrameCycles(GB *gb)
+{
+    return GetPPUCycles(gb, APU_FRAME_CYCLES);
+}
+
+void RequestInterrupt(GB *gb, uint8_t mask)
+{
+    gb->io[IO_IF - IO_BASE] |= mask;
+    gb->irqCheck = true;
+}
+
+// TAC input clock select -> bit of the internal divider whose falling edge
+// increments TIMA
+const uint8_t timerBits[4] = {9, 3, 5, 7};
+
+void IncrementTIMA(GB *gb)
+{
+    uint8_t *tima = &gb->io[IO_TIMA - IO_BASE];
+
+    if (*tima == 0xFF)
+    {
+        *tima = gb->io[IO_TMA - IO_BASE];
+        RequestInterrupt(gb, TIMER_MASK);
+    }
+    else
+    {
+        *tima += 1;
+    }
+}
+
+// Brings TIMA up to date by counting the falling edges of the selected
+// divider bit since it was last synced
+void SyncTimer(GB *gb)
+{
+    uint8_t tac = gb->io[IO_TAC - IO_BASE];
+
+    if ((tac & 0x4) > 0)
+    {
+        uint8_t  shift = timerBits[tac & 0b11] + 1;
+        uint64_t ticks = ((gb->cycles - gb->divBase) >> shift) -
+                         ((gb->timerSync - gb->divBase) >> shift);
+
+        for (uint64_t i = 0; i < ticks; ++i)
+        {
+            IncrementTIMA(gb);
+        }
+    }
+
+    gb->timerSync = gb->cycles;
+}
+
+// Schedules the next TIMA overflow, must be called after SyncTimer
+void ScheduleTimer(GB *gb)
+{
+    uint8_t tac = gb->io[IO_TAC - IO_BASE];
+
+    if ((tac & 0x4) == 0)
+    {
+        ScheduleEvent(gb, EVENT_TIMER, EVENT_NEVER);
+        return;
+    }
+
+    uint64_t period  = 1 << (timerBits[tac & 0b11] + 1);
+    uint64_t elapsed = gb->cycles - gb->divBase;
+    uint64_t ticks   = 0x100 - gb->io[IO_TIMA - IO_BASE];
+
+    uint64_t nextEdge = gb->divBase + (elapsed / period + 1) * period;
+    ScheduleEvent(gb, EVENT_TIMER, nextEdge + (ticks - 1) * period);
+}
+
+void UpdateLCDStatus(GB *gb);
+
+// Turns the PPU on or off when LCDC bit 7 changes
+void SetLCDEnabled(GB *gb, bool enabled)
+{
+    gb->io[IO_LY - IO_BASE] = 0;
+    gb->statLine            = false;
+
+    if (enabled)
+    {
+        gb->ppuMode = PPU_MODE_OAM;
+        ScheduleEvent(gb, EVENT_PPU,
+                      gb->cycles + GetPPUCycles(gb, PPU_OAM_CYCLES));
+    }
+    else
+    {
+        gb->ppuMode = PPU_MODE_HBLANK;
+        ScheduleEvent(gb, EVENT_PPU, EVENT_NEVER);
+
+        // The screen goes blank while the LCD is off
+        for (int i = 0; i < GB_VID_WIDTH * GB_VID_HEIGHT; ++i)
+        {
+            gb->framebuffer[i] = 0xFFFFFFFF;
+        }
+        gb->frameDone = true;
+    }
+
+    UpdateLCDStatus(gb);
+}
+
+//-------------APU-------------
+// Info from https://gbdev.gg8i.net/wiki/articles/Gameboy_sound_hardware
+//
+// The channel state that games can observe (lengths, envelopes, sweep and
+// the NR52 status bits) always runs, clocked by the frame sequencer event.
+// Turning the channels into sound is optional. When enabled it happens in
+// bulk at every frame sequencer step and APU register write, by stepping
+// each channel's waveform through the cycles since then and adding every
+// change of its output as a band limited step to a buffer at the host
+// sample rate (see AddDelta). Without it nothing is synthesized at all.
+
+// Band limited steps, BLIP_TAPS samples long at BLIP_PHASES sub-sample
+// positions. Output is delayed by half the taps.
+#define BLIP_PHASES 32
+#define BLIP_TAPS 16
+#define BLIP_SCALE 15
+// Leaves some band below Nyquist for the window to fall off
+#define BLIP_CUTOFF 0.9
+
+// Samples kept for GB_ReadSamples, the oldest are dropped once full
+#define AUDIO_BUFFER_SAMPLES 8192
+// Cycles synthesized at once at most, the buffer has room for them
+#define AUDIO_CHUNK_CYCLES 0x10000
+// Output of a channel at its loudest and with NR50 at its maximum is
+// 15 * 8 * AUDIO_SCALE, four of them still fit in a sample
+#define AUDIO_SCALE 64
+// DC blocking filter, the shift sets how fast it follows (about 15 Hz at
+// 48 kHz)
+#define AUDIO_HIGHPASS_SHIFT 9
+
+typedef struct APUSynthstruct
+{
+    uint32_t sampleRate;
+    // Output samples per cycle, 32.32 fixed point
+    uint64_t samplesPerCycle;
+
+    // Cycles are synthesized up to here
+    uint64_t cycle;
+    // The sample position of cycle t in the buffers is
+    // (t - baseCycle) * samplesPerCycle - baseOffset, see GetSamplePosition
+    uint64_t baseCycle;
+    int64_t  baseOffset;
+
+    // Waveform of each channel, when it steps next and how far it is
+    uint64_t nextStep[APU_CHANNELS];
+    uint8_t  position[APU_CHANNELS];
+    uint16_t lfsr;
+
+    // Current output of each channel (0-15) and what it adds to each side
+    uint8_t level[APU_CHANNELS];
+    int32_t outputs[APU_CHANNELS][2];
+
+    int32_t kernel[BLIP_PHASES][BLIP_TAPS];
+    // Changes of the left and right output per sample, summed up when read
+    int32_t buffers[2][AUDIO_BUFFER_SAMPLES + BLIP_TAPS];
+    int32_t sums[2];
+    int64_t highPass[2];
+} APUSynth;
+
+// Read back as 1, per register from NR10
+const uint8_t apuReadMasks[0x20] = {
+    0x80, 0x3F, 0x00, 0xFF, 0xBF, 0xFF, 0x3F, 0x00, 0xFF, 0xBF, 0x7F,
+    0xFF, 0x9F, 0xFF, 0xBF, 0xFF, 0xFF, 0x00, 0x00, 0xBF, 0x00, 0x00,
+    0x70, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+};
+
+// Square wave duty cycles, one bit per step
+const uint8_t dutyPatterns[4] = {0x01, 0x81, 0x87, 0x7E};
+
+// Noise channel divisors, doubled by every step of the clock shift
+const uint8_t noiseDivisors[8] = {8, 16, 32, 48, 64, 80, 96, 112};
+
+// Registers of a channel, NRx0 to NRx4
+uint8_t *GetChannelRegs(GB *gb, uint8_t channel)
+{
+    return &gb->io[IO_NR10 - IO_BASE + channel * 5];
+}
+
+uint16_t GetChannelFrequency(GB *gb, uint8_t channel)
+{
+    const uint8_t *regs = GetChannelRegs(gb, channel);
+    return regs[3] | ((regs[4] & 0x7) << 8);
+}
+
+// Cycles between steps of a channel's waveform
+uint64_t GetChannelPeriod(GB *gb, uint8_t channel)
+{
+    if (channel == 3)
+    {
+        uint8_t  nr43    = GetChannelRegs(gb, 3)[3];
+        uint8_t  shift   = nr43 >> 4;
+        uint64_t divisor = noiseDivisors[nr43 & 0x7];
+
+        // Shifts of 14 and 15 stop the noise
+        return shift >= 14 ? EVENT_NEVER : GetPPUCycles(gb, divisor << shift);
+    }
+
+    return GetPPUCycles(gb, (2048 - GetChannelFrequency(gb, channel)) *
+                                (channel == 2 ? 2 : 4));
+}
+
+void InitBlipKernel(APUSynth *synth)
+{
+    for (int phase = 0; phase < BLIP_PHASES; ++phase)
+    {
+        double  taps[BLIP_TAPS];
+        double  sum = 0;
+        int32_t total = 0;
+        int     largest = 0;
+
+        for (int i = 0; i < BLIP_TAPS; ++i)
+        {
+            // Centered between the middle taps, shifted by the phase
+            double x = i - (BLIP_TAPS / 2 - 1) - (double)phase / BLIP_PHASES;
+            double w = 0.42 + 0.5 * cos(2 * M_PI * x / BLIP_TAPS) +
+                       0.08 * cos(4 * M_PI * x / BLIP_TAPS);
+            double a = M_PI * x * BLIP_CUTOFF;
+
+            taps[i] = (x == 0 ? 1 : sin(a) / a) * w;
+            sum += taps[i];
+        }
+
+        // Every phase adds up to exactly one step, so the sums don't drift
+        for (int i = 0; i < BLIP_TAPS; ++i)
+        {
+            synth->kernel[phase][i] = lround(taps[i] / sum * (1 << BLIP_SCALE));
+            total += synth->kernel[phase][i];
+
+            if (taps[i] > taps[largest])
+            {
+                largest = i;
+            }
+        }
+        synth->kernel[phase][largest] += (1 << BLIP_SCALE) - total;
+    }
+}
+
+// Sample position of a cycle, 32.32 fixed point
+int64_t GetSamplePosition(APUSynth *synth, uint64_t cycle)
+{
+    return (int64_t)((cycle - synth->baseCycle) * synth->samplesPerCycle) -
+           synth->baseOffset;
+}
+
+// Samples whose value is final, later changes only add to later ones
+uint32_t GetAvailableSamples(APUSynth *synth)
+{
+    return GetSamplePosition(synth, synth->cycle) >> 32;
+}
+
+// Adds a change of one side's output at a cycle as a band limited step
+void AddDelta(APUSynth *synth, int side, uint64_t cycle, int32_t delta)
+{
+    int64_t  pos   = GetSamplePosition(synth, cycle);
+    uint32_t index = pos >> 32;
+    uint32_t phase = (pos >> (32 - 5)) & (BLIP_PHASES - 1);
+
+    if (index >= AUDIO_BUFFER_SAMPLES)
+    {
+        return;
+    }
+
+    int32_t *samples = &synth->buffers[side][index];
+    for (int i = 0; i < BLIP_TAPS; ++i)
+    {
+        samples[i] += delta * synth->kernel[phase][i];
+    }
+}
+
+// Moves count samples out of the buffers, to out unless it's NULL
+void TakeSamples(APUSynth *synth, int16_t *out, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        for (int side = 0; side < 2; ++side)
+        {
+            synth->sums[side] += synth->buffers[side][i];
+
+            int32_t sample = synth->sums[side] >> BLIP_SCALE;
+            int64_t high   = (int64_t)sample * 65536 - synth->highPass[side];
+            synth->highPass[side] += high >> AUDIO_HIGHPASS_SHIFT;
+
+            if (out != NULL)
+            {
+                int32_t val = high / 65536;
+                val         = val > INT16_MAX ? INT16_MAX : val;
+                val         = val < INT16_MIN ? INT16_MIN : val;
+
+                out[i * 2 + side] = val;
+            }
+        }
+    }
+
+    // What's left still gets the tails of the steps added to it
+    uint32_t left = GetAvailableSamples(synth) - count + BLIP_TAPS;
+    for (int side = 0; side < 2; ++side)
+    {
+        memmove(synth->buffers[side], &synth->buffers[side][count],
+                left * sizeof(int32_t));
+        memset(&synth->buffers[side][left], 0,
+               (AUDIO_BUFFER_SAMPLES + BLIP_TAPS - left) * sizeof(int32_t));
+    }
+
+    // Rebased to the current cycle so the positions stay small
+    synth->baseOffset += (int64_t)count << 32;
+    synth->baseOffset -=
+        (int64_t)((synth->cycle - synth->baseCycle) * synth->samplesPerCycle);
+    synth->baseCycle = synth->cycle;
+}
+
+// Changes a channel's output, panned by NR51 and scaled by NR50
+void SetChannelLevel(GB *gb, uint8_t channel, uint8_t level, uint64_t cycle)
+{
+    APUSynth *synth = gb->synth;
+    uint8_t   nr50  = gb->io[IO_NR50 - IO_BASE];
+    uint8_t   nr51  = gb->io[IO_NR51 - IO_BASE];
+
+    synth->level[channel] = level;
+
+    for (int side = 0; side < 2; ++side)
+    {
+        // Right is the low nibble of both
+        uint8_t shift  = side == 0 ? 4 : 0;
+        int32_t volume = ((nr50 >> shift) & 0x7) + 1;
+        int32_t output = (nr51 >> (shift + channel) & 1) * level * volume *
+                         AUDIO_SCALE;
+
+        if (output != synth->outputs[channel][side])
+        {
+            AddDelta(synth, side, cycle, output - synth->outputs[channel][side]);
+            synth->outputs[channel][side] = output;
+        }
+    }
+}
+
+// Output of a channel at the current step of its waveform
+uint8_t GetChannelLevel(GB *gb, uint8_t channel)
+{
+    APUSynth *  synth = gb->synth;
+    APUChannel *ch    = &gb->apuChannels[channel];
+    uint8_t     pos   = synth->position[channel];
+
+    switch (channel)
+    {
+        case 0:
+        case 1:
+        {
+            uint8_t duty = GetChannelRegs(gb, channel)[1] >> 6;
+            return (dutyPatterns[duty] >> (7 - pos) & 1) * ch->volume;
+        }
+
+        case 2:
+        {
+            // Volume codes 1-3 shift the 4 bit samples by 0-2, 0 mutes
+            uint8_t code = (GetChannelRegs(gb, 2)[2] >> 5) & 0x3;
+            uint8_t byte = gb->io[IO_WAVE - IO_BASE + pos / 2];
+            uint8_t val  = (pos & 1) == 0 ? byte >> 4 : byte & 0xF;
+
+            return code == 0 ? 0 : val >> (code - 1);
+        }
+
+        default:
+            return (~synth->lfsr & 1) * ch->volume;
+    }
+}
+
+// Steps a channel's waveform through the cycles from..to
+void RunChannel(GB *gb, uint8_t channel, uint64_t from, uint64_t to)
+{
+    APUSynth *  synth = gb->synth;
+    APUChannel *ch    = &gb->apuChannels[channel];
+
+    if (!ch->enabled)
+    {
+        SetChannelLevel(gb, channel, 0, from);
+        return;
+    }
+
+    // Registers and envelopes only change between runs
+    SetChannelLevel(gb, channel, GetChannelLevel(gb, channel), from);
+
+    uint64_t period = GetChannelPeriod(gb, channel);
+    uint64_t next   = synth->nextStep[channel];
+    if (period == EVENT_NEVER)
+    {
+        return;
+    }
+    if (next < from)
+    {
+        next = from;
+    }
+
+    // Silent squares and waves skip straight to where they'll be
+    bool silent = channel == 2 ? ((GetChannelRegs(gb, 2)[2] >> 5) & 0x3) == 0
+                               : ch->volume == 0;
+
+    if (silent && channel != 3 && next < to)
+    {
+        uint64_t steps = (to - next + period - 1) / period;
+
+        synth->position[channel] += steps;
+        synth->position[channel] &= channel == 2 ? 31 : 7;
+        next += steps * period;
+    }
+
+    for (; next < to; next += period)
+    {
+        if (channel == 3)
+        {
+            // 15 bit LFSR, the 7 bit mode also feeds the result into bit 6
+            uint16_t lfsr = synth->lfsr;
+            uint16_t bit  = (lfsr ^ (lfsr >> 1)) & 1;
+
+            lfsr = (lfsr >> 1) | (bit << 14);
+            if ((GetChannelRegs(gb, 3)[3] & 0x8) > 0)
+            {
+                lfsr = (lfsr & ~0x40) | (bit << 6);
+            }
+            synth->lfsr = lfsr;
+        }
+        else
+        {
+            synth->position[channel] += 1;
+            synth->position[channel] &= channel == 2 ? 31 : 7;
+        }
+
+        SetChannelLevel(gb, channel, GetChannelLevel(gb, channel), next);
+    }
+
+    synth->nextStep[channel] = next;
+}
+
+// Synthesizes the sound up to the current cycle, needs to be called before
+// anything a channel's sound depends on changes
+void SyncAudio(GB *gb)
+{
+    APUSynth *synth = gb->synth;
+    if (synth == NULL)
+    {
+        return;
+    }
+
+    while (synth->cycle < gb->cycles)
+    {
+        uint64_t to = gb->cycles;
+        if (to - synth->cycle > AUDIO_CHUNK_CYCLES)
+        {
+            to = synth->cycle + AUDIO_CHUNK_CYCLES;
+        }
+
+        for (uint8_t i = 0; i < APU_CHANNELS; ++i)
+        {
+            RunChannel(gb, i, synth->cycle, to);
+        }
+        synth->cycle = to;
+
+        // Nobody is reading, make room
+        uint32_t available = GetAvailableSamples(synth);
+        uint32_t limit     = AUDIO_BUFFER_SAMPLES - BLIP_TAPS -
+                         (uint32_t)((AUDIO_CHUNK_CYCLES * synth->samplesPerCycle) >> 32);
+        if (available > limit)
+        {
+            TakeSamples(synth, NULL, available - limit);
+        }
+    }
+}
+
+// Starts synthesis from the current cycle, with every channel silent
+void ResetAudio(GB *gb)
+{
+    APUSynth *synth = gb->synth;
+    if (synth == NULL)
+    {
+        return;
+    }
+
+    synth->samplesPerCycle =
+        ((uint64_t)synth->sampleRate << 32) / GetClockRate(gb);
+    synth->cycle      = gb->cycles;
+    synth->baseCycle  = gb->cycles;
+    synth->baseOffset = 0;
+    synth->lfsr       = 0x7FFF;
+
+    for (int i = 0; i < APU_CHANNELS; ++i)
+    {
+        synth->nextStep[i]   = gb->cycles;
+        synth->position[i]   = 0;
+        synth->level[i]      = 0;
+        synth->outputs[i][0] = 0;
+        synth->outputs[i][1] = 0;
+    }
+
+    memset(synth->buffers, 0, sizeof(synth->buffers));
+    memset(synth->sums, 0, sizeof(synth->sums));
+    memset(synth->highPass, 0, sizeof(synth->highPass));
+}
+
+// Whether any frame sequencer step could change the channels
+bool APUNeedsClock(GB *gb)
+{
+    if (gb->apuChannels[0].enabled && gb->sweepEnabled)
+    {
+        return true;
+    }
+
+    for (int i = 0; i < APU_CHANNELS; ++i)
+    {
+        const APUChannel *ch = &gb->apuChannels[i];
+
+        if (((GetChannelRegs(gb, i)[4] & 0x40) > 0 && ch->length > 0) ||
+            ch->envelopeTimer > 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Counts the steps that passed while the frame sequencer had nothing to
+// clock, see ScheduleAPU
+void SyncFrameSequencer(GB *gb)
+{
+    if (gb->events[EVENT_APU] != EVENT_NEVER ||
+        (gb->io[IO_NR52 - IO_BASE] & 0x80) == 0 ||
+        gb->cycles <= gb->apuStepCycle)
+    {
+        return;
+    }
+
+    uint64_t period = GetAPUFrameCycles(gb);
+    uint64_t steps  = (gb->cycles - gb->apuStepCycle - 1) / period + 1;
+
+    gb->apuStep = (gb->apuStep + steps) & 0x7;
+    gb->apuStepCycle += steps * period;
+}
+
+// Schedules the next frame sequencer step while the APU is on and some
+// channel has a length, envelope or sweep running. Otherwise the steps are
+// only counted by SyncFrameSequencer, most of the time nothing is playing
+// and they would just cut HALTs short.
+void ScheduleAPU(GB *gb)
+{
+    bool powered = (gb->io[IO_NR52 - IO_BASE] & 0x80) > 0;
+
+    ScheduleEvent(gb, EVENT_APU,
+                  powered && APUNeedsClock(gb) ? gb->apuStepCycle
+                                               : EVENT_NEVER);
+}
+
+// Returns the next frequency of channel 1's sweep, disabling the channel
+// if it overflows
+uint16_t SweepFrequency(GB *gb)
+{
+    uint8_t  nr10  = GetChannelRegs(gb, 0)[0];
+    uint16_t delta = gb->sweepFrequency >> (nr10 & 0x7);
+    uint16_t freq  = (nr10 & 0x8) > 0 ? gb->sweepFrequency - delta
+                                      : gb->sweepFrequency + delta;
+
+    if (freq > 2047)
+    {
+        gb->apuChannels[0].enabled = false;
+    }
+
+    return freq;
+}
+
+void ClockSweep(GB *gb)
+{
+    uint8_t nr10   = GetChannelRegs(gb, 0)[0];
+    uint8_t period = (nr10 >> 4) & 0x7;
+
+    if (gb->sweepTimer > 0)
+    {
+        gb->sweepTimer -= 1;
+    }
+    if (gb->sweepTimer > 0)
+    {
+        return;
+    }
+
+    // A period of 0 counts as 8 for the timer but doesn't sweep
+    gb->sweepTimer = period > 0 ? period : 8;
+    if (!gb->sweepEnabled || period == 0)
+    {
+        return;
+    }
+
+    uint16_t freq = SweepFrequency(gb);
+    if (freq <= 2047 && (nr10 & 0x7) > 0)
+    {
+        uint8_t *regs = GetChannelRegs(gb, 0);
+
+        gb->sweepFrequency = freq;
+        regs[3]            = freq & 0xFF;
+        regs[4]            = (regs[4] & ~0x7) | (freq >> 8);
+
+        // Checked once more with the new frequency
+        SweepFrequency(gb);
+    }
+}
+
+void ClockEnvelopes(GB *gb)
+{
+    for (int i = 0; i < APU_CHANNELS; ++i)
+    {
+        APUChannel *ch     = &gb->apuChannels[i];
+        uint8_t     nrx2   = GetChannelRegs(gb, i)[2];
+        uint8_t     period = nrx2 & 0x7;
+
+        if (i == 2 || ch->envelopeTimer == 0 || --ch->envelopeTimer > 0)
+        {
+            continue;
+        }
+
+        ch->envelopeTimer = period;
+        if ((nrx2 & 0x8) > 0 && ch->volume < 15)
+        {
+            ch->volume += 1;
+        }
+        else if ((nrx2 & 0x8) == 0 && ch->volume > 0)
+        {
+            ch->volume -= 1;
+        }
+
+        // Stays at either end until triggered again
+        if ((nrx2 & 0x8) > 0 ? ch->volume == 15 : ch->volume == 0)
+        {
+            ch->envelopeTimer = 0;
+        }
+    }
+}
+
+void ClockLengths(GB *gb)
+{
+    for (int i = 0; i < APU_CHANNELS; ++i)
+    {
+        APUChannel *ch = &gb->apuChannels[i];
+
+        if ((GetChannelRegs(gb, i)[4] & 0x40) > 0 && ch->length > 0 &&
+            --ch->length == 0)
+        {
+            ch->enabled = false;
+        }
+    }
+}
+
+// Steps the frame sequencer: lengths at 256 Hz, the sweep at 128 Hz and the
+// envelopes at 64 Hz
+void APUEvent(GB *gb)
+{
+    SyncAudio(gb);
+
+    if ((gb->apuStep & 1) == 0)
+    {
+        ClockLengths(gb);
+    }
+    if (gb->apuStep == 2 || gb->apuStep == 6)
+    {
+        ClockSweep(gb);
+    }
+    if (gb->apuStep == 7)
+    {
+        ClockEnvelopes(gb);
+    }
+
+    gb->apuStep = (gb->apuStep + 1) & 0x7;
+    gb->apuStepCycle += GetAPUFrameCycles(gb);
+    ScheduleAPU(gb);
+}
+
+// Writing bit 7 of NRx4 restarts a channel
+void TriggerChannel(GB *gb, uint8_t channel)
+{
+    APUChannel *ch   = &gb->apuChannels[channel];
+    uint8_t *   regs = GetChannelRegs(gb, channel);
+
+    ch->enabled = ch->dacEnabled;
+    if (ch->length == 0)
+    {
+        ch->length = channel == 2 ? 256 : 64;
+    }
+
+    ch->volume        = regs[2] >> 4;
+    ch->envelopeTimer = regs[2] & 0x7;
+
+    if (channel == 0)
+    {
+        uint8_t period = (regs[0] >> 4) & 0x7;
+
+        gb->sweepFrequency = GetChannelFrequency(gb, 0);
+        gb->sweepTimer     = period > 0 ? period : 8;
+        gb->sweepEnabled   = period > 0 || (regs[0] & 0x7) > 0;
+
+        if ((regs[0] & 0x7) > 0)
+        {
+            SweepFrequency(gb);
+        }
+    }
+
+    if (gb->synth != NULL)
+    {
+        uint64_t period = GetChannelPeriod(gb, channel);
+
+        gb->synth->position[channel] = 0;
+        gb->synth->nextStep[channel] =
+            period == EVENT_NEVER ? gb->cycles : gb->cycles + period;
+        if (channel == 3)
+        {
+            gb->synth->lfsr = 0x7FFF;
+        }
+    }
+}
+
+uint8_t ReadAPU(GB *gb, uint16_t addr)
+{
+    uint8_t val = gb->io[addr - IO_BASE];
+
+    if (addr >= IO_WAVE)
+    {
+        return val;
+    }
+
+    if (addr == IO_NR52)
+    {
+        for (int i = 0; i < APU_CHANNELS; ++i)
+        {
+            val |= gb->apuChannels[i].enabled ? 1 << i : 0;
+        }
+    }
+
+    return val | apuReadMasks[addr - IO_NR10];
+}
+
+// Called between SyncFrameSequencer and ScheduleAPU, see WriteIO
+void WriteAPU(GB *gb, uint16_t addr, uint8_t val)
+{
+    uint8_t *reg     = &gb->io[addr - IO_BASE];
+    bool     powered = (gb->io[IO_NR52 - IO_BASE] & 0x80) > 0;
+
+    if (addr >= IO_WAVE)
+    {
+        *reg = val;
+        return;
+    }
+
+    if (addr == IO_NR52)
+    {
+        // Turning the APU off clears every register and stops the channels
+        *reg = val & 0x80;
+        if (powered && (val & 0x80) == 0)
+        {
+            memset(&gb->io[IO_NR10 - IO_BASE], 0, IO_NR52 - IO_NR10);
+            memset(gb->apuChannels, 0, sizeof(gb->apuChannels));
+        }
+        if (!powered && (val & 0x80) > 0)
+        {
+            // Steps on the next frame sequencer period since the divider
+            // was reset
+            uint64_t period  = GetAPUFrameCycles(gb);
+            uint64_t elapsed = gb->cycles - gb->divBase;
+
+            gb->apuStep      = 0;
+            gb->apuStepCycle = gb->divBase + (elapsed / period + 1) * period;
+        }
+        return;
+    }
+
+    // Read only while off
+    if (!powered || addr > IO_NR52)
+    {
+        return;
+    }
+    *reg = val;
+
+    if (addr >= IO_NR50)
+    {
+        return;
+    }
+
+    uint8_t     channel = (addr - IO_NR10) / 5;
+    APUChannel *ch      = &gb->apuChannels[channel];
+
+    switch ((addr - IO_NR10) % 5)
+    {
+        case 0:
+        {
+            if (channel == 2)
+            {
+                ch->dacEnabled = (val & 0x80) > 0;
+                ch->enabled    = ch->enabled && ch->dacEnabled;
+            }
+        }
+        break;
+
+        case 1:
+        {
+            ch->length = channel == 2 ? 256 - val : 64 - (val & 0x3F);
+        }
+        break;
+
+        case 2:
+        {
+            // The DAC is off while the volume is 0 and going down
+            if (channel != 2)
+            {
+                ch->dacEnabled = (val & 0xF8) > 0;
+                ch->enabled    = ch->enabled && ch->dacEnabled;
+            }
+        }
+        break;
+
+        case 4:
+        {
+            if ((val & 0x80) > 0)
+            {
+                TriggerChannel(gb, channel);
+            }
+        }
+        break;
+    }
+}
+
+// The input lines of JOYP, bits 0-3. Bit 4 low selects the directions, bit
+// 5 low the buttons. Pressed buttons read as 0.
+uint8_t GetJoypadLines(GB *gb)
+{
+    uint8_t joyp    = gb->io[IO_JOYP - IO_BASE];
+    uint8_t pressed = 0;
+
+    if ((joyp & 0x10) == 0)
+    {
+        pressed |= gb->buttons & 0xF;
+    }
+    if ((joyp & 0x20) == 0)
+    {
+        pressed |= gb->buttons >> 4;
+    }
+
+    return ~pressed & 0xF;
+}
+
+// The joypad interrupt is raised by any input line going low, either from
+// a button press or from selecting a group with one held
+void UpdateJoypad(GB *gb, uint8_t lines)
+{
+    if ((lines & ~GetJoypadLines(gb)) > 0)
+    {
+        RequestInterrupt(gb, JOYPAD_MASK);
+    }
+}
+
+// Reads from the I/O registers that aren't simply stored
+uint8_t ReadIO(GB *gb, uint16_t addr)
+{
+    if (addr >= HRAM_BASE)
+    {
+        return addr == IO_IE ? gb->ie : gb->hram[addr - HRAM_BASE];
+    }
+
+    if (gb->cgb && IsCGBRegister(addr))
+    {
+        return ReadCGB(gb, addr);
+    }
+
+    switch (addr)
+    {
+        case IO_JOYP:
+        {
+            return (gb->io[IO_JOYP - IO_BASE] & 0xF0) | GetJoypadLines(gb);
+        }
+
+        case IO_DIV:
+        {
+            return ((gb->cycles - gb->divBase) >> 8) & 0xFF;
+        }
+
+        case IO_TIMA:
+        {
+            SyncTimer(gb);
+        }
+        break;
+    }
+
+    if (addr >= IO_NR10 && addr < IO_WAVE_END)
+    {
+        return ReadAPU(gb, addr);
+    }
+
+    return gb->io[addr - IO_BASE];
+}
+
+// Writing DIV (or a speed switch) clears the divider
+void ResetDivider(GB *gb)
+{
+    SyncTimer(gb);
+
+    // Resetting the divider is a falling edge if the selected bit was set
+    uint8_t tac = gb->io[IO_TAC - IO_BASE];
+    if ((tac & 0x4) > 0 &&
+        ((gb->cycles - gb->divBase) >> timerBits[tac & 0b11] & 1) > 0)
+    {
+        IncrementTIMA(gb);
+    }
+
+    // The frame sequencer is clocked by the divider too
+    SyncFrameSequencer(gb);
+
+    gb->divBase      = gb->cycles;
+    gb->apuStepCycle = gb->cycles + GetAPUFrameCycles(gb);
+    ScheduleTimer(gb);
+    ScheduleAPU(gb);
+}
+
+// Writes to the I/O registers that have side effects beyond storing the value
+void WriteIO(GB *gb, uint16_t addr, uint8_t val)
+{
+    if (addr >= HRAM_BASE && addr != IO_IE)
+    {
+        gb->hram[addr - HRAM_BASE] = val;
+        return;
+    }
+
+    uint8_t *reg = addr == IO_IE ? &gb->ie : &gb->io[addr - IO_BASE];
+
+    if (gb->cgb && IsCGBRegister(addr))
+    {
+        WriteCGB(gb, addr, val);
+        return;
+    }
+
+    if (addr >= IO_NR10 && addr < IO_WAVE_END)
+    {
+        SyncAudio(gb);
+        SyncFrameSequencer(gb);
+        WriteAPU(gb, addr, val);
+        ScheduleAPU(gb);
+        return;
+    }
+
+    switch (addr)
+    {
+        case IO_JOYP:
+        {
+            uint8_t lines = GetJoypadLines(gb);
+
+            // Only the select bits are writable, see ReadIO
+            *reg = (val & 0x30) | 0xCF;
+            UpdateJoypad(gb, lines);
+        }
+        break;
+
+        case IO_SC:
+        {
+            *reg = val | 0x7E;
+
+            // Only transfers using the internal clock ever complete, there
+            // is no link partner to provide one
+            if ((val & 0x81) == 0x81)
+            {
+                if (gb->serialOutLength < SERIAL_OUT_SIZE)
+                {
+                    gb->serialOut[gb->serialOutLength++] =
+                        gb->io[IO_SB - IO_BASE];
+                }
+
+                gb->serialBits = 8;
+                ScheduleEvent(gb, EVENT_SERIAL,
+                              gb->cycles + SERIAL_BIT_CYCLES);
+            }
+        }
+        break;
+
+        case IO_DIV:
+        {
+            ResetDivider(gb);
+        }
+        break;
+
+        case IO_TIMA:
+        case IO_TMA:
+        case IO_TAC:
+        {
+            SyncTimer(gb);
+            *reg = addr == IO_TAC ? (val | 0xF8) : val;
+            ScheduleTimer(gb);
+        }
+        break;
+
+        case IO_DMA:
+        {
+            // OAM is filled in one go once the transfer would be done
+            *reg = val;
+            ScheduleEvent(gb, EVENT_DMA, gb->cycles + DMA_CYCLES);
+        }
+        break;
+
+        case IO_IF:
+        {
+            *reg         = val | 0xE0;
+            gb->irqCheck = true;
+        }
+        break;
+
+        case IO_IE:
+        {
+            *reg         = val;
+            gb->irqCheck = true;
+        }
+        break;
+
+        case IO_LCDC:
+        {
+            bool wasEnabled = (*reg & 0x80) > 0;
+            *reg            = val;
+
+            if (wasEnabled != ((val & 0x80) > 0))
+            {
+                SetLCDEnabled(gb, (val & 0x80) > 0);
+            }
+        }
+        break;
+
+        case IO_STAT:
+        {
+            // Mode and coincidence bits are read only
+            *reg = 0x80 | (val & 0x78) | (*reg & 0x07);
+            UpdateLCDStatus(gb);
+        }
+        break;
+
+        case IO_LY:
+        {
+            *reg = 0;
+            UpdateLCDStatus(gb);
+        }
+        break;
+
+        case IO_LYC:
+        {
+            *reg = val;
+            UpdateLCDStatus(gb);
+        }
+        break;
+
+        case IO_BOOT:
+        {
+            // Write once, an unmapped boot ROM never comes back
+            if (*reg == 0)
+            {
+                *reg = val;
+                MapMemory(gb);
+            }
+        }
+        break;
+
+        default:
+            *reg = val;
+    }
+}
+
+// Reads of the pages that are never mapped: I/O registers and HRAM, OAM
+// (0xFEA0-0xFEFF reads 0) and cartridge RAM behind its controller
+uint8_t ReadUnmapped(GB *gb, uint16_t addr)
+{
+    if (addr >= IO_BASE)
+    {
+        return ReadIO(gb, addr);
+    }
+
+    if (addr >= OAM_BASE)
+    {
+        return addr < OAM_END ? gb->oam[addr - OAM_BASE] : 0;
+    }
+
+    return gb->mbc->readRam(gb, addr);
+}
+
+uint8_t ReadMem(GB *gb, uint16_t addr)
+{
+    const uint8_t *page = gb->readPages[addr >> 8];
+    if (page != NULL)
+    {
+        return page[addr & 0xFF];
+    }
+
+    // Pages holding watchpoints are only in mappedReadPages
+    if (gb->debugger != NULL)
+    {
+        return ReadWatched(gb, addr);
+    }
+
+    return ReadUnmapped(gb, addr);
+}
+
+//-------------CGB-------------
+// Info from http://problemkaputt.de/pandocs.htm#cgbregisters
+//
+// The registers only do anything while gb->cgb, on a DMG they are stored
+// like any other unused one. Banked VRAM and WRAM are absorbed by the page
+// tables, see MapRamBanks.
+
+bool IsCGBRegister(uint16_t addr)
+{
+    return addr == IO_KEY1 || addr == IO_VBK ||
+           (addr >= IO_HDMA1 && addr <= IO_HDMA5) ||
+           (addr >= IO_BCPS && addr <= IO_OCPD) || addr == IO_SVBK;
+}
+
+// Moves a cycle still to come so the time left until it stays the same at
+// the other speed
+uint64_t ScaleToSpeed(uint64_t now, uint64_t when, bool doubled)
+{
+    if (when == EVENT_NEVER || when <= now)
+    {
+        return when;
+    }
+
+    return now + (doubled ? (when - now) * 2 : (when - now) / 2);
+}
+
+// Switches between normal and double speed. Cycles count CPU clocks, so
+// everything clocked by the PPU's rate has what's left of its current
+// period scaled to the new speed.
+void SetDoubleSpeed(GB *gb, bool enabled)
+{
+    SyncAudio(gb);
+    SyncRTC(gb);
+    SyncTimer(gb);
+    SyncFrameSequencer(gb);
+
+    uint64_t now = gb->cycles;
+
+    APUSynth *synth = gb->synth;
+    if (synth != NULL)
+    {
+        // Rebased so the sample positions carry on from the current cycle
+        synth->baseOffset -=
+            (int64_t)((now - synth->baseCycle) * synth->samplesPerCycle);
+        synth->baseCycle = now;
+
+        for (int i = 0; i < APU_CHANNELS; ++i)
+        {
+            synth->nextStep[i] = ScaleToSpeed(now, synth->nextStep[i], enabled);
+        }
+    }
+
+    // The part of the RTC's current second that has passed is scaled too
+    uint64_t rtcElapsed = now - gb->rtcCycle;
+    gb->rtcCycle = now - (enabled ? rtcElapsed * 2 : rtcElapsed / 2);
+
+    ScheduleEvent(gb, EVENT_PPU,
+                  ScaleToSpeed(now, gb->events[EVENT_PPU], enabled));
+
+    gb->doubleSpeed = enabled;
+    if (synth != NULL)
+    {
+        synth->samplesPerCycle =
+            ((uint64_t)synth->sampleRate << 32) / GetClockRate(gb);
+    }
+
+    // STOP resets the divider, then the CPU waits for the clock to settle
+    ResetDivider(gb);
+    gb->cycles += SPEED_SWITCH_CYCLES;
+}
+
+// Copies the next 16 byte block of a VRAM DMA into the selected VRAM bank,
+// stopping the CPU while it runs
+void CopyHDMABlock(GB *gb)
+{
+    uint8_t        bank   = GetVRAMBank(gb);
+    uint16_t       dest   = gb->hdmaDest;
+    int16_t        id     = (bank * VRAM_SIZE + dest) >> 8;
+    uint8_t *      out    = &gb->vram[bank * VRAM_SIZE + dest];
+    const uint8_t *source = gb->readPages[gb->hdmaSource >> 8];
+
+    if (gb->codePages[id])
+    {
+        InvalidateCode(gb, id);
+    }
+    gb->dirtyPages[id] = true;
+
+    // Blocks are 16 byte aligned, they never cross a page or tile
+    if (source != NULL)
+    {
+        memcpy(out, &source[gb->hdmaSource & 0xFF], HDMA_BLOCK_SIZE);
+    }
+    else
+    {
+        for (int i = 0; i < HDMA_BLOCK_SIZE; ++i)
+        {
+            out[i] = ReadMem(gb, gb->hdmaSource + i);
+        }
+    }
+
+    if (dest < VRAM_TILES_END - VRAM_BASE)
+    {
+        gb->tileDirty[bank * TILE_COUNT + (dest >> 4)] = true;
+    }
+
+    gb->hdmaSource += HDMA_BLOCK_SIZE;
+    gb->hdmaDest = (dest + HDMA_BLOCK_SIZE) & (VRAM_SIZE - 1);
+    gb->hdmaBlocks -= 1;
+    gb->hdmaActive = gb->hdmaActive && gb->hdmaBlocks > 0;
+
+    gb->cycles += GetPPUCycles(gb, HDMA_BLOCK_CYCLES);
+}
+
+// HDMA5 bit 7 clear copies every block at once, set one block per HBlank
+void StartHDMA(GB *gb, uint8_t val)
+{
+    // Clearing bit 7 while an HBlank transfer runs cancels it
+    if (gb->hdmaActive && (val & 0x80) == 0)
+    {
+        gb->hdmaActive = false;
+        return;
+    }
+
+    gb->hdmaBlocks = (val & 0x7F) + 1;
+
+    if ((val & 0x80) == 0)
+    {
+        while (gb->hdmaBlocks > 0)
+        {
+            CopyHDMABlock(gb);
+        }
+        return;
+    }
+
+    // Started in HBlank (where the PPU stays while the LCD is off), the
+    // first block is copied right away
+    gb->hdmaActive = true;
+    if (gb->ppuMode == PPU_MODE_HBLANK)
+    {
+        CopyHDMABlock(gb);
+    }
+}
+
+// Writes the palette byte selected by BCPS or OCPS, bit 7 of which steps it
+// to the next byte
+void WritePalette(uint8_t *spec, uint8_t *palettes, uint8_t val)
+{
+    palettes[*spec & 0x3F] = val;
+
+    if ((*spec & 0x80) > 0)
+    {
+        *spec = 0x80 | ((*spec + 1) & 0x3F);
+    }
+}
+
+uint8_t ReadCGB(GB *gb, uint16_t addr)
+{
+    uint8_t val = gb->io[addr - IO_BASE];
+
+    switch (addr)
+    {
+        case IO_KEY1:
+        {
+            return 0x7E | (gb->doubleSpeed ? 0x80 : 0) | (val & 1);
+        }
+
+        case IO_VBK:
+        {
+            return val | 0xFE;
+        }
+
+        case IO_HDMA5:
+        {
+            return (gb->hdmaActive ? 0 : 0x80) | ((gb->hdmaBlocks - 1) & 0x7F);
+        }
+
+        case IO_BCPS:
+        case IO_OCPS:
+        {
+            return val | 0x40;
+        }
+
+        case IO_BCPD:
+        {
+            return gb->bgPalettes[gb->io[IO_BCPS - IO_BASE] & 0x3F];
+        }
+
+        case IO_OCPD:
+        {
+            return gb->objPalettes[gb->io[IO_OCPS - IO_BASE] & 0x3F];
+        }
+
+        case IO_SVBK:
+        {
+            return val | 0xF8;
+        }
+    }
+
+    // The DMA source and destination are write only
+    return 0xFF;
+}
+
+void WriteCGB(GB *gb, uint16_t addr, uint8_t val)
+{
+    uint8_t *reg = &gb->io[addr - IO_BASE];
+
+    switch (addr)
+    {
+        case IO_KEY1:
+        {
+            // Only the switch request is writable, STOP does the switch
+            *reg = val & 1;
+        }
+        break;
+
+        case IO_VBK:
+        case IO_SVBK:
+        {
+            *reg = val & (addr == IO_VBK ? 0x1 : 0x7);
+            MapRamBanks(gb);
+        }
+        break;
+
+        case IO_HDMA1:
+        {
+            gb->hdmaSource = (val << 8) | (gb->hdmaSource & 0xF0);
+        }
+        break;
+
+        case IO_HDMA2:
+        {
+            gb->hdmaSource = (gb->hdmaSource & 0xFF00) | (val & 0xF0);
+        }
+        break;
+
+        case IO_HDMA3:
+        {
+            gb->hdmaDest = ((val & 0x1F) << 8) | (gb->hdmaDest & 0xF0);
+        }
+        break;
+
+        case IO_HDMA4:
+        {
+            gb->hdmaDest = (gb->hdmaDest & 0x1F00) | (val & 0xF0);
+        }
+        break;
+
+        case IO_HDMA5:
+        {
+            StartHDMA(gb, val);
+        }
+        break;
+
+        case IO_BCPS:
+        case IO_OCPS:
+        {
+            *reg = val & 0xBF;
+        }
+        break;
+
+        case IO_BCPD:
+        {
+            WritePalette(&gb->io[IO_BCPS - IO_BASE], gb->bgPalettes, val);
+        }
+        break;
+
+        case IO_OCPD:
+        {
+            WritePalette(&gb->io[IO_OCPS - IO_BASE], gb->objPalettes, val);
+        }
+        break;
+    }
+}
+
+//-------------Memory bank controllers-------------
+// Info from http://problemkaputt.de/pandocs.htm#memorybankcontrollers
+
+// Header RAM size codes
+const uint32_t cartRamSizes[6] = {0, 0x800, 0x2000, 0x8000, 0x20000, 0x10000};
+
+// Cartridge RAM that is disabled, absent or not mapped reads as open bus
+uint8_t ReadCartRamNone(GB *gb, uint16_t addr)
+{
+    return 0xFF;
+}
+
+void WriteCartRamNone(GB *gb, uint16_t addr, uint8_t val)
+{
+}
+
+void WriteMemRomOnly(GB *gb, uint16_t addr, uint8_t val)
+{
+    // No banking, writes to ROM are ignored
+}
+
+// MBC1, up to 2MB ROM and 32KB RAM
+// 0xA in the low bits of the RAM enable register enables cartridge RAM,
+// anything else disables it. Games disable it once they are done saving, so
+// that is when the save file is flushed.
+void WriteRamEnable(GB *gb, uint8_t val)
+{
+    bool enabled = (val & 0xF) == 0xA;
+
+    if (gb->ramEnabled && !enabled)
+    {
+        FlushSaveFile(gb);
+    }
+
+    gb->ramEnabled = enabled;
+}
+
+void WriteMemMBC1(GB *gb, uint16_t addr, uint8_t val)
+{
+    switch (addr >> 13)
+    {
+        // 0x0000-0x1FFF RAM enable
+        case 0:
+        {
+            WriteRamEnable(gb, val);
+        }
+        break;
+
+        // 0x2000-0x3FFF lower 5 bits of the ROM bank, 0 selects 1
+        case 1:
+        {
+            gb->mbc1Bank1 = val & 0x1F;
+            if (gb->mbc1Bank1 == 0)
+            {
+                gb->mbc1Bank1 = 1;
+            }
+        }
+        break;
+
+        // 0x4000-0x5FFF RAM bank or upper 2 bits of the ROM bank
+        case 2:
+        {
+            gb->mbc1Bank2 = val & 0b11;
+        }
+        break;
+
+        // 0x6000-0x7FFF banking mode, 1 also applies bank2 to 0x0000 and RAM
+        case 3:
+        {
+            gb->mbc1Mode = val & 0x1;
+        }
+        break;
+    }
+
+    gb->romBank  = (gb->mbc1Bank2 << 5) | gb->mbc1Bank1;
+    gb->romBank0 = gb->mbc1Mode ? gb->mbc1Bank2 << 5 : 0;
+    gb->ramBank  = gb->mbc1Mode ? gb->mbc1Bank2 : 0;
+
+    MapCart(gb);
+}
+
+// MBC2, up to 256KB ROM and 512x4 bits of built in RAM
+void WriteMemMBC2(GB *gb, uint16_t addr, uint8_t val)
+{
+    if (addr >= 0x4000)
+    {
+        return;
+    }
+
+    // Bit 8 of the address selects the register
+    if ((addr & 0x100) == 0)
+    {
+        WriteRamEnable(gb, val);
+    }
+    else
+    {
+        gb->romBank = val & 0xF;
+        if (gb->romBank == 0)
+        {
+            gb->romBank = 1;
+        }
+
+        MapCart(gb);
+    }
+}
+
+// The 512 bytes are echoed through 0xA000-0xBFFF, upper nibbles are open bus
+uint8_t ReadCartRamMBC2(GB *gb, uint16_t addr)
+{
+    if (!gb->ramEnabled)
+    {
+        return 0xFF;
+    }
+
+    return 0xF0 | gb->cartRam[addr & 0x1FF];
+}
+
+void WriteCartRamMBC2(GB *gb, uint16_t addr, uint8_t val)
+{
+    if (gb->ramEnabled)
+    {
+        gb->cartRam[addr & 0x1FF] = val & 0xF;
+        gb->dirtyPages[DIRTY_MEM_PAGES + ((addr & 0x1FF) >> 8)] = true;
+    }
+}
+
+#define RTC_DAY_SECONDS (24 * 60 * 60)
+#define RTC_DAYS 512
+
+// Brings the clock up to the current cycle
+void SyncRTC(GB *gb)
+{
+    if (gb->rtcHalt)
+    {
+        gb->rtcCycle = gb->cycles;
+        return;
+    }
+
+    uint64_t seconds = (gb->cycles - gb->rtcCycle) / GetClockRate(gb);
+    gb->rtcTime += seconds;
+    gb->rtcCycle += seconds * GetClockRate(gb);
+
+    // The day counter is 9 bits wide, overflowing sets the carry flag
+    if (gb->rtcTime >= (uint64_t)RTC_DAYS * RTC_DAY_SECONDS)
+    {
+        gb->rtcTime %= (uint64_t)RTC_DAYS * RTC_DAY_SECONDS;
+        gb->rtcCarry = true;
+    }
+}
+
+// Splits the clock into the seconds, minutes, hours, day low and day high
+// registers
+void GetRTCRegisters(GB *gb, uint8_t regs[5])
+{
+    uint64_t days = gb->rtcTime / RTC_DAY_SECONDS;
+
+    regs[0] = gb->rtcTime % 60;
+    regs[1] = (gb->rtcTime / 60) % 60;
+    regs[2] = (gb->rtcTime / 3600) % 24;
+    regs[3] = days & 0xFF;
+    regs[4] = ((days >> 8) & 0x1) | (gb->rtcHalt ? 0x40 : 0) |
+              (gb->rtcCarry ? 0x80 : 0);
+}
+
+// MBC3, up to 2MB ROM, 32KB RAM and a real time clock
+void WriteMemMBC3(GB *gb, uint16_t addr, uint8_t val)
+{
+    switch (addr >> 13)
+    {
+        // 0x0000-0x1FFF RAM and clock enable
+        case 0:
+        {
+            WriteRamEnable(gb, val);
+        }
+        break;
+
+        // 0x2000-0x3FFF ROM bank, 0 selects 1
+        case 1:
+        {
+            gb->romBank = val & 0x7F;
+            if (gb->romBank == 0)
+            {
+                gb->romBank = 1;
+            }
+        }
+        break;
+
+        // 0x4000-0x5FFF RAM bank (0x00-0x03) or clock register (0x08-0x0C)
+        case 2:
+        {
+            gb->ramBank = val & 0xF;
+        }
+        break;
+
+        // 0x6000-0x7FFF latches the clock on a 0 -> 1 write
+        case 3:
+        {
+            if (gb->rtcLatch == 0 && val == 1)
+            {
+                SyncRTC(gb);
+                GetRTCRegisters(gb, gb->rtcLatched);
+            }
+            gb->rtcLatch = val;
+        }
+        break;
+    }
+
+    MapCart(gb);
+}
+
+// Only reached when RAM is disabled or a clock register is selected
+uint8_t ReadCartRamMBC3(GB *gb, uint16_t addr)
+{
+    if (!gb->ramEnabled || gb->ramBank < 0x08 || gb->ramBank > 0x0C)
+    {
+        return 0xFF;
+    }
+
+    return gb->rtcLatched[gb->ramBank - 0x08];
+}
+
+void WriteCartRamMBC3(GB *gb, uint16_t addr, uint8_t val)
+{
+    if (!gb->ramEnabled || gb->ramBank < 0x08 || gb->ramBank > 0x0C)
+    {
+        return;
+    }
+
+    uint8_t regs[5];
+    SyncRTC(gb);
+    GetRTCRegisters(gb, regs);
+
+    regs[gb->ramBank - 0x08]           = val;
+    gb->rtcLatched[gb->ramBank - 0x08] = val;
+
+    uint64_t days = regs[3] | ((regs[4] & 0x1) << 8);
+    gb->rtcTime   = (regs[0] % 60) + (regs[1] % 60) * 60 +
+                  (regs[2] % 24) * 3600 + days * RTC_DAY_SECONDS;
+    gb->rtcHalt  = (regs[4] & 0x40) > 0;
+    gb->rtcCarry = (regs[4] & 0x80) > 0;
+    gb->rtcCycle = gb->cycles;
+}
+
+// MBC5, up to 8MB ROM (bank 0 can be mapped at 0x4000) and 128KB RAM
+void WriteMemMBC5(GB *gb, uint16_t addr, uint8_t val)
+{
+    if (addr < 0x2000)
+    {
+        WriteRamEnable(gb, val);
+    }
+    else if (addr < 0x3000)
+    {
+        gb->romBank = (gb->romBank & 0x100) | val;
+    }
+    else if (addr < 0x4000)
+    {
+        gb->romBank = (gb->romBank & 0xFF) | ((val & 0x1) << 8);
+    }
+    else if (addr < 0x6000)
+    {
+        // Bit 3 drives the motor of rumble carts
+        uint8_t type   = gb->cart[CART_CART_TYPE];
+        bool    rumble = type >= CART_TYPE_MBC5_RUMBLE &&
+                         type <= CART_TYPE_MBC5_RUMBLE_RAM_BATTERY;
+
+        gb->ramBank = val & (rumble ? 0x7 : 0xF);
+    }
+
+    MapCart(gb);
+}
+
+const MBC mbcRomOnly = {"ROM", WriteMemRomOnly, ReadCartRamNone,
+                        WriteCartRamNone, true, 1};
+const MBC mbc1 = {"MBC1", WriteMemMBC1, ReadCartRamNone, WriteCartRamNone,
+                  true, 4};
+const MBC mbc2 = {"MBC2", WriteMemMBC2, ReadCartRamMBC2, WriteCartRamMBC2,
+                  false, 0};
+const MBC mbc3 = {"MBC3", WriteMemMBC3, ReadCartRamMBC3, WriteCartRamMBC3,
+                  true, 8};
+const MBC mbc5 = {"MBC5", WriteMemMBC5, ReadCartRamNone, WriteCartRamNone,
+                  true, 16};
+
+// Returns the controller for a cartridge type, NULL if it isn't supported
+const MBC *GetMBC(uint8_t cartType)
+{
+    switch (cartType)
+    {
+        case CART_TYPE_ROM_ONLY:
+        case CART_TYPE_ROM_RAM:
+        case CART_TYPE_ROM_RAM_BATTERY:
+            return &mbcRomOnly;
+
+        case CART_TYPE_MBC1:
+        case CART_TYPE_MBC1_RAM:
+        case CART_TYPE_MBC1_RAM_BATTERY:
+            return &mbc1;
+
+        case CART_TYPE_MBC2:
+        case CART_TYPE_MBC2_BATTERY:
+            return &mbc2;
+
+        case CART_TYPE_MBC3_TIMER_BATTERY:
+        case CART_TYPE_MBC3_TIMER_RAM_BATTERY:
+        case CART_TYPE_MBC3:
+        case CART_TYPE_MBC3_RAM:
+        case CART_TYPE_MBC3_RAM_BATTERY:
+            return &mbc3;
+
+        case CART_TYPE_MBC5:
+        case CART_TYPE_MBC5_RAM:
+        case CART_TYPE_MBC5_RAM_BATTERY:
+        case CART_TYPE_MBC5_RUMBLE:
+        case CART_TYPE_MBC5_RUMBLE_RAM:
+        case CART_TYPE_MBC5_RUMBLE_RAM_BATTERY:
+            return &mbc5;
+    }
+
+    return NULL;
+}
+
+bool HasBattery(uint8_t cartType)
+{
+    switch (cartType)
+    {
+        case CART_TYPE_ROM_RAM_BATTERY:
+        case CART_TYPE_MBC1_RAM_BATTERY:
+        case CART_TYPE_MBC2_BATTERY:
+        case CART_TYPE_MBC3_TIMER_BATTERY:
+        case CART_TYPE_MBC3_TIMER_RAM_BATTERY:
+        case CART_TYPE_MBC3_RAM_BATTERY:
+        case CART_TYPE_MBC5_RAM_BATTERY:
+        case CART_TYPE_MBC5_RUMBLE_RAM_BATTERY:
+            return true;
+    }
+
+    return false;
+}
+
+// Picks the controller and allocates cartridge RAM from the header
+bool InitCart(GB *gb)
+{
+    gb->mbc = GetMBC(gb->cart[CART_CART_TYPE]);
+    if (gb->mbc == NULL)
+    {
+        printf("Unsupported cartridge type: 0x%02X\n",
+               gb->cart[CART_CART_TYPE]);
+        return false;
+    }
+
+    // A DMG boot ROM can't set the CGB up, the cartridge runs as on a DMG
+    gb->cgb = (gb->cart[CART_CGB_FLAG] & CGB_FLAG) &&
+              (gb->bootRom == NULL || gb->bootRomSize >= CGB_BOOT_ROM_SIZE);
+
+    uint8_t ramSize = gb->cart[CART_RAMSIZE];
+
+    gb->hasBattery = HasBattery(gb->cart[CART_CART_TYPE]);
+
+    gb->cartRamSize = ramSize < 6 ? cartRamSizes[ramSize] : 0;
+    if (gb->mbc == &mbc2)
+    {
+        gb->cartRamSize = 0x200;
+    }
+
+    if (gb->cartRamSize > 0)
+    {
+        gb->cartRam = calloc(1, gb->cartRamSize);
+        if (gb->cartRam == NULL)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Puts the controller back in its power up state
+void ResetCart(GB *gb)
+{
+    gb->romBank0  = 0;
+    gb->romBank   = 1;
+    gb->ramBank   = 0;
+    gb->mbc1Bank1 = 1;
+    gb->mbc1Bank2 = 0;
+    gb->mbc1Mode  = 0;
+    gb->rtcLatch  = 0xFF;
+    gb->rtcCycle  = 0;
+
+    // Carts without a controller have their RAM always enabled
+    gb->ramEnabled = gb->mbc == &mbcRomOnly;
+}
+
+void WriteMem(GB *gb, uint16_t addr, uint8_t val)
+{
+    uint8_t *page = gb->writePages[addr >> 8];
+    if (page != NULL)
+    {
+        page[addr & 0xFF] = val;
+        return;
+    }
+
+    int16_t id = gb->pageIds[addr >> 8];
+    if (id >= 0 && gb->codePages[id])
+    {
+        InvalidateCode(gb, id);
+    }
+
+    if (gb->debugger != NULL)
+    {
+        CheckWatchpoint(gb, addr, GB_WATCH_WRITE, val);
+    }
+
+    // First write to a page since the last snapshot, watched pages stay on
+    // the slow path
+    page = gb->mappedPages[addr >> 8];
+    if (page != NULL)
+    {
+        gb->dirtyPages[id] = true;
+        if (gb->debugger == NULL ||
+            !IsWatchedPage(gb, addr >> 8, GB_WATCH_WRITE))
+        {
+            gb->writePages[addr >> 8] = page;
+        }
+
+        page[addr & 0xFF] = val;
+        return;
+    }
+
+    if (addr >= IO_BASE)
+    {
+        WriteIO(gb, addr, val);
+    }
+    else if (addr >= OAM_BASE)
+    {
+        if (addr < OAM_END)
+        {
+            gb->oam[addr - OAM_BASE] = val;
+            gb->spritesDirty         = true;
+        }
+    }
+    else if (addr >= 0xA000 && addr < 0xC000)
+    {
+        gb->mbc->writeRam(gb, addr, val);
+    }
+    else if (addr >= VRAM_BASE)
+    {
+        // Tile data, the only RAM without mapped write pages
+        uint8_t bank = GetVRAMBank(gb);
+
+        gb->tileDirty[bank * TILE_COUNT + ((addr - VRAM_BASE) >> 4)] = true;
+        gb->dirtyPages[id]                             = true;
+        gb->vram[bank * VRAM_SIZE + addr - VRAM_BASE]  = val;
+    }
+    else
+    {
+        gb->mbc->write(gb, addr, val);
+    }
+}
+
+uint8_t *LoadRom(const char *filename, uint32_t *romSize)
+{
+    FILE *f = fopen(filename, "rb");
+    if (f == NULL)
+    {
+        return NULL;
+    }
+
+    fseek(f, 0, SEEK_END);
+    (*romSize) = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    uint8_t *rom = malloc(sizeof(uint8_t) * (*romSize));
+
+    fread(rom, (*romSize), 1, f);
+
+    fclose(f);
+
+    return rom;
+}
+
+//-------------ROM cache-------------
+// ROMs are mapped read only and shared by every GB running the same file, so
+// a fleet of instances pays for each cartridge once. Entries are released
+// when the last instance using them is destroyed.
+
+#define ROM_CACHE_SIZE 64
+
+typedef struct RomCacheEntrystruct
+{
+    char *   path;
+    uint8_t *data;
+    uint32_t size;
+    uint32_t refs;
+    bool     mapped;
+} RomCacheEntry;
+
+RomCacheEntry romCache[ROM_CACHE_SIZE];
+
+#ifndef WIN32
+pthread_mutex_t romCacheLock = PTHREAD_MUTEX_INITIALIZER;
+#define LockRomCache() pthread_mutex_lock(&romCacheLock)
+#define UnlockRomCache() pthread_mutex_unlock(&romCacheLock)
+#else
+#define LockRomCache()
+#define UnlockRomCache()
+#endif
+
+// Maps a file read only, returns NULL if it can't be mapped
+uint8_t *MapRomFile(const char *filename, uint32_t *romSize)
+{
+#ifndef WIN32
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    (*romSize) = st.st_size;
+    return data;
+#else
+    return NULL;
+#endif
+}
+
+// Returns the shared contents of a ROM file, loading it on first use. Every
+// call has to be paired with ReleaseRom.
+uint8_t *AcquireRom(const char *filename, uint32_t *romSize)
+{
+    LockRomCache();
+
+    RomCacheEntry *entry = NULL;
+    for (int i = 0; i < ROM_CACHE_SIZE; ++i)
+    {
+        if (romCache[i].refs > 0 && strcmp(romCache[i].path, filename) == 0)
+        {
+            entry = &romCache[i];
+            break;
+        }
+        else if (entry == NULL && romCache[i].refs == 0)
+        {
+            entry = &romCache[i];
+        }
+    }
+
+    if (entry == NULL)
+    {
+        UnlockRomCache();
+        printf("ROM cache is full\n");
+        return NULL;
+    }
+
+    if (entry->refs == 0)
+    {
+        entry->mapped = true;
+        entry->data   = MapRomFile(filename, &entry->size);
+
+        // Fall back to a private heap copy where mmap isn't available
+        if (entry->data == NULL)
+        {
+            entry->mapped = false;
+            entry->data   = LoadRom(filename, &entry->size);
+        }
+
+        if (entry->data == NULL)
+        {
+            UnlockRomCache();
+            return NULL;
+        }
+
+        entry->path = strdup(filename);
+    }
+
+    entry->refs += 1;
+    (*romSize) = entry->size;
+
+    UnlockRomCache();
+    return entry->data;
+}
+
+void ReleaseRom(uint8_t *rom)
+{
+    LockRomCache();
+
+    for (int i = 0; i < ROM_CACHE_SIZE; ++i)
+    {
+        RomCacheEntry *entry = &romCache[i];
+        if (entry->refs == 0 || entry->data != rom)
+        {
+            continue;
+        }
+
+        entry->refs -= 1;
+        if (entry->refs == 0)
+        {
+#ifndef WIN32
+            if (entry->mapped)
+            {
+                munmap(entry->data, entry->size);
+            }
+            else
+#endif
+            {
+                free(entry->data);
+            }
+
+            free(entry->path);
+            entry->path = NULL;
+            entry->data = NULL;
+        }
+        break;
+    }
+
+    UnlockRomCache();
+}
+
+//-------------Save files-------------
+// Battery buffered RAM is a shared mapping of its save file, so saving costs
+// nothing more than the writes the game makes. The OS writes the dirty
+// pages back on its own schedule, FlushSaveFile only asks it to start.
+// Without mmap the RAM is a copy of the file that is written back whole.
+
+// Maps size bytes of a save file read write, creating or growing it as
+// needed. A new file is filled with ram. Returns NULL if it can't be mapped.
+uint8_t *MapSaveFile(const char *path, const uint8_t *ram, uint32_t size)
+{
+#ifndef WIN32
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (st.st_size < size && ftruncate(fd, size) != 0))
+    {
+        close(fd);
+        return NULL;
+    }
+
+    void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    if (st.st_size == 0)
+    {
+        memcpy(data, ram, size);
+    }
+
+    return data;
+#else
+    return NULL;
+#endif
+}
+
+// Reads a save file into a copy of ram, a new file keeps ram as it is.
+// Returns NULL if the file can't be opened for writing.
+uint8_t *LoadSaveFile(const char *path, const uint8_t *ram, uint32_t size)
+{
+    FILE *f = fopen(path, "r+b");
+    if (f == NULL)
+    {
+        f = fopen(path, "w+b");
+    }
+    if (f == NULL)
+    {
+        return NULL;
+    }
+
+    uint8_t *copy = malloc(size);
+    if (copy != NULL)
+    {
+        memcpy(copy, ram, size);
+        fread(copy, 1, size, f);
+    }
+
+    fclose(f);
+    return copy;
+}
+
+void FlushSaveFile(GB *gb)
+{
+    if (gb->savePath == NULL)
+    {
+        return;
+    }
+
+#ifndef WIN32
+    if (gb->saveMapped)
+    {
+        msync(gb->cartRam, gb->cartRamSize, MS_ASYNC);
+        return;
+    }
+#endif
+
+    FILE *f = fopen(gb->savePath, "r+b");
+    if (f == NULL)
+    {
+        f = fopen(gb->savePath, "wb");
+    }
+    if (f == NULL)
+    {
+        printf("Failed to write save file: %s\n", gb->savePath);
+        return;
+    }
+
+    fwrite(gb->cartRam, 1, gb->cartRamSize, f);
+    fclose(f);
+}
+
+// Drops the cartridge RAM, flushing the save file it is kept in
+void FreeCartRam(GB *gb)
+{
+    FlushSaveFile(gb);
+
+#ifndef WIN32
+    if (gb->saveMapped)
+    {
+        munmap(gb->cartRam, gb->cartRamSize);
+    }
+    else
+#endif
+    {
+        free(gb->cartRam);
+    }
+
+    free(gb->savePath);
+    gb->cartRam    = NULL;
+    gb->savePath   = NULL;
+    gb->saveMapped = false;
+}
+
+void DumpCPURegisters(GB *gb)
+{
+    MaterializeFlags(gb);
+
+    printf("CPU Registers\n");
+    printf("\tA: 0x%01x\n", gb->regs[REG_AF]);
+    printf("\tBC: 0x%02x\n", gb->regs[REG_BC]);
+    printf("\tDE: 0x%02x\n", gb->regs[REG_DE]);
+    printf("\tHL: 0x%02x\n", gb->regs[REG_HL]);
+    printf("\tSP: 0x%02x\n", gb->regs[REG_SP]);
+    printf("PC: 0x%02x\n", gb->regs[REG_PC]);
+    printf("Cycles: %" PRIu64 "\n", gb->cycles);
+}
+
+void DumpRomInfo(GB *gb)
+{
+    printf("Rom Info\n");
+    printf("\tTitle: %s\n", &gb->cart[CART_TITLE]);
+    printf("\tCart Type: 0x%01X\n", gb->cart[CART_CART_TYPE]);
+    printf("\tROM Size: 0x%01X\n", gb->cart[CART_ROMSIZE]);
+    printf("\tRAM Size: 0x%01X\n", gb->cart[CART_RAMSIZE]);
+    printf("\tModel: %s\n", gb->cgb ? "CGB" : "DMG");
+
+    if (!gb->cgb && (gb->cart[CART_CGB_FLAG] & CGB_FLAG) > 0)
+    {
+        printf("\tCGB cartridge started by a DMG boot ROM, running as a "
+               "DMG\n");
+    }
+}
+
+#ifdef GB_PROFILE
+//-------------Profiler-------------
+
+#define PROFILE_TOP_PCS 32
+
+typedef struct ProfileEntrystruct
+{
+    uint32_t       key;
+    ProfileCounter counter;
+} ProfileEntry;
+
+// Most cycles first
+int CompareProfileEntries(const void *a, const void *b)
+{
+    const ProfileEntry *x = a;
+    const ProfileEntry *y = b;
+
+    if (x->counter.cycles != y->counter.cycles)
+    {
+        return x->counter.cycles < y->counter.cycles ? 1 : -1;
+    }
+    return x->key < y->key ? -1 : 1;
+}
+
+// Prints up to limit of the counters that were hit, hottest first
+void DumpProfileTable(const char *title, const char *keyFormat,
+                      const ProfileCounter *counters, uint32_t count,
+                      uint32_t limit)
+{
+    ProfileEntry *entries = malloc(count * sizeof(ProfileEntry));
+    uint32_t      used    = 0;
+    uint64_t      total   = 0;
+
+    if (entries == NULL)
+    {
+        return;
+    }
+
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        if (counters[i].count > 0)
+        {
+            entries[used].key     = i;
+            entries[used].counter = counters[i];
+            used += 1;
+            total += counters[i].cycles;
+        }
+    }
+
+    qsort(entries, used, sizeof(ProfileEntry), CompareProfileEntries);
+
+    printf("%s (%u hit, %" PRIu64 " cycles)\n", title, used, total);
+    printf("\t%-8s %14s %16s %7s\n", "", "count", "cycles", "%");
+
+    for (uint32_t i = 0; i < used && i < limit; ++i)
+    {
+        char key[16];
+        snprintf(key, sizeof(key), keyFormat, entries[i].key);
+
+        printf("\t%-8s %14" PRIu64 " %16" PRIu64 " %6.2f%%\n", key,
+               entries[i].counter.count, entries[i].counter.cycles,
+               100.0 * entries[i].counter.cycles / total);
+    }
+
+    free(entries);
+}
+
+void DumpProfile(GB *gb)
+{
+    Profile *profile = gb->profile;
+
+    DumpProfileTable("Opcodes", "0x%02X", profile->opcodes, 256, 256);
+    DumpProfileTable("CB Opcodes", "0xCB%02X", profile->cbOpcodes, 256, 256);
+    DumpProfileTable("Hot PCs", "$%04X", profile->pcs, 0x10000,
+                     PROFILE_TOP_PCS);
+}
+#endif
+
+//-------------PPU-------------
+
+// Shades for the four palette colors
+const uint32_t shades[4] = {
+    0xFFFFFFFF,
+    0x7E7E7EFF,
+    0x3F3F3FFF,
+    0xFF,
+};
+
+// Decodes the 16 bytes of a tile to its 8x8 color indices, leftmost pixel
+// first. Each row is two bit planes, the first holding the low bits.
+void DecodeTile(const uint8_t *data, uint8_t (*out)[8])
+{
+#if defined(GB_SIMD_SSE2)
+    // Pixel tx of a row tests bit 7 - tx of both planes
+    const __m128i bits = _mm_set_epi8(1, 2, 4, 8, 16, 32, 64, (char)128, 1, 2,
+                                      4, 8, 16, 32, 64, (char)128);
+    const __m128i lowByte = _mm_set1_epi16(0xFF);
+    const __m128i one     = _mm_set1_epi8(1);
+    const __m128i two     = _mm_set1_epi8(2);
+
+    // Splits the planes and repeats each row's byte over its 8 pixels, two
+    // rows per register
+    __m128i data16 = _mm_loadu_si128((const __m128i *)data);
+    __m128i planes = _mm_packus_epi16(_mm_and_si128(data16, lowByte),
+                                      _mm_srli_epi16(data16, 8));
+    __m128i x2     = _mm_unpacklo_epi8(planes, planes);
+    __m128i y2     = _mm_unpackhi_epi8(planes, planes);
+    __m128i x4[2]  = {_mm_unpacklo_epi16(x2, x2), _mm_unpackhi_epi16(x2, x2)};
+    __m128i y4[2]  = {_mm_unpacklo_epi16(y2, y2), _mm_unpackhi_epi16(y2, y2)};
+
+    for (int i = 0; i < 4; ++i)
+    {
+        __m128i low  = (i & 1) == 0 ? _mm_unpacklo_epi32(x4[i / 2], x4[i / 2])
+                                    : _mm_unpackhi_epi32(x4[i / 2], x4[i / 2]);
+        __m128i high = (i & 1) == 0 ? _mm_unpacklo_epi32(y4[i / 2], y4[i / 2])
+                                    : _mm_unpackhi_epi32(y4[i / 2], y4[i / 2]);
+
+        // 0xFF for every bit set in the plane
+        __m128i lowSet  = _mm_cmpeq_epi8(_mm_and_si128(low, bits), bits);
+        __m128i highSet = _mm_cmpeq_epi8(_mm_and_si128(high, bits), bits);
+        __m128i color   = _mm_or_si128(_mm_and_si128(lowSet, one),
+                                       _mm_and_si128(highSet, two));
+
+        _mm_storeu_si128((__m128i *)out[i * 2], color);
+    }
+#elif defined(GB_SIMD_NEON)
+    const uint8x8_t bits = {128, 64, 32, 16, 8, 4, 2, 1};
+
+    for (int ty = 0; ty < 8; ++ty)
+    {
+        uint8x8_t low  = vtst_u8(vdup_n_u8(data[ty * 2]), bits);
+        uint8x8_t high = vtst_u8(vdup_n_u8(data[ty * 2 + 1]), bits);
+
+        vst1_u8(out[ty], vorr_u8(vand_u8(low, vdup_n_u8(1)),
+                                 vand_u8(high, vdup_n_u8(2))));
+    }
+#else
+    for (int ty = 0; ty < 8; ++ty)
+    {
+        uint8_t row1 = data[ty * 2];
+        uint8_t row2 = data[ty * 2 + 1];
+
+        for (int tx = 0; tx < 8; ++tx)
+        {
+            uint8_t color = (row1 >> (7 - tx)) & 1;
+            color |= ((row2 >> (7 - tx)) & 1) << 1;
+
+            out[ty][tx] = color;
+        }
+    }
+#endif
+}
+
+// Returns the decoded color indices of a tile, decoding it again if VRAM
+// changed since it was last used. Tiles from TILE_COUNT on are in VRAM bank
+// 1.
+uint8_t (*GetTile(GB *gb, uint16_t tile))[8]
+{
+    if (gb->tileDirty[tile])
+    {
+        uint32_t offset =
+            (tile / TILE_COUNT) * VRAM_SIZE + (tile % TILE_COUNT) * 16;
+
+        DecodeTile(&gb->vram[offset], gb->tileCache[tile]);
+        gb->tileDirty[tile] = false;
+    }
+
+    return gb->tileCache[tile];
+}
+
+// Shades of a BGP/OBP palette's four colors
+void GetPaletteShades(uint8_t palette, uint32_t lut[4])
+{
+    for (int i = 0; i < 4; ++i)
+    {
+        lut[i] = shades[(palette >> (i * 2)) & 0b11];
+    }
+}
+
+// Writes the shades of count color indices, count a multiple of 8. Reads
+// them 8 at a time from 8 byte aligned offsets, the way they were written.
+//
+// Each pixel is a byte shuffle of the four shades. SSE2 alone has no byte
+// shuffle and selecting the shades with compares loses to the plain lookup.
+void MapPalette(const uint8_t *colors, const uint32_t lut[4], uint32_t *out,
+                int count)
+{
+#if defined(GB_SIMD_SSSE3)
+    const __m128i table = _mm_loadu_si128((const __m128i *)lut);
+    // Repeat pixel 0-3 (4-7) of the 8 over the bytes of its shade, whose
+    // offsets are then added to the index times 4
+    const __m128i spread[2] = {
+        _mm_set_epi8(3, 3, 3, 3, 2, 2, 2, 2, 1, 1, 1, 1, 0, 0, 0, 0),
+        _mm_set_epi8(7, 7, 7, 7, 6, 6, 6, 6, 5, 5, 5, 5, 4, 4, 4, 4)};
+    const __m128i offsets = _mm_set1_epi32(0x03020100);
+
+    for (int x = 0; x < count; x += 8)
+    {
+        __m128i c = _mm_slli_epi16(
+            _mm_loadl_epi64((const __m128i *)&colors[x]), 2);
+
+        for (int i = 0; i < 2; ++i)
+        {
+            __m128i bytes =
+                _mm_add_epi8(_mm_shuffle_epi8(c, spread[i]), offsets);
+            _mm_storeu_si128((__m128i *)&out[x + i * 4],
+                             _mm_shuffle_epi8(table, bytes));
+        }
+    }
+#elif defined(GB_SIMD_NEON)
+    // Byte offsets of each pixel's four bytes in the shades
+    const uint8x16_t offsets = {0, 1, 2, 3, 0, 1, 2, 3,
+                                0, 1, 2, 3, 0, 1, 2, 3};
+    uint8x16_t       table   = vld1q_u8((const uint8_t *)lut);
+
+    for (int x = 0; x < count; x += 8)
+    {
+        // Every index times 4 repeated for the bytes of its pixel
+        uint8x8_t    c  = vshl_n_u8(vld1_u8(&colors[x]), 2);
+        uint8x8x2_t  c2 = vzip_u8(c, c);
+        uint8x16_t   c8 = vcombine_u8(c2.val[0], c2.val[1]);
+        uint8x16x2_t c4 = vzipq_u8(c8, c8);
+
+        vst1q_u8((uint8_t *)&out[x],
+                 vqtbl1q_u8(table, vaddq_u8(c4.val[0], offsets)));
+        vst1q_u8((uint8_t *)&out[x + 4],
+                 vqtbl1q_u8(table, vaddq_u8(c4.val[1], offsets)));
+    }
+#else
+    for (int x = 0; x < count; ++x)
+    {
+        out[x] = lut[colors[x]];
+    }
+#endif
+}
+
+// Room on either side of a line's color indices for tile rows partly off
+// the screen
+#define TILE_ROW_PADDING 8
+
+// Maps a BG/window tile map entry to its tile
+uint16_t GetBGTile(uint8_t lcdControl, uint8_t tileIndex)
+{
+    // 0x8800 addressing uses signed indices relative to 0x9000
+    if ((lcdControl & 0x10) > 0)
+    {
+        return tileIndex;
+    }
+
+    return 256 + (int8_t)tileIndex;
+}
+
+// Sorts the sprites into the lines they're on. Each line gets the first 10
+// in OAM order, sorted so the lowest X (then lowest OAM index) comes first.
+// The CGB draws them in OAM order.
+void BuildLineSprites(GB *gb, uint8_t height)
+{
+    const uint8_t *oam = gb->oam;
+
+    memset(gb->lineSpriteCounts, 0, sizeof(gb->lineSpriteCounts));
+
+    for (int i = 0; i < OAM_SPRITES; ++i)
+    {
+        const uint8_t *sprite = &oam[i * 4];
+        int            top    = sprite[0] - 16;
+        int            first  = top > 0 ? top : 0;
+        int            last   = top + height < GB_VID_HEIGHT ? top + height
+                                                             : GB_VID_HEIGHT;
+
+        for (int ly = first; ly < last; ++ly)
+        {
+            uint8_t *sprites = gb->lineSprites[ly];
+            if (gb->lineSpriteCounts[ly] == SPRITES_PER_LINE)
+            {
+                continue;
+            }
+
+            int j = gb->lineSpriteCounts[ly]++;
+            while (!gb->cgb && j > 0 && oam[sprites[j - 1] * 4 + 1] > sprite[1])
+            {
+                sprites[j] = sprites[j - 1];
+                j -= 1;
+            }
+            sprites[j] = i;
+        }
+    }
+
+    gb->lineSpriteHeight = height;
+    gb->spritesDirty     = false;
+}
+
+// Framebuffer pixels of the 32 colors of CGB palette RAM, RGB555 expanded
+// to 8 bits per channel
+void GetCGBColors(const uint8_t *palettes, uint32_t lut[32])
+{
+    for (int i = 0; i < 32; ++i)
+    {
+        uint16_t color = palettes[i * 2] | (palettes[i * 2 + 1] << 8);
+        uint32_t pixel = 0xFF;
+
+        for (int c = 0; c < 3; ++c)
+        {
+            uint8_t val = (color >> (c * 5)) & 0x1F;
+            pixel |= (uint32_t)((val << 3) | (val >> 2)) << (24 - c * 8);
+        }
+
+        lut[i] = pixel;
+    }
+}
+
+// Draws BG or window tiles from the map row at offset row of VRAM into
+// pixels from onwards, pixel from being pixel x of the map row. Keeps each
+// pixel's color index and the attributes of its tile from VRAM bank 1.
+void DrawCGBTiles(GB *gb, uint16_t row, uint8_t y, int from, uint8_t x,
+                  uint8_t *colors, uint8_t *attrs)
+{
+    uint8_t        lcdControl = gb->io[IO_LCDC - IO_BASE];
+    const uint8_t *pixels     = NULL;
+    uint8_t        attr       = 0;
+
+    for (int px = from; px < GB_VID_WIDTH; ++px, ++x)
+    {
+        if (pixels == NULL || x % 8 == 0)
+        {
+            uint16_t entry = row + x / 8;
+            uint16_t tile  = GetBGTile(lcdControl, gb->vram[entry]);
+
+            attr = gb->vram[VRAM_SIZE + entry];
+            if ((attr & BG_ATTR_BANK) > 0)
+            {
+                tile += TILE_COUNT;
+            }
+
+            pixels = GetTile(gb, tile)[(attr & BG_ATTR_FLIP_Y) > 0 ? 7 - y % 8
+                                                                   : y % 8];
+        }
+
+        colors[px] = pixels[(attr & BG_ATTR_FLIP_X) > 0 ? 7 - x % 8 : x % 8];
+        attrs[px]  = attr;
+    }
+}
+
+// RenderScanline of the CGB: every BG tile picks its palette, bank, flips
+// and priority and LCDC bit 0 drops the BG's priority instead of the BG
+void RenderScanlineCGB(GB *gb)
+{
+    uint8_t   ly         = gb->io[IO_LY - IO_BASE];
+    uint8_t   lcdControl = gb->io[IO_LCDC - IO_BASE];
+    uint32_t *line       = &gb->framebuffer[ly * GB_VID_WIDTH];
+
+    if (ly == 0)
+    {
+        gb->windowLine = 0;
+    }
+
+    uint8_t bgColors[GB_VID_WIDTH];
+    uint8_t bgAttrs[GB_VID_WIDTH];
+
+    uint8_t  scy   = gb->io[IO_SCY - IO_BASE];
+    uint8_t  scx   = gb->io[IO_SCX - IO_BASE];
+    uint16_t bgMap = (lcdControl & 0x8) > 0 ? 0x9C00 : 0x9800;
+    uint8_t  y     = scy + ly;
+
+    DrawCGBTiles(gb, bgMap - VRAM_BASE + (y / 8) * 32, y, 0, scx, bgColors,
+                 bgAttrs);
+
+    uint8_t wy = gb->io[IO_WY - IO_BASE];
+    int     wx = gb->io[IO_WX - IO_BASE] - 7;
+
+    if ((lcdControl & 0x20) > 0 && ly >= wy && wx < GB_VID_WIDTH)
+    {
+        uint16_t winMap = (lcdControl & 0x40) > 0 ? 0x9C00 : 0x9800;
+        uint8_t  winY   = gb->windowLine;
+        int      from   = wx > 0 ? wx : 0;
+
+        DrawCGBTiles(gb, winMap - VRAM_BASE + (winY / 8) * 32, winY, from,
+                     from - wx, bgColors, bgAttrs);
+
+        gb->windowLine += 1;
+    }
+
+    uint32_t lut[32];
+    GetCGBColors(gb->bgPalettes, lut);
+
+    for (int x = 0; x < GB_VID_WIDTH; ++x)
+    {
+        line[x] = lut[(bgAttrs[x] & BG_ATTR_PALETTE) * 4 + bgColors[x]];
+    }
+
+    if ((lcdControl & 0x2) == 0)
+    {
+        return;
+    }
+
+    uint8_t height = (lcdControl & 0x4) > 0 ? 16 : 8;
+    if (gb->spritesDirty || gb->lineSpriteHeight != height)
+    {
+        BuildLineSprites(gb, height);
+    }
+
+    GetCGBColors(gb->objPalettes, lut);
+
+    // Pixels already taken by a higher priority sprite
+    bool covered[GB_VID_WIDTH] = {0};
+    bool bgPriority            = (lcdControl & 0x1) > 0;
+
+    for (int i = 0; i < gb->lineSpriteCounts[ly]; ++i)
+    {
+        const uint8_t *sprite = &gb->oam[gb->lineSprites[ly][i] * 4];
+        uint8_t        flags  = sprite[3];
+
+        uint8_t ty = ly - (sprite[0] - 16);
+        if ((flags & SPRITE_FLIP_Y) > 0)
+        {
+            ty = height - 1 - ty;
+        }
+
+        uint16_t tile = sprite[2];
+        if (height == 16)
+        {
+            tile = (tile & 0xFE) + ty / 8;
+        }
+        if ((flags & SPRITE_BANK) > 0)
+        {
+            tile += TILE_COUNT;
+        }
+        const uint8_t * row    = GetTile(gb, tile)[ty % 8];
+        const uint32_t *colors = &lut[(flags & SPRITE_CGB_PALETTE) * 4];
+
+        for (int tx = 0; tx < 8; ++tx)
+        {
+            int x = sprite[1] - 8 + tx;
+            if (x < 0 || x >= GB_VID_WIDTH || covered[x])
+            {
+                continue;
+            }
+
+            uint8_t color = row[(flags & SPRITE_FLIP_X) > 0 ? 7 - tx : tx];
+            if (color == 0)
+            {
+                continue;
+            }
+
+            // Either priority flag puts BG colors 1-3 on top
+            covered[x] = true;
+            if (bgPriority && bgColors[x] != 0 &&
+                ((flags & SPRITE_BEHIND_BG) > 0 ||
+                 (bgAttrs[x] & BG_ATTR_PRIORITY) > 0))
+            {
+                continue;
+            }
+
+            line[x] = colors[color];
+        }
+    }
+}
+
+// Draws line LY of the background, window and sprites into the framebuffer
+void RenderScanline(GB *gb)
+{
+    if (gb->cgb)
+    {
+        RenderScanlineCGB(gb);
+        return;
+    }
+
+    uint8_t ly         = gb->io[IO_LY - IO_BASE];
+    uint8_t lcdControl = gb->io[IO_LCDC - IO_BASE];
+    uint8_t bgp        = gb->io[IO_BGP - IO_BASE];
+
+    if (ly == 0)
+    {
+        gb->windowLine = 0;
+    }
+
+    // Color indices before the palette, sprite priority depends on them.
+    // Whole tile rows are copied in, the padding takes those crossing either
+    // edge of the screen.
+    uint8_t   colorRow[TILE_ROW_PADDING + GB_VID_WIDTH + 2 * TILE_ROW_PADDING];
+    uint8_t * bgColors = &colorRow[TILE_ROW_PADDING];
+    uint32_t *line     = &gb->framebuffer[ly * GB_VID_WIDTH];
+
+    memset(bgColors, 0, GB_VID_WIDTH);
+
+    if ((lcdControl & 0x1) > 0)
+    {
+        uint8_t  scy   = gb->io[IO_SCY - IO_BASE];
+        uint8_t  scx   = gb->io[IO_SCX - IO_BASE];
+        uint16_t bgMap = (lcdControl & 0x8) > 0 ? 0x9C00 : 0x9800;
+
+        uint8_t        y   = scy + ly;
+        const uint8_t *row = &gb->vram[bgMap - VRAM_BASE + (y / 8) * 32];
+
+        // Every 8 pixels are the end of one tile row and the start of the
+        // next, put together as little endian words and stored aligned for
+        // MapPalette. The map wraps around after 32 tiles.
+        unsigned fine = (scx % 8) * 8;
+        uint64_t left, right;
+
+        memcpy(&left,
+               GetTile(gb, GetBGTile(lcdControl, row[scx / 8]))[y % 8], 8);
+
+        for (int t = 1; t <= GB_VID_WIDTH / 8; ++t)
+        {
+            uint16_t tile = GetBGTile(lcdControl, row[(scx / 8 + t) % 32]);
+            memcpy(&right, GetTile(gb, tile)[y % 8], 8);
+
+            uint64_t pixels =
+                fine == 0 ? left : (left >> fine) | (right << (64 - fine));
+            memcpy(&bgColors[(t - 1) * 8], &pixels, 8);
+
+            left = right;
+        }
+
+        // The window is drawn over the background from WX - 7 onwards
+        uint8_t wy = gb->io[IO_WY - IO_BASE];
+        int     wx = gb->io[IO_WX - IO_BASE] - 7;
+
+        if ((lcdControl & 0x20) > 0 && ly >= wy && wx < GB_VID_WIDTH)
+        {
+            uint16_t winMap = (lcdControl & 0x40) > 0 ? 0x9C00 : 0x9800;
+
+            uint8_t winY = gb->windowLine;
+            row          = &gb->vram[winMap - VRAM_BASE + (winY / 8) * 32];
+
+            for (int t = 0; wx + t * 8 < GB_VID_WIDTH; ++t)
+            {
+                uint16_t tile = GetBGTile(lcdControl, row[t]);
+
+                memcpy(&bgColors[wx + t * 8], GetTile(gb, tile)[winY % 8], 8);
+            }
+
+            gb->windowLine += 1;
+        }
+    }
+
+    uint32_t lut[4];
+    GetPaletteShades(bgp, lut);
+    MapPalette(bgColors, lut, line, GB_VID_WIDTH);
+
+    if ((lcdControl & 0x2) == 0)
+    {
+        return;
+    }
+
+    uint8_t height = (lcdControl & 0x4) > 0 ? 16 : 8;
+    if (gb->spritesDirty || gb->lineSpriteHeight != height)
+    {
+        BuildLineSprites(gb, height);
+    }
+
+    const uint8_t *oam = gb->oam;
+
+    // Pixels already taken by a higher priority sprite
+    bool covered[GB_VID_WIDTH] = {0};
+
+    for (int i = 0; i < gb->lineSpriteCounts[ly]; ++i)
+    {
+        const uint8_t *sprite = &oam[gb->lineSprites[ly][i] * 4];
+        uint8_t        flags  = sprite[3];
+
+        GetPaletteShades(
+            gb->io[((flags & SPRITE_PALETTE) > 0 ? IO_OBP1 : IO_OBP0) -
+                   IO_BASE],
+            lut);
+
+        uint8_t ty = ly - (sprite[0] - 16);
+        if ((flags & SPRITE_FLIP_Y) > 0)
+        {
+            ty = height - 1 - ty;
+        }
+
+        uint16_t tile = sprite[2];
+        if (height == 16)
+        {
+            tile = (tile & 0xFE) + ty / 8;
+        }
+        const uint8_t *row = GetTile(gb, tile)[ty % 8];
+
+        for (int tx = 0; tx < 8; ++tx)
+        {
+            int x = sprite[1] - 8 + tx;
+            if (x < 0 || x >= GB_VID_WIDTH || covered[x])
+            {
+                continue;
+            }
+
+            uint8_t color = row[(flags & SPRITE_FLIP_X) > 0 ? 7 - tx : tx];
+            if (color == 0)
+            {
+                continue;
+            }
+
+            // Hidden sprite pixels still block lower priority sprites
+            covered[x] = true;
+            if ((flags & SPRITE_BEHIND_BG) > 0 && bgColors[x] != 0)
+            {
+                continue;
+            }
+
+            line[x] = lut[color];
+        }
+    }
+}
+
+// Immediate operand of the executing instruction, read along with the opcode
+// (see opcodeLengths) so decoded blocks can supply it without a memory read
+uint8_t GetImm8(GB *gb)
+{
+    return gb->operand & 0xFF;
+}
+
+uint16_t GetImm16(GB *gb)
+{
+    return gb->operand;
+}
+
+void Set8Reg(GB *gb, uint8_t reg, uint8_t val)
+{
+    assert(reg != 6 && reg <= 7);
+
+    size_t   index  = reg == REG_A ? 7 : reg / 2;
+    uint16_t bigVal = val;
+    uint16_t mask   = 0xFF00;
+    if (reg % 2 == 0 || reg == REG_A)
+    {
+        bigVal <<= 8;
+        mask >>= 8;
+    }
+
+    gb->regs[index] &= mask;
+    gb->regs[index] |= bigVal;
+}
+
+uint8_t Get8Reg(GB *gb, uint8_t reg)
+{
+    assert(reg != 6 && reg <= 7);
+
+    size_t   index = reg == REG_A ? 7 : reg / 2;
+    uint16_t val   = gb->regs[index];
+    if ((reg % 2) == 0 || reg == REG_A)
+    {
+        val >>= 8;
+    }
+
+    return val & 0xFF;
+}
+
+char *GetReg8Name(uint8_t reg)
+{
+    switch (reg)
+    {
+        case REG_B:
+            return "B";
+
+        case REG_C:
+            return "C";
+
+        case REG_D:
+            return "D";
+
+        case REG_E:
+            return "E";
+
+        case REG_H:
+            return "H";
+
+        case REG_L:
+            return "L";
+
+        case REG_A:
+            return "A";
+        default:
+            assert(false);
+    }
+}
+
+char *GetRegName(uint8_t reg)
+{
+    switch (reg)
+    {
+        case REG_BC:
+            return "BC";
+
+        case REG_DE:
+            return "DE";
+
+        case REG_HL:
+            return "HL";
+
+        case REG_SP:
+            return "SP";
+
+        case REG_AF:
+            return "A(F)";
+
+        default:
+            assert(false);
+    }
+}
+
+char *GetFlagName(uint8_t flag)
+{
+    switch (flag)
+    {
+        case FLAG_NZ:
+            return "NZ";
+
+        case FLAG_Z:
+            return "Z";
+
+        case FLAG_NC:
+            return "NC";
+
+        case FLAG_C:
+            return "C";
+
+        default:
+            assert(false);
+    }
+}
+
+// Flags of the pending lazy operation, Z N H C in the bits of F
+uint8_t ComputeLazyFlags(GB *gb)
+{
+    uint8_t a     = gb->lazyA;
+    uint8_t b     = gb->lazyB;
+    uint8_t carry = gb->lazyCarry;
+
+    switch (gb->lazyOp)
+    {
+        case LAZY_ADD:
+        {
+            unsigned result = a + b + carry;
+
+            return ((result & 0xFF) == 0 ? 0x80 : 0) |
+                   (((a & 0xF) + (b & 0xF) + carry) > 0xF ? 0x20 : 0) |
+                   (result > 0xFF ? 0x10 : 0);
+        }
+
+        case LAZY_SUB:
+        {
+            int result = a - b - carry;
+
+            return ((result & 0xFF) == 0 ? 0x80 : 0) | 0x40 |
+                   (((a & 0xF) - (b & 0xF) - carry) < 0 ? 0x20 : 0) |
+                   (result < 0 ? 0x10 : 0);
+        }
+
+        case LAZY_LOGIC:
+            return (a == 0 ? 0x80 : 0) | b;
+
+        case LAZY_INC:
+            return (a == 0 ? 0x80 : 0) | ((a & 0xF) == 0 ? 0x20 : 0);
+
+        case LAZY_DEC:
+            return (a == 0 ? 0x80 : 0) | 0x40 | ((a & 0xF) == 0xF ? 0x20 : 0);
+    }
+
+    return 0;
+}
+
+// Bits of F the pending lazy operation decides
+static inline uint8_t GetLazyMask(uint8_t op)
+{
+    return op >= LAZY_INC ? 0xE0 : 0xF0;
+}
+
+// F as the program sees it
+static inline uint8_t GetFlags(GB *gb)
+{
+    uint8_t flags = gb->regs[REG_AF] & 0xFF;
+
+    if (gb->lazyOp != LAZY_NONE)
+    {
+        uint8_t mask = GetLazyMask(gb->lazyOp);
+        flags        = (flags & ~mask) | (ComputeLazyFlags(gb) & mask);
+    }
+
+    return flags;
+}
+
+// Writes pending lazy flags to F, needed before F is read or written as a
+// whole
+void MaterializeFlags(GB *gb)
+{
+    if (gb->lazyOp != LAZY_NONE)
+    {
+        gb->regs[REG_AF] = (gb->regs[REG_AF] & 0xFF00) | GetFlags(gb);
+        gb->lazyOp       = LAZY_NONE;
+    }
+}
+
+static inline void SetLazyFlags(GB *gb, uint8_t op, uint8_t a, uint8_t b,
+                                uint8_t carry)
+{
+    // inc and dec keep C, which may itself still be pending
+    if (op >= LAZY_INC && gb->lazyOp != LAZY_NONE && gb->lazyOp < LAZY_INC)
+    {
+        MaterializeFlags(gb);
+    }
+
+    gb->lazyOp    = op;
+    gb->lazyA     = a;
+    gb->lazyB     = b;
+    gb->lazyCarry = carry;
+}
+
+void SetFlag(GB *gb, uint8_t flag, uint8_t val)
+{
+    uint8_t mask = 1;
+
+    // The other flags of a pending operation must not be lost
+    MaterializeFlags(gb);
+
+    switch (flag)
+    {
+        case FLAG_Z:
+        {
+            mask <<= 7;
+        }
+        break;
+
+        case FLAG_C:
+        {
+            mask <<= 4;
+        }
+        break;
+
+        case FLAG_N:
+        {
+            mask <<= 6;
+        }
+        break;
+
+        case FLAG_H:
+        {
+            mask <<= 5;
+        }
+        break;
+
+        default:
+            assert(false);
+            return;
+    }
+
+    if (val > 0)
+    {
+        gb->regs[REG_AF] |= mask;
+    }
+    else
+    {
+        gb->regs[REG_AF] &= ~mask;
+    }
+}
+
+bool CheckFlag(GB *gb, uint8_t flag)
+{
+    uint8_t flags = GetFlags(gb);
+
+    switch (flag)
+    {
+        case FLAG_NZ:
+        {
+            return (flags & 0x80) == 0;
+        }
+        break;
+
+        case FLAG_Z:
+        {
+            return (flags & 0x80) > 0;
+        }
+        break;
+
+        case FLAG_NC:
+        {
+            return (flags & 0x10) == 0;
+        }
+        break;
+
+        case FLAG_C:
+        {
+            return (flags & 0x10) > 0;
+        }
+        break;
+
+        default:
+            printf("Checking flag that doesn't not exist. This should not have "
+                   "been called!\n");
+            assert(false);
+    }
+}
+
+// Carry flag as 0 or 1, used as the carry-in of adc/sbc and the rotates
+uint8_t GetCarry(GB *gb)
+{
+    return (GetFlags(gb) >> 4) & 1;
+}
+
+bool CheckInterrupt(GB *gb, uint8_t mask)
+{
+    uint8_t ienable = ReadMem(gb, IO_IE);
+    uint8_t iflag   = ReadMem(gb, IO_IF);
+
+    if (gb->IME && (ienable & mask) > 0 && (iflag & mask) > 0)
+    {
+        WriteMem(gb, IO_IF, iflag & ~mask);
+
+        return true;
+    }
+
+    return false;
+}
+
+void Push16(GB *gb, uint16_t val)
+{
+    gb->regs[REG_SP] -= 1;
+    WriteMem(gb, gb->regs[REG_SP], (val & 0xFF00) >> 8);
+    gb->regs[REG_SP] -= 1;
+    WriteMem(gb, gb->regs[REG_SP], val & 0xFF);
+}
+
+void CallInterrupt(GB *gb, uint8_t vector)
+{
+    Push16(gb, gb->regs[REG_PC]);
+    gb->regs[REG_PC] = vector;
+
+    gb->IME    = false;
+    gb->halted = false;
+}
+
+uint16_t Pop16(GB *gb)
+{
+    uint16_t val = ReadMem(gb, gb->regs[REG_SP]);
+    gb->regs[REG_SP] += 1;
+    val |= ReadMem(gb, gb->regs[REG_SP]) << 8;
+    gb->regs[REG_SP] += 1;
+
+    return val;
+}
+
+// Services the highest priority pending interrupt and returns the cycles it
+// took (0 if nothing was dispatched)
+uint8_t DoInterrupts(GB *gb)
+{
+    gb->irqCheck = false;
+
+    uint8_t pending = ReadMem(gb, IO_IE) & ReadMem(gb, IO_IF) & 0x1F;
+    if (pending == 0)
+    {
+        return 0;
+    }
+
+    // A pending interrupt ends halt even when IME is cleared
+    gb->halted = false;
+
+    if (CheckInterrupt(gb, VBLANK_MASK))
+    {
+        CallInterrupt(gb, 0x40);
+    }
+    else if (CheckInterrupt(gb, LCD_STAT_MASK))
+    {
+        CallInterrupt(gb, 0x48);
+    }
+    else if (CheckInterrupt(gb, TIMER_MASK))
+    {
+        CallInterrupt(gb, 0x50);
+    }
+    else if (CheckInterrupt(gb, SERIAL_MASK))
+    {
+        CallInterrupt(gb, 0x58);
+    }
+    else if (CheckInterrupt(gb, JOYPAD_MASK))
+    {
+        CallInterrupt(gb, 0x60);
+    }
+    else
+    {
+        return 0;
+    }
+
+    return 20;
+}
+
+//-------------ALU helpers-------------
+// Shared by the register, immediate and (hl) forms of each operation
+
+void Add8(GB *gb, uint8_t val, uint8_t carry)
+{
+    uint8_t a = Get8Reg(gb, REG_A);
+
+    SetLazyFlags(gb, LAZY_ADD, a, val, carry);
+    Set8Reg(gb, REG_A, a + val + carry);
+}
+
+// Sets the flags of a - val - carry and returns the result, cp discards it
+uint8_t Sub8(GB *gb, uint8_t val, uint8_t carry)
+{
+    uint8_t a = Get8Reg(gb, REG_A);
+
+    SetLazyFlags(gb, LAZY_SUB, a, val, carry);
+    return a - val - carry;
+}
+
+void And8(GB *gb, uint8_t val)
+{
+    uint8_t result = Get8Reg(gb, REG_A) & val;
+    Set8Reg(gb, REG_A, result);
+
+    // H is always set
+    SetLazyFlags(gb, LAZY_LOGIC, result, 0x20, 0);
+}
+
+void Xor8(GB *gb, uint8_t val)
+{
+    uint8_t result = Get8Reg(gb, REG_A) ^ val;
+    Set8Reg(gb, REG_A, result);
+
+    SetLazyFlags(gb, LAZY_LOGIC, result, 0, 0);
+}
+
+void Or8(GB *gb, uint8_t val)
+{
+    uint8_t result = Get8Reg(gb, REG_A) | val;
+    Set8Reg(gb, REG_A, result);
+
+    SetLazyFlags(gb, LAZY_LOGIC, result, 0, 0);
+}
+
+uint8_t Inc8(GB *gb, uint8_t val)
+{
+    uint8_t result = val + 1;
+
+    SetLazyFlags(gb, LAZY_INC, result, 0, 0);
+    return result;
+}
+
+uint8_t Dec8(GB *gb, uint8_t val)
+{
+    uint8_t result = val - 1;
+
+    SetLazyFlags(gb, LAZY_DEC, result, 0, 0);
+    return result;
+}
+
+// Sets the flags shared by every rotate/shift and returns the result
+uint8_t ShiftResult(GB *gb, uint8_t result, uint8_t carry)
+{
+    SetLazyFlags(gb, LAZY_LOGIC, result, carry ? 0x10 : 0, 0);
+    return result;
+}
+
+uint8_t Rlc8(GB *gb, uint8_t val)
+{
+    return ShiftResult(gb, (val << 1) | (val >> 7), val >> 7);
+}
+
+uint8_t Rrc8(GB *gb, uint8_t val)
+{
+    return ShiftResult(gb, (val >> 1) | (val << 7), val & 1);
+}
+
+uint8_t Rl8(GB *gb, uint8_t val)
+{
+    return ShiftResult(gb, (val << 1) | GetCarry(gb), val >> 7);
+}
+
+uint8_t Rr8(GB *gb, uint8_t val)
+{
+    return ShiftResult(gb, (val >> 1) | (GetCarry(gb) << 7), val & 1);
+}
+
+uint8_t Sla8(GB *gb, uint8_t val)
+{
+    return ShiftResult(gb, val << 1, val >> 7);
+}
+
+uint8_t Sra8(GB *gb, uint8_t val)
+{
+    return ShiftResult(gb, (val >> 1) | (val & 0x80), val & 1);
+}
+
+uint8_t Swap8(GB *gb, uint8_t val)
+{
+    return ShiftResult(gb, (val >> 4) | (val << 4), 0);
+}
+
+uint8_t Srl8(GB *gb, uint8_t val)
+{
+    return ShiftResult(gb, val >> 1, val & 1);
+}
+
+// Adds the signed immediate of add sp,dd and ld hl,sp+dd to SP. The flags
+// come from the unsigned addition of the low bytes.
+uint16_t AddSPSigned(GB *gb, uint8_t offset)
+{
+    uint16_t sp = gb->regs[REG_SP];
+
+    SetFlag(gb, FLAG_Z, 0);
+    SetFlag(gb, FLAG_N, 0);
+    SetFlag(gb, FLAG_H, ((sp & 0xF) + (offset & 0xF)) > 0xF);
+    SetFlag(gb, FLAG_C, ((sp & 0xFF) + offset) > 0xFF);
+
+    return sp + (int8_t)offset;
+}
+
+// Opcode handlers
+//
+// Every opcode (and every 0xCB-prefixed opcode) is decoded through a
+// 256-entry table built from the OP_* definitions in GBOpcodes.h. The handler
+// receives the already fetched opcode so that handlers shared by a whole
+// group of opcodes (ld r,r, add a,r, ...) can decode their operands from it.
+// Handlers return the number of clock cycles the instruction took, or 0 if
+// it could not be executed.
+typedef uint8_t (*OpcodeHandler)(GB *gb, uint8_t opcode);
+
+//-------------CB-prefixed Commands-------------
+// Cycle counts include the 0xCB prefix
+// rlc r
+uint8_t OpCBRlcR(GB *gb, uint8_t opcode)
+{
+    uint8_t reg = opcode & 0b111;
+
+    Set8Reg(gb, reg, Rlc8(gb, Get8Reg(gb, reg)));
+    return 8;
+}
+
+// rlc (hl)
+uint8_t OpCBRlcPtrHL(GB *gb, uint8_t opcode)
+{
+    uint8_t val = ReadMem(gb, gb->regs[REG_HL]);
+
+    WriteMem(gb, gb->regs[REG_HL], Rlc8(gb, val));
+    return 16;
+}
+
+// rrc r
+uint8_t OpCBRrcR(GB *gb, uint8_t opcode)
+{
+    uint8_t reg = opcode & 0b111;
+
+    Set8Reg(gb, reg, Rrc8(gb, Get8Reg(gb, reg)));
+    return 8;
+}
+
+// rrc (hl)
+uint8_t OpCBRrcPtrHL(GB *gb, uint8_t opcode)
+{
+    uint8_t val = ReadMem(gb, gb->regs[REG_HL]);
+
+    WriteMem(gb, gb->regs[REG_HL], Rrc8(gb, val));
+    return 16;
+}
+
+// rl r
+uint8_t OpCBRlR(GB *gb, uint8_t opcode)
+{
+    uint8_t reg = opcode & 0b111;
+
+    Set8Reg(gb, reg, Rl8(gb, Get8Reg(gb, reg)));
+    return 8;
+}
+
+// rl (hl)
+uint8_t OpCBRlPtrHL(GB *gb, uint8_t opcode)
+{
+    uint8_t val = ReadMem(gb, gb->regs[REG_HL]);
+
+    WriteMem(gb, gb->regs[REG_HL], Rl8(gb, val));
+    return 16;
+}
+
+// rr r
+uint8_t OpCBRrR(GB *gb, uint8_t opcode)
+{
+    uint8_t reg = opcode & 0b111;
+
+    Set8Reg(gb, reg, Rr8(gb, Get8Reg(gb, reg)));
+    return 8;
+}
+
+// rr (hl)
+uint8_t OpCBRrPtrHL(GB *gb, uint8_t opcode)
+{
+    uint8_t val = ReadMem(gb, gb->regs[REG_HL]);
+
+    WriteMem(gb, gb->regs[REG_HL], Rr8(gb, val));
+    return 16;
+}
+
+// sla r
+uint8_t OpCBSlaR(GB *gb, uint8_t opcode)
+{
+    uint8_t reg = opcode & 0b111;
+
+    Set8Reg(gb, reg, Sla8(gb, Get8Reg(gb, reg)));
+    return 8;
+}
+
+// sla (hl)
+uint8_t OpCBSlaPtrHL(GB *gb, uint8_t opcode)
+{
+    uint8_t val = ReadMem(gb, gb->regs[REG_HL]);
+
+    WriteMem(gb, gb->regs[REG_HL], Sla8(gb, val));
+    return 16;
+}
+
+// sra r
+uint8_t OpCBSraR(GB *gb, uint8_t opcode)
+{
+    uint8_t reg = opcode & 0b111;
+
+    Set8Reg(gb, reg, Sra8(gb, Get8Reg(gb, reg)));
+    return 8;
+}
+
+// sra (hl)
+uint8_t OpCBSraPtrHL(GB *gb, uint8_t opcode)
+{
+    uint8_t val = ReadMem(gb, gb->regs[REG_HL]);
+
+    WriteMem(gb, gb->regs[REG_HL], Sra8(gb, val));
+    return 16;
+}
+
+// swap r
+uint8_t OpCBSwapR(GB *gb, uint8_t opcode)
+{
+    uint8_t reg = opcode & 0b111;
+
+    Set8Reg(gb, reg, Swap8(gb, Get8Reg(gb, reg)));
+    return 8;
+}
+
+// swap (hl)
+uint8_t OpCBSwapPtrHL(GB *gb, uint8_t opcode)
+{
+    uint8_t val = ReadMem(gb, gb->regs[REG_HL]);
+
+    WriteMem(gb, gb->regs[REG_HL], Swap8(gb, val));
+    return 16;
+}
+
+// srl r
+uint8_t OpCBSrlR(GB *gb, uint8_t opcode)
+{
+    uint8_t reg = opcode & 0b111;
+
+    Set8Reg(gb, reg, Srl8(gb, Get8Reg(gb, reg)));
+    return 8;
+}
+
+// srl (hl)
+uint8_t OpCBSrlPtrHL(GB *gb, uint8_t opcode)
+{
+    uint8_t val = ReadMem(gb, gb->regs[REG_HL]);
+
+    WriteMem(gb, gb->regs[REG_HL], Srl8(gb, val));
+    return 16;
+}
+
+// bit n,r
+uint8_t OpCBBitNR(GB *gb, uint8_t opcode)
+{
+    uint8_t bit = (opcode >> 3) & 0b111;
+    uint8_t reg = Get8Reg(gb, opcode & 0b111);
+
+    SetFlag(gb, FLAG_Z, (reg & (1 << bit)) == 0);
+    SetFlag(gb, FLAG_N, 0);
+    SetFlag(gb, FLAG_H, 1);
+    return 8;
+}
+
+// bit n,(hl)
+uint8_t OpCBBitNPtrHL(GB *gb, uint8_t opcode)
+{
+    uint8_t bit = (opcode >> 3) & 0b111;
+    uint8_t val = ReadMem(gb, gb->regs[REG_HL]);
+
+    SetFlag(gb, FLAG_Z, (val & (1 << bit)) == 0);
+    SetFlag(gb, FLAG_N, 0);
+    SetFlag(gb, FLAG_H, 1);
+    return 12;
+}
+
+// res n,r
+uint8_t OpCBResNR(GB *gb, uint8_t opcode)
+{
+    uint8_t bit = (opcode >> 3) & 0b111;
+    uint8_t reg = Get8Reg(gb, opcode & 0b111);
+
+    Set8Reg(gb, opcode & 0b111, (reg & ~(1 << bit)));
+    return 8;
+}
+
+// res n,(hl)
+uint8_t OpCBResNPtrHL(GB *gb, uint8_t opcode)
+{
+    uint8_t bit = (opcode >> 3) & 0b111;
+    uint8_t val = ReadMem(gb, gb->regs[REG_HL]);
+
+    WriteMem(gb, gb->regs[REG_HL], val & ~(1 << bit));
+    return 16;
+}
+
+// set n,r
+uint8_t OpCBSetNR(GB *gb, uint8_t opcode)
+{
+    uint8_t bit = (opcode >> 3) & 0b111;
+    uint8_t reg = Get8Reg(gb, opcode & 0b111);
+
+    Set8Reg(gb, opcode & 0b111, (reg | (1 << bit)));
+    return 8;
+}
+
+// set n,(hl)
+uint8_t OpCBSetNPtrHL(GB *gb, uint8_t opcode)
+{
+    uint8_t bit = (opcode >> 3) & 0b111;
+    uint8_t val = ReadMem(gb, gb->regs[REG_HL]);
+
+    WriteMem(gb, gb->regs[REG_HL], val | (1 << bit));
+    return 16;
+}
+
+//-------------8 bit Load Commands-------------
+// nop
+uint8_t OpNop(GB *gb, uint8_t opcode)
+{
+    return 4;
+}
+
+// ld (nn), sp
+uint8_t OpLdPtrnnSP(GB *gb, uint8_t opcode)
+{
+    uint16_t addr = GetImm16(gb);
+
+    WriteMem(gb, addr, gb->regs[REG_SP] & 0xFF);
+    WriteMem(gb, addr + 1, gb->regs[REG_SP] >> 8);
+    return 20;
+}
+
+// ld r,r
+uint8_t OpLdRR(GB *gb, uint8_t opcode)
+{
+    uint8_t regDst = (opcode >> 3) & 0b111;
+    uint8_t regSrc = opcode & 0b111;
+
+    Set8Reg(gb, regDst, Get8Reg(gb, regSrc));
+    return 4;
+}
+
+// ld r,n
+uint8_t OpLdRN(GB *gb, uint8_t opcode)
+{
+    uint8_t regDst = (opcode >> 3) & 0b111;
+    uint8_t val    = GetImm8(gb);
+
+    Set8Reg(gb, regDst, val);
+    return 8;
+}
+
+// ld (de),a
+uint8_t OpLdPtrDEA(GB *gb, uint8_t opcode)
+{
+    WriteMem(gb, gb->regs[REG_DE], Get8Reg(gb, REG_A));
+    return 8;
+}
+
+// ld a,($FF00+n)
+uint8_t OpLdAIOn(GB *gb, uint8_t opcode)
+{
+    uint8_t offset = GetImm8(gb);
+    Set8Reg(gb, REG_A, ReadMem(gb, 0xFF00 + offset));
+    return 12;
+}
+
+// ld ($FF00+n), a
+uint8_t OpLdIOnA(GB *gb, uint8_t opcode)
+{
+    uint8_t offset = GetImm8(gb);
+    WriteMem(gb, 0xFF00 + offset, Get8Reg(gb, REG_A));
+    return 12;
+}
+
+// ld ($FF00+c), a
+uint8_t OpLdIOCA(GB *gb, uint8_t opcode)
+{
+    uint8_t offset = Get8Reg(gb, REG_C);
+    WriteMem(gb, 0xFF00 + offset, Get8Reg(gb, REG_A));
+    return 8;
+}
+
+// ld a,($FF00+c)
+uint8_t OpLdAIOC(GB *gb, uint8_t opcode)
+{
+    uint8_t offset = Get8Reg(gb, REG_C);
+    Set8Reg(gb, REG_A, ReadMem(gb, 0xFF00 + offset));
+    return 8;
+}
+
+// ldi a,(hl)
+uint8_t OpLdiAPtrHL(GB *gb, uint8_t opcode)
+{
+    uint8_t val = ReadMem(gb, gb->regs[REG_HL]);
+
+    Set8Reg(gb, REG_A, val);
+
+    gb->regs[REG_HL] += 1;
+    return 8;
+}
+
+// ldd a,(hl)
+uint8_t OpLddAPtrHL(GB *gb, uint8_t opcode)
+{
+    uint8_t val = ReadMem(gb, gb->regs[REG_HL]);
+
+    Set8Reg(gb, REG_A, val);
+
+    gb->regs[REG_HL] -= 1;
+    return 8;
+}
+
+// ldi (hl),a
+uint8_t OpLdiPtrHLA(GB *gb, uint8_t opcode)
+{
+    uint8_t val = Get8Reg(gb, REG_A);
+    WriteMem(gb, gb->regs[REG_HL], val);
+
+    gb->regs[REG_HL] += 1;
+    return 8;
+}
+
+// ldd (hl),a
+uint8_t OpLddPtrHLA(GB *gb, uint8_t opcode)
+{
+    uint8_t val = Get8Reg(gb, REG_A);
+    WriteMem(gb, gb->regs[REG_HL], val);
+
+    gb->regs[REG_HL] -= 1;
+    return 8;
+}
+
+// ld r,(hl)
+uint8_t OpLdRPtrHL(GB *gb, uint8_t opcode)
+{
+    uint8_t reg = (opcode >> 3) & 0b111;
+    uint8_t val = ReadMem(gb, gb->regs[REG_HL]);
+
+    Set8Reg(gb, reg, val);
+    return 8;
+}
+
+// ld (hl),r
+uint8_t OpLdPtrHLR(GB *gb, uint8_t opcode)
+{
+    uint8_t reg = opcode & 0b111;
+    uint8_t val = Get8Reg(gb, reg);
+    WriteMem(gb, gb->regs[REG_HL], val);
+    return 8;
+}
+
+// ld (hl),n
+uint8_t OpLdPtrHLN(GB *gb, uint8_t opcode)
+{
+    uint8_t val = GetImm8(gb);
+    WriteMem(gb, gb->regs[REG_HL], val);
+    return 12;
+}
+
+// ld a,(bc)
+uint8_t OpLdAPtrBC(GB *gb, uint8_t opcode)
+{
+    uint8_t val = ReadMem(gb, gb->regs[REG_BC]);
+
+    Set8Reg(gb, REG_A, val);
+    return 8;
+}
+
+// ld a,(de)
+uint8_t OpLdAPtrDE(GB *gb, uint8_t opcode)
+{
+    uint8_t val = ReadMem(gb, gb->regs[REG_DE]);
+
+    Set8Reg(gb, REG_A, val);
+    return 8;
+}
+
+// ld a,(nn)
+uint8_t OpLdAPtrnn(GB *gb, uint8_t opcode)
+{
+    uint16_t addr = GetImm16(gb);
+    uint8_t  val  = ReadMem(gb, addr);
+
+    Set8Reg(gb, REG_A, val);
+    return 16;
+}
+
+// ld (bc),a
+uint8_t OpLdPtrBCA(GB *gb, uint8_t opcode)
+{
+    uint8_t val = Get8Reg(gb, REG_A);
+    WriteMem(gb, gb->regs[REG_BC], val);
+    return 8;
+}
+
+// ld (nn),a
+uint8_t OpLdPtrnnA(GB *gb, uint8_t opcode)
+{
+    uint16_t addr = GetImm16(gb);
+
+    WriteMem(gb, addr, Get8Reg(gb, REG_A));
+    return 16;
+}
+
+//-------------8 bit Arthimetic/Logical Commands-------------
+// add a,r
+uint8_t OpAddAR(GB *gb, uint8_t opcode)
+{
+    Add8(gb, Get8Reg(gb, opcode & 0b111), 0);
+    return 4;
+}
+
+// add a,n
+uint8_t OpAddAN(GB *gb, uint8_t opcode)
+{
+    Add8(gb, GetImm8(gb), 0);
+    return 8;
+}
+
+// add a,(hl)
+uint8_t OpAddAPtrHL(GB *gb, uint8_t opcode)
+{
+    Add8(gb, ReadMem(gb, gb->regs[REG_HL]), 0);
+    return 8;
+}
+
+// adc a,r
+uint8_t OpAdcAR(GB *gb, uint8_t opcode)
+{
+    Add8(gb, Get8Reg(gb, opcode & 0b111), GetCarry(gb));
+    return 4;
+}
+
+// adc a,n
+uint8_t OpAdcAN(GB *gb, uint8_t opcode)
+{
+    Add8(gb, GetImm8(gb), GetCarry(gb));
+    return 8;
+}
+
+// adc a,(hl)
+uint8_t OpAdcAPtrHL(GB *gb, uint8_t opcode)
+{
+    Add8(gb, ReadMem(gb, gb->regs[REG_HL]), GetCarry(gb));
+    return 8;
+}
+
+// sub a,r
+uint8_t OpSubAR(GB *gb, uint8_t opcode)
+{
+    Set8Reg(gb, REG_A, Sub8(gb, Get8Reg(gb, opcode & 0b111), 0));
+    return 4;
+}
+
+// sub a,n
+uint8_t OpSubAN(GB *gb, uint8_t opcode)
+{
+    Set8Reg(gb, REG_A, Sub8(gb, GetImm8(gb), 0));
+    return 8;
+}
+
+// sub a,(hl)
+uint8_t OpSubAPtrHL(GB *gb, uint8_t opcode)
+{
+    Set8Reg(gb, REG_A, Sub8(gb, ReadMem(gb, gb->regs[REG_HL]), 0));
+    return 8;
+}
+
+// sbc a,r
+uint8_t OpSbcAR(GB *gb, uint8_t opcode)
+{
+    Set8Reg(gb, REG_A, Sub8(gb, Get8Reg(gb, opcode & 0b111), GetCarry(gb)));
+    return 4;
+}
+
+// sbc a,n
+uint8_t OpSbcAN(GB *gb, uint8_t opcode)
+{
+    Set8Reg(gb, REG_A, Sub8(gb, GetImm8(gb), GetCarry(gb)));
+    return 8;
+}
+
+// sbc a,(hl)
+uint8_t OpSbcAPtrHL(GB *gb, uint8_t opcode)
+{
+    Set8Reg(gb, REG_A,
+            Sub8(gb, ReadMem(gb, gb->regs[REG_HL]), GetCarry(gb)));
+    return 8;
+}
+
+// and a,r
+uint8_t OpAndAR(GB *gb, uint8_t opcode)
+{
+    And8(gb, Get8Reg(gb, opcode & 0b111));
+    return 4;
+}
+
+// and a,n
+uint8_t OpAndAN(GB *gb, uint8_t opcode)
+{
+    And8(gb, GetImm8(gb));
+    return 8;
+}
+
+// and a,(hl)
+uint8_t OpAndAPtrHL(GB *gb, uint8_t opcode)
+{
+    And8(gb, ReadMem(gb, gb->regs[REG_HL]));
+    return 8;
+}
+
+// xor a,r
+uint8_t OpXorAR(GB *gb, uint8_t opcode)
+{
+    Xor8(gb, Get8Reg(gb, opcode & 0b111));
+    return 4;
+}
+
+// xor a,n
+uint8_t OpXorAN(GB *gb, uint8_t opcode)
+{
+    Xor8(gb, GetImm8(gb));
+    return 8;
+}
+
+// xor a,(hl)
+uint8_t OpXorAPtrHL(GB *gb, uint8_t opcode)
+{
+    Xor8(gb, ReadMem(gb, gb->regs[REG_HL]));
+    return 8;
+}
+
+// or a,r
+uint8_t OpOrAR(GB *gb, uint8_t opcode)
+{
+    Or8(gb, Get8Reg(gb, opcode & 0b111));
+    return 4;
+}
+
+// or a,n
+uint8_t OpOrAN(GB *gb, uint8_t opcode)
+{
+    Or8(gb, GetImm8(gb));
+    return 8;
+}
+
+// or a,(hl)
+uint8_t OpOrAPtrHL(GB *gb, uint8_t opcode)
+{
+    Or8(gb, ReadMem(gb, gb->regs[REG_HL]));
+    return 8;
+}
+
+// cp a,r
+uint8_t OpCpAR(GB *gb, uint8_t opcode)
+{
+    Sub8(gb, Get8Reg(gb, opcode & 0b111), 0);
+    return 4;
+}
+
+// cp a,n
+uint8_t OpCpAN(GB *gb, uint8_t opcode)
+{
+    Sub8(gb, GetImm8(gb), 0);
+    return 8;
+}
+
+// cp a,(hl)
+uint8_t OpCpAPtrHL(GB *gb, uint8_t opcode)
+{
+    Sub8(gb, ReadMem(gb, gb->regs[REG_HL]), 0);
+    return 8;
+}
+
+// inc r
+uint8_t OpIncR(GB *gb, uint8_t opcode)
+{
+    uint8_t reg = (opcode >> 3) & 0b111;
+
+    Set8Reg(gb, reg, Inc8(gb, Get8Reg(gb, reg)));
+    return 4;
+}
+
+// inc (hl)
+uint8_t OpIncPtrHL(GB *gb, uint8_t opcode)
+{
+    uint8_t data = ReadMem(gb, gb->regs[REG_HL]);
+
+    WriteMem(gb, gb->regs[REG_HL], Inc8(gb, data));
+    return 12;
+}
+
+// dec r
+uint8_t OpDecR(GB *gb, uint8_t opcode)
+{
+    uint8_t reg = (opcode >> 3) & 0b111;
+
+    Set8Reg(gb, reg, Dec8(gb, Get8Reg(gb, reg)));
+    return 4;
+}
+
+// dec (hl)
+uint8_t OpDecPtrHL(GB *gb, uint8_t opcode)
+{
+    uint8_t data = ReadMem(gb, gb->regs[REG_HL]);
+
+    WriteMem(gb, gb->regs[REG_HL], Dec8(gb, data));
+    return 12;
+}
+
+// daa
+uint8_t OpDaa(GB *gb, uint8_t opcode)
+{
+    uint8_t val   = Get8Reg(gb, REG_A);
+    uint8_t flags = GetFlags(gb);
+    bool    carry = (flags & 0x10) > 0;
+
+    // Adjust the result of the previous add/sub back into BCD
+    if ((flags & 0x40) == 0)
+    {
+        if (carry || val > 0x99)
+        {
+            val += 0x60;
+            carry = true;
+        }
+        if ((flags & 0x20) > 0 || (val & 0xF) > 9)
+        {
+            val += 6;
+        }
+    }
+    else
+    {
+        if (carry)
+        {
+            val -= 0x60;
+        }
+        if ((flags & 0x20) > 0)
+        {
+            val -= 6;
+        }
+    }
+
+    SetFlag(gb, FLAG_Z, val == 0);
+    SetFlag(gb, FLAG_C, carry);
+    SetFlag(gb, FLAG_H, 0);
+
+    Set8Reg(gb, REG_A, val);
+    return 4;
+}
+
+// cpl
+uint8_t OpCpl(GB *gb, uint8_t opcode)
+{
+    uint8_t val = Get8Reg(gb, REG_A) ^ 0xFF;
+    Set8Reg(gb, REG_A, val);
+
+    SetFlag(gb, FLAG_N, 1);
+    SetFlag(gb, FLAG_H, 1);
+    return 4;
+}
+
+//-------------16 bit Load/Arithmetic/Logical Commands-------------
+// ld rr, nn
+uint8_t OpLdRRNN(GB *gb, uint8_t opcode)
+{
+    uint8_t  reg = (opcode & 0xF0) >> 4;
+    uint16_t val = GetImm16(gb);
+
+    gb->regs[reg] = val;
+    return 12;
+}
+
+// ld sp, hl
+uint8_t OpLdSPHL(GB *gb, uint8_t opcode)
+{
+    gb->regs[REG_SP] = gb->regs[REG_HL];
+    return 8;
+}
+
+// ld hl, sp+dd
+uint8_t OpLdHLSPDD(GB *gb, uint8_t opcode)
+{
+    gb->regs[REG_HL] = AddSPSigned(gb, GetImm8(gb));
+    return 12;
+}
+
+// push rr
+uint8_t OpPushRR(GB *gb, uint8_t opcode)
+{
+    // The fourth pair of push/pop is AF rather than SP
+    uint8_t reg = (opcode >> 4) & 0b11;
+    if (reg == REG_SP)
+    {
+        reg = REG_AF;
+        MaterializeFlags(gb);
+    }
+
+    Push16(gb, gb->regs[reg]);
+    return 16;
+}
+
+// pop rr
+uint8_t OpPopRR(GB *gb, uint8_t opcode)
+{
+    uint8_t reg = (opcode >> 4) & 0b11;
+    if (reg == REG_SP)
+    {
+        reg = REG_AF;
+    }
+
+    gb->regs[reg] = Pop16(gb);
+
+    // The low nibble of F always reads as zero
+    if (reg == REG_AF)
+    {
+        gb->regs[REG_AF] &= 0xFFF0;
+        gb->lazyOp = LAZY_NONE;
+    }
+    return 12;
+}
+
+// add hl, rr
+uint8_t OpAddHLRR(GB *gb, uint8_t opcode)
+{
+    uint8_t  reg    = (opcode >> 4) & 0b11;
+    uint16_t hl     = gb->regs[REG_HL];
+    uint32_t newVal = hl + gb->regs[reg];
+
+    SetFlag(gb, FLAG_C, newVal > 0xFFFF);
+    SetFlag(gb, FLAG_N, 0);
+    SetFlag(gb, FLAG_H, ((hl & 0xFFF) + (gb->regs[reg] & 0xFFF)) > 0xFFF);
+
+    gb->regs[REG_HL] = newVal & 0xFFFF;
+    return 8;
+}
+
+// inc rr
+uint8_t OpIncRR(GB *gb, uint8_t opcode)
+{
+    uint8_t reg = (opcode >> 4) & 0b11;
+
+    gb->regs[reg] += 1;
+    return 8;
+}
+
+// dec rr
+uint8_t OpDecRR(GB *gb, uint8_t opcode)
+{
+    uint8_t reg = (opcode >> 4) & 0b11;
+
+    gb->regs[reg] -= 1;
+    return 8;
+}
+
+// add sp, dd
+uint8_t OpAddSPDD(GB *gb, uint8_t opcode)
+{
+    gb->regs[REG_SP] = AddSPSigned(gb, GetImm8(gb));
+    return 16;
+}
+
+//-------------Rotate/Shift Commands-------------
+// Unlike their CB counterparts the accumulator rotates always clear Z
+// rlca
+uint8_t OpRlca(GB *gb, uint8_t opcode)
+{
+    Set8Reg(gb, REG_A, Rlc8(gb, Get8Reg(gb, REG_A)));
+    SetFlag(gb, FLAG_Z, 0);
+    return 4;
+}
+
+// rrca
+uint8_t OpRrca(GB *gb, uint8_t opcode)
+{
+    Set8Reg(gb, REG_A, Rrc8(gb, Get8Reg(gb, REG_A)));
+    SetFlag(gb, FLAG_Z, 0);
+    return 4;
+}
+
+// rla
+uint8_t OpRla(GB *gb, uint8_t opcode)
+{
+    Set8Reg(gb, REG_A, Rl8(gb, Get8Reg(gb, REG_A)));
+    SetFlag(gb, FLAG_Z, 0);
+    return 4;
+}
+
+// rra
+uint8_t OpRra(GB *gb, uint8_t opcode)
+{
+    Set8Reg(gb, REG_A, Rr8(gb, Get8Reg(gb, REG_A)));
+    SetFlag(gb, FLAG_Z, 0);
+    return 4;
+}
+
+//-------------CPU Control Commands-------------
+// ccf
+uint8_t OpCcf(GB *gb, uint8_t opcode)
+{
+    SetFlag(gb, FLAG_C, !GetCarry(gb));
+    SetFlag(gb, FLAG_N, 0);
+    SetFlag(gb, FLAG_H, 0);
+    return 4;
+}
+
+// scf
+uint8_t OpScf(GB *gb, uint8_t opcode)
+{
+    SetFlag(gb, FLAG_C, 1);
+    SetFlag(gb, FLAG_N, 0);
+    SetFlag(gb, FLAG_H, 0);
+    return 4;
+}
+
+// halt
+uint8_t OpHalt(GB *gb, uint8_t opcode)
+{
+    gb->halted   = true;
+    gb->irqCheck = true;
+    return 4;
+}
+
+// stop
+uint8_t OpStop(GB *gb, uint8_t opcode)
+{
+    // Once KEY1 bit 0 asks for it the CGB switches speed instead
+    if (gb->cgb && (gb->io[IO_KEY1 - IO_BASE] & 1) > 0)
+    {
+        gb->io[IO_KEY1 - IO_BASE] &= ~1;
+        SetDoubleSpeed(gb, !gb->doubleSpeed);
+        return 4;
+    }
+
+    // TODO: actualy stop instead of nop'ing, the second byte is skipped as
+    // its operand
+    return 4;
+}
+
+// di
+uint8_t OpDi(GB *gb, uint8_t opcode)
+{
+    gb->IME        = false;
+    gb->imePending = false;
+    return 4;
+}
+
+// ei
+uint8_t OpEi(GB *gb, uint8_t opcode)
+{
+    // IME is only set after the following instruction, see StepGB
+    gb->imePending = true;
+    return 4;
+}
+
+//-------------Jump Commands-------------
+// jp nn
+uint8_t OpJpNN(GB *gb, uint8_t opcode)
+{
+    uint16_t addr = GetImm16(gb);
+
+    gb->regs[REG_PC] = addr;
+    return 16;
+}
+
+// jp hl
+uint8_t OpJpHL(GB *gb, uint8_t opcode)
+{
+    uint16_t addr = gb->regs[REG_HL];
+
+    gb->regs[REG_PC] = addr;
+    return 4;
+}
+
+// jp f,nn
+uint8_t OpJpFNN(GB *gb, uint8_t opcode)
+{
+    uint16_t addr = GetImm16(gb);
+    uint8_t  flag = (opcode >> 3) & 0b11;
+
+    if (CheckFlag(gb, flag))
+    {
+        gb->regs[REG_PC] = addr;
+        return 16;
+    }
+    return 12;
+}
+
+// jr f,dd
+uint8_t OpJrFDD(GB *gb, uint8_t opcode)
+{
+    int8_t  offset = GetImm8(gb);
+    uint8_t flag   = (opcode >> 3) & 0b11;
+
+    if (CheckFlag(gb, flag))
+    {
+        gb->regs[REG_PC] += offset;
+        return 12;
+    }
+    return 8;
+}
+
+// jr dd
+uint8_t OpJrDD(GB *gb, uint8_t opcode)
+{
+    int8_t offset = GetImm8(gb);
+
+    gb->regs[REG_PC] += offset;
+    return 12;
+}
+
+// call nn
+uint8_t OpCallNN(GB *gb, uint8_t opcode)
+{
+    uint16_t addr = GetImm16(gb);
+    Push16(gb, gb->regs[REG_PC]);
+
+    gb->regs[REG_PC] = addr;
+    return 24;
+}
+
+// call f,nn
+uint8_t OpCallFNN(GB *gb, uint8_t opcode)
+{
+    uint8_t  flag = opcode >> 3 & 0b11;
+    uint16_t addr = GetImm16(gb);
+
+    if (CheckFlag(gb, flag))
+    {
+        Push16(gb, gb->regs[REG_PC]);
+
+        gb->regs[REG_PC] = addr;
+        return 24;
+    }
+    return 12;
+}
+
+// ret
+uint8_t OpRet(GB *gb, uint8_t opcode)
+{
+    gb->regs[REG_PC] = Pop16(gb);
+    return 16;
+}
+
+// ret f
+uint8_t OpRetF(GB *gb, uint8_t opcode)
+{
+    uint8_t flag = opcode >> 3 & 0b11;
+
+    if (CheckFlag(gb, flag))
+    {
+        gb->regs[REG_PC] = Pop16(gb);
+        return 20;
+    }
+    return 8;
+}
+
+// reti
+uint8_t OpReti(GB *gb, uint8_t opcode)
+{
+    gb->regs[REG_PC] = Pop16(gb);
+    gb->IME          = true;
+    gb->irqCheck     = true;
+    return 16;
+}
+
+// rst n
+uint8_t OpRstN(GB *gb, uint8_t opcode)
+{
+    Push16(gb, gb->regs[REG_PC]);
+
+    gb->regs[REG_PC] = opcode & 0x38;
+    return 16;
+}
+
+uint8_t DoCBInstruction(GB *gb, uint8_t prefix);
+
+// Expands to one table entry per 8 bit register operand of an opcode group,
+// e.g. OP_ENTRIES_R(OP_ADD, OpAddAR) covers OP_ADD_B through OP_ADD_A
+#define OP_ENTRIES_R(group, handler)                                    \
+    [group##_B] = handler, [group##_C] = handler, [group##_D] = handler, \
+    [group##_E] = handler, [group##_H] = handler, [group##_L] = handler, \
+    [group##_A] = handler
+
+// Same as OP_ENTRIES_R but for every bit index of a CB bit operation
+#define OP_ENTRIES_BIT_R(group, handler)                              \
+    OP_ENTRIES_R(group##_0, handler), OP_ENTRIES_R(group##_1, handler), \
+    OP_ENTRIES_R(group##_2, handler), OP_ENTRIES_R(group##_3, handler), \
+    OP_ENTRIES_R(group##_4, handler), OP_ENTRIES_R(group##_5, handler), \
+    OP_ENTRIES_R(group##_6, handler), OP_ENTRIES_R(group##_7, handler)
+
+// Opcodes without an entry are unimplemented/invalid
+const OpcodeHandler opcodeTable[256] = {
+    [OP_NOP] = OpNop,
+
+    //-------------8 bit Load Commands-------------
+    [OP_LD_ptrnn_SP] = OpLdPtrnnSP,
+
+    OP_ENTRIES_R(OP_LD_B, OpLdRR),
+    OP_ENTRIES_R(OP_LD_C, OpLdRR),
+    OP_ENTRIES_R(OP_LD_D, OpLdRR),
+    OP_ENTRIES_R(OP_LD_E, OpLdRR),
+    OP_ENTRIES_R(OP_LD_H, OpLdRR),
+    OP_ENTRIES_R(OP_LD_L, OpLdRR),
+    OP_ENTRIES_R(OP_LD_A, OpLdRR),
+
+    [OP_LD_B_n] = OpLdRN,
+    [OP_LD_C_n] = OpLdRN,
+    [OP_LD_D_n] = OpLdRN,
+    [OP_LD_E_n] = OpLdRN,
+    [OP_LD_H_n] = OpLdRN,
+    [OP_LD_L_n] = OpLdRN,
+    [OP_LD_A_n] = OpLdRN,
+
+    [OP_LD_ptrDE_A]  = OpLdPtrDEA,
+    [OP_LD_A_IOn]    = OpLdAIOn,
+    [OP_LD_IOn_A]    = OpLdIOnA,
+    [OP_LD_IOC_A]    = OpLdIOCA,
+    [OP_LD_A_IOC]    = OpLdAIOC,
+    [OP_LDI_A_ptrHL] = OpLdiAPtrHL,
+    [OP_LDI_ptrHL_A] = OpLdiPtrHLA,
+    [OP_LDD_ptrHL_A] = OpLddPtrHLA,
+    [OP_LDD_A_ptrHL] = OpLddAPtrHL,
+
+    [OP_LD_B_ptrHL] = OpLdRPtrHL,
+    [OP_LD_C_ptrHL] = OpLdRPtrHL,
+    [OP_LD_D_ptrHL] = OpLdRPtrHL,
+    [OP_LD_E_ptrHL] = OpLdRPtrHL,
+    [OP_LD_H_ptrHL] = OpLdRPtrHL,
+    [OP_LD_L_ptrHL] = OpLdRPtrHL,
+    [OP_LD_A_ptrHL] = OpLdRPtrHL,
+
+    OP_ENTRIES_R(OP_LD_ptrHL, OpLdPtrHLR),
+
+    [OP_LD_ptrHL_n] = OpLdPtrHLN,
+    [OP_LD_A_ptrBC] = OpLdAPtrBC,
+    [OP_LD_A_ptrDE] = OpLdAPtrDE,
+    [OP_LD_A_ptrnn] = OpLdAPtrnn,
+    [OP_LD_ptrBC_A] = OpLdPtrBCA,
+    [OP_LD_ptrnn_A] = OpLdPtrnnA,
+
+    //-------------8 bit Arthimetic/Logical Commands-------------
+    OP_ENTRIES_R(OP_ADD, OpAddAR),
+    [OP_ADD_A_n]     = OpAddAN,
+    [OP_ADD_A_ptrHL] = OpAddAPtrHL,
+    OP_ENTRIES_R(OP_ADC, OpAdcAR),
+    [OP_ADC_A_n]     = OpAdcAN,
+    [OP_ADC_A_ptrHL] = OpAdcAPtrHL,
+    OP_ENTRIES_R(OP_SUB, OpSubAR),
+    [OP_SUB_A_n]     = OpSubAN,
+    [OP_SUB_A_ptrHL] = OpSubAPtrHL,
+    OP_ENTRIES_R(OP_SBC, OpSbcAR),
+    [OP_SBC_A_n]   = OpSbcAN,
+    [OP_SBC_ptrHL] = OpSbcAPtrHL,
+    OP_ENTRIES_R(OP_AND, OpAndAR),
+    [OP_AND_A_nn]  = OpAndAN,
+    [OP_AND_ptrHL] = OpAndAPtrHL,
+    OP_ENTRIES_R(OP_XOR, OpXorAR),
+    [OP_XOR_n]     = OpXorAN,
+    [OP_XOR_ptrHL] = OpXorAPtrHL,
+    OP_ENTRIES_R(OP_OR, OpOrAR),
+    [OP_OR_n]     = OpOrAN,
+    [OP_OR_ptrHL] = OpOrAPtrHL,
+    OP_ENTRIES_R(OP_CP, OpCpAR),
+    [OP_CP_n]     = OpCpAN,
+    [OP_CP_ptrHL] = OpCpAPtrHL,
+
+    OP_ENTRIES_R(OP_INC, OpIncR),
+    [OP_INC_ptrHL] = OpIncPtrHL,
+    OP_ENTRIES_R(OP_DEC, OpDecR),
+    [OP_DEC_ptrHL] = OpDecPtrHL,
+    [OP_DAA]       = OpDaa,
+    [OP_CPL]       = OpCpl,
+
+    //-------------16 bit Load/Arithmetic/Logical Commands-------------
+    [OP_LD_BC_nn] = OpLdRRNN,
+    [OP_LD_DE_nn] = OpLdRRNN,
+    [OP_LD_HL_nn] = OpLdRRNN,
+    [OP_LD_SP_nn] = OpLdRRNN,
+
+    [OP_LD_SP_HL]   = OpLdSPHL,
+    [OP_LD_HL_SPdd] = OpLdHLSPDD,
+
+    [OP_PUSH_BC] = OpPushRR,
+    [OP_PUSH_DE] = OpPushRR,
+    [OP_PUSH_HL] = OpPushRR,
+    [OP_PUSH_AF] = OpPushRR,
+
+    [OP_POP_BC] = OpPopRR,
+    [OP_POP_DE] = OpPopRR,
+    [OP_POP_HL] = OpPopRR,
+    [OP_POP_AF] = OpPopRR,
+
+    [OP_ADD_HL_BC] = OpAddHLRR,
+    [OP_ADD_HL_DE] = OpAddHLRR,
+    [OP_ADD_HL_HL] = OpAddHLRR,
+    [OP_ADD_HL_SP] = OpAddHLRR,
+
+    [OP_INC_BC] = OpIncRR,
+    [OP_INC_DE] = OpIncRR,
+    [OP_INC_HL] = OpIncRR,
+    [OP_INC_SP] = OpIncRR,
+
+    [OP_DEC_BC] = OpDecRR,
+    [OP_DEC_DE] = OpDecRR,
+    [OP_DEC_HL] = OpDecRR,
+    [OP_DEC_SP] = OpDecRR,
+
+    [OP_ADD_SP_dd] = OpAddSPDD,
+
+    //-------------Rotate/Shift Commands-------------
+    [OP_RLCA]      = OpRlca,
+    [OP_RRCA]      = OpRrca,
+    [OP_RLA]       = OpRla,
+    [OP_RRA]       = OpRra,
+    [OP_PREFIX_CB] = DoCBInstruction,
+
+    //-------------CPU Control Commands-------------
+    [OP_CCF]  = OpCcf,
+    [OP_SCF]  = OpScf,
+    [OP_HALT] = OpHalt,
+    [OP_STOP] = OpStop,
+    [OP_DI]   = OpDi,
+    [OP_EI]   = OpEi,
+
+    //-------------Jump Commands-------------
+    [OP_JP_NN] = OpJpNN,
+    [OP_JP_HL] = OpJpHL,
+
+    [OP_JP_NZ_nn] = OpJpFNN,
+    [OP_JP_Z_nn]  = OpJpFNN,
+    [OP_JP_NC_nn] = OpJpFNN,
+    [OP_JP_C_nn]  = OpJpFNN,
+
+    [OP_JR_NZ_dd] = OpJrFDD,
+    [OP_JR_Z_dd]  = OpJrFDD,
+    [OP_JR_NC_dd] = OpJrFDD,
+    [OP_JR_C_dd]  = OpJrFDD,
+
+    [OP_JR_dd]   = OpJrDD,
+    [OP_CALL_nn] = OpCallNN,
+
+    [OP_CALL_NZ_nn] = OpCallFNN,
+    [OP_CALL_Z_nn]  = OpCallFNN,
+    [OP_CALL_NC_nn] = OpCallFNN,
+    [OP_CALL_C_nn]  = OpCallFNN,
+
+    [OP_RET] = OpRet,
+
+    [OP_RET_NZ_nn] = OpRetF,
+    [OP_RET_Z_nn]  = OpRetF,
+    [OP_RET_NC_nn] = OpRetF,
+    [OP_RET_C_nn]  = OpRetF,
+
+    [OP_RETI] = OpReti,
+
+    [OP_RST_00] = OpRstN,
+    [OP_RST_08] = OpRstN,
+    [OP_RST_10] = OpRstN,
+    [OP_RST_18] = OpRstN,
+    [OP_RST_20] = OpRstN,
+    [OP_RST_28] = OpRstN,
+    [OP_RST_30] = OpRstN,
+    [OP_RST_38] = OpRstN,
+};
+
+// Same as OP_ENTRIES_BIT_R for the (hl) forms
+#define OP_ENTRIES_BIT_PTRHL(group, handler)                        \
+    [group##_0_ptrHL] = handler, [group##_1_ptrHL] = handler,       \
+    [group##_2_ptrHL] = handler, [group##_3_ptrHL] = handler,       \
+    [group##_4_ptrHL] = handler, [group##_5_ptrHL] = handler,       \
+    [group##_6_ptrHL] = handler, [group##_7_ptrHL] = handler
+
+const OpcodeHandler cbOpcodeTable[256] = {
+    OP_ENTRIES_R(OP_CB_RLC, OpCBRlcR),
+    [OP_CB_RLC_ptrHL] = OpCBRlcPtrHL,
+    OP_ENTRIES_R(OP_CB_RRC, OpCBRrcR),
+    [OP_CB_RRC_ptrHL] = OpCBRrcPtrHL,
+    OP_ENTRIES_R(OP_CB_RL, OpCBRlR),
+    [OP_CB_RL_ptrHL] = OpCBRlPtrHL,
+    OP_ENTRIES_R(OP_CB_RR, OpCBRrR),
+    [OP_CB_RR_ptrHL] = OpCBRrPtrHL,
+    OP_ENTRIES_R(OP_CB_SLA, OpCBSlaR),
+    [OP_CB_SLA_ptrHL] = OpCBSlaPtrHL,
+    OP_ENTRIES_R(OP_CB_SRA, OpCBSraR),
+    [OP_CB_SRA_ptrHL] = OpCBSraPtrHL,
+    OP_ENTRIES_R(OP_CB_SWAP, OpCBSwapR),
+    [OP_CB_SWAP_ptrHL] = OpCBSwapPtrHL,
+    OP_ENTRIES_R(OP_CB_SRL, OpCBSrlR),
+    [OP_CB_SRL_ptrHL] = OpCBSrlPtrHL,
+
+    OP_ENTRIES_BIT_R(OP_CB_BIT, OpCBBitNR),
+    OP_ENTRIES_BIT_PTRHL(OP_CB_BIT, OpCBBitNPtrHL),
+    OP_ENTRIES_BIT_R(OP_CB_RES, OpCBResNR),
+    OP_ENTRIES_BIT_PTRHL(OP_CB_RES, OpCBResNPtrHL),
+    OP_ENTRIES_BIT_R(OP_CB_SET, OpCBSetNR),
+    OP_ENTRIES_BIT_PTRHL(OP_CB_SET, OpCBSetNPtrHL),
+};
+
+// Bytes taken by each instruction including the opcode, the CB prefix counts
+// its second opcode byte as the operand
+const uint8_t opcodeLengths[256] = {
+    1, 3, 1, 1, 1, 1, 2, 1, 3, 1, 1, 1, 1, 1, 2, 1, // 0x00
+    2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1, // 0x10
+    2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1, // 0x20
+    2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1, // 0x30
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x40
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x50
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x60
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x70
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x80
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x90
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0xA0
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0xB0
+    1, 1, 3, 3, 3, 1, 2, 1, 1, 1, 3, 2, 3, 3, 2, 1, // 0xC0
+    1, 1, 3, 1, 3, 1, 2, 1, 1, 1, 3, 1, 3, 1, 2, 1, // 0xD0
+    2, 1, 1, 1, 1, 1, 2, 1, 2, 1, 3, 1, 1, 1, 2, 1, // 0xE0
+    2, 1, 1, 1, 1, 1, 2, 1, 2, 1, 3, 1, 1, 1, 2, 1, // 0xF0
+};
+
+uint8_t DoCBInstruction(GB *gb, uint8_t prefix)
+{
+    const uint16_t instrPC = gb->regs[REG_PC] - 2;
+    uint8_t        opcode  = GetImm8(gb);
+
+    OpcodeHandler handler = cbOpcodeTable[opcode];
+    if (handler == NULL)
+    {
+        DumpCPURegisters(gb);
+        printf("PC: $%02X: Unknown CB-prefixed instruction: 0x%01X\n", instrPC,
+               opcode);
+        return 0;
+    }
+
+#ifdef GB_PROFILE
+    uint8_t cycles = handler(gb, opcode);
+
+    gb->profile->cbOpcodes[opcode].count += 1;
+    gb->profile->cbOpcodes[opcode].cycles += cycles;
+
+    return cycles;
+#else
+    return handler(gb, opcode);
+#endif
+}
+
+// Records the instruction about to run into the trace ring
+void TraceInstruction(GB *gb, uint8_t opcode, uint16_t instrPC)
+{
+    TraceEntry *entry = &gb->trace[gb->traceNext];
+
+    entry->cycles   = gb->cycles;
+    entry->pc       = instrPC;
+    entry->af       = (gb->regs[REG_AF] & 0xFF00) | GetFlags(gb);
+    entry->bc       = gb->regs[REG_BC];
+    entry->de       = gb->regs[REG_DE];
+    entry->hl       = gb->regs[REG_HL];
+    entry->sp       = gb->regs[REG_SP];
+    entry->bytes[0] = opcode;
+    entry->bytes[1] = gb->operand & 0xFF;
+    entry->bytes[2] = gb->operand >> 8;
+    entry->flags    = gb->IME ? GB_TRACE_IME : 0;
+
+    if (++gb->traceNext == gb->traceCapacity)
+    {
+        gb->traceNext = 0;
+    }
+    gb->traceCount += 1;
+}
+
+// Runs an instruction whose operand is in gb->operand, PC already points past
+// it
+static inline uint8_t ExecuteInstruction(GB *gb, OpcodeHandler handler,
+                                         uint8_t opcode, uint16_t instrPC)
+{
+    if (gb->trace != NULL)
+    {
+        TraceInstruction(gb, opcode, instrPC);
+    }
+
+#ifdef GB_PROFILE
+    // Prefixed instructions count once here under 0xCB as well
+    uint8_t cycles = handler(gb, opcode);
+
+    gb->profile->opcodes[opcode].count += 1;
+    gb->profile->opcodes[opcode].cycles += cycles;
+    gb->profile->pcs[instrPC].count += 1;
+    gb->profile->pcs[instrPC].cycles += cycles;
+
+    return cycles;
+#else
+    return handler(gb, opcode);
+#endif
+}
+
+// Executes one instruction and returns the cycles it took, 0 on failure
+uint8_t DoInstruction(GB *gb)
+{
+    const uint16_t instrPC = gb->regs[REG_PC];
+    uint8_t        opcode  = ReadMem(gb, instrPC);
+    uint8_t        length  = opcodeLengths[opcode];
+
+    gb->operand = 0;
+    if (length > 1)
+    {
+        gb->operand = ReadMem(gb, instrPC + 1);
+    }
+    if (length > 2)
+    {
+        gb->operand |= ReadMem(gb, instrPC + 2) << 8;
+    }
+    gb->regs[REG_PC] = instrPC + length;
+
+    OpcodeHandler handler = opcodeTable[opcode];
+    if (handler == NULL)
+    {
+        DumpCPURegisters(gb);
+        printf("PC: $%02X: Unknown instruction: 0x%01X\n", instrPC, opcode);
+        return 0;
+    }
+
+    return ExecuteInstruction(gb, handler, opcode, instrPC);
+}
+
+// Updates the mode and coincidence bits of STAT and raises the STAT interrupt
+// on a rising edge of any of its enabled sources
+void UpdateLCDStatus(GB *gb)
+{
+    uint8_t *stat = &gb->io[IO_STAT - IO_BASE];
+    uint8_t  mode = gb->ppuMode;
+    uint8_t  val  = 0x80 | (*stat & 0x78) | mode;
+
+    if (gb->io[IO_LY - IO_BASE] == gb->io[IO_LYC - IO_BASE])
+    {
+        val |= 0x4;
+    }
+    *stat = val;
+
+    bool line = ((val & 0x40) > 0 && (val & 0x4) > 0) ||
+                ((val & 0x08) > 0 && mode == PPU_MODE_HBLANK) ||
+                ((val & 0x10) > 0 && mode == PPU_MODE_VBLANK) ||
+                ((val & 0x20) > 0 && mode == PPU_MODE_OAM);
+
+    if (line && !gb->statLine)
+    {
+        RequestInterrupt(gb, LCD_STAT_MASK);
+    }
+    gb->statLine = line;
+}
+
+// Moves the PPU to its next mode and schedules the one after. Times are
+// relative to when the event was due so late dispatch doesn't drift.
+void PPUEvent(GB *gb)
+{
+    uint8_t *ly   = &gb->io[IO_LY - IO_BASE];
+    uint64_t when = gb->events[EVENT_PPU];
+
+    switch (gb->ppuMode)
+    {
+        case PPU_MODE_OAM:
+        {
+            gb->ppuMode = PPU_MODE_TRANSFER;
+            when += GetPPUCycles(gb, PPU_TRANSFER_CYCLES);
+        }
+        break;
+
+        case PPU_MODE_TRANSFER:
+        {
+            RenderScanline(gb);
+
+            gb->ppuMode = PPU_MODE_HBLANK;
+            if (gb->hdmaActive)
+            {
+                CopyHDMABlock(gb);
+            }
+            when += GetPPUCycles(gb, PPU_LINE_CYCLES - PPU_OAM_CYCLES -
+                                          PPU_TRANSFER_CYCLES);
+        }
+        break;
+
+        case PPU_MODE_HBLANK:
+        {
+            *ly += 1;
+            if (*ly == GB_VID_HEIGHT)
+            {
+                gb->ppuMode = PPU_MODE_VBLANK;
+                when += GetPPUCycles(gb, PPU_LINE_CYCLES);
+
+                RequestInterrupt(gb, VBLANK_MASK);
+                gb->frameDone = true;
+            }
+            else
+            {
+                gb->ppuMode = PPU_MODE_OAM;
+                when += GetPPUCycles(gb, PPU_OAM_CYCLES);
+            }
+        }
+        break;
+
+        case PPU_MODE_VBLANK:
+        {
+            *ly += 1;
+            if (*ly >= PPU_LINES)
+            {
+                *ly         = 0;
+                gb->ppuMode = PPU_MODE_OAM;
+                when += GetPPUCycles(gb, PPU_OAM_CYCLES);
+            }
+            else
+            {
+                when += GetPPUCycles(gb, PPU_LINE_CYCLES);
+            }
+        }
+        break;
+    }
+
+    ScheduleEvent(gb, EVENT_PPU, when);
+    UpdateLCDStatus(gb);
+}
+
+// TIMA overflows exactly when its event is due, counting up to it reloads
+// TMA and requests the interrupt
+void TimerEvent(GB *gb)
+{
+    SyncTimer(gb);
+    ScheduleTimer(gb);
+}
+
+// Shifts out one bit of SB, nothing is connected so a 1 is shifted in
+void SerialEvent(GB *gb)
+{
+    uint8_t *sb = &gb->io[IO_SB - IO_BASE];
+    *sb         = (*sb << 1) | 1;
+
+    gb->serialBits -= 1;
+    if (gb->serialBits > 0)
+    {
+        ScheduleEvent(gb, EVENT_SERIAL,
+                      gb->events[EVENT_SERIAL] + SERIAL_BIT_CYCLES);
+        return;
+    }
+
+    gb->io[IO_SC - IO_BASE] &= ~0x80;
+    ScheduleEvent(gb, EVENT_SERIAL, EVENT_NEVER);
+    RequestInterrupt(gb, SERIAL_MASK);
+}
+
+// Copies the 160 bytes of OAM from the page written to the DMA register.
+// Sources from 0xE000 up read the echo of WRAM.
+void DMAEvent(GB *gb)
+{
+    uint8_t source = gb->io[IO_DMA - IO_BASE];
+    if (source >= 0xE0)
+    {
+        source -= 0x20;
+    }
+
+    uint8_t *      oam  = gb->oam;
+    const uint8_t *page = gb->readPages[source];
+
+    if (page != NULL)
+    {
+        memcpy(oam, page, OAM_END - OAM_BASE);
+    }
+    else
+    {
+        // Cartridge RAM behind a controller
+        for (int i = 0; i < OAM_END - OAM_BASE; ++i)
+        {
+            oam[i] = ReadMem(gb, (source << 8) | i);
+        }
+    }
+
+    gb->spritesDirty = true;
+
+    ScheduleEvent(gb, EVENT_DMA, EVENT_NEVER);
+}
+
+// Dispatches every event that is due, in order of their timestamps
+void RunEvents(GB *gb)
+{
+    while (gb->nextEvent <= gb->cycles)
+    {
+        if (gb->events[EVENT_PPU] == gb->nextEvent)
+        {
+            PPUEvent(gb);
+        }
+        else if (gb->events[EVENT_TIMER] == gb->nextEvent)
+        {
+            TimerEvent(gb);
+        }
+        else if (gb->events[EVENT_APU] == gb->nextEvent)
+        {
+            APUEvent(gb);
+        }
+        else if (gb->events[EVENT_DMA] == gb->nextEvent)
+        {
+            DMAEvent(gb);
+        }
+        else
+        {
+            SerialEvent(gb);
+        }
+    }
+}
+
+// Bookkeeping after every executed instruction. enableIME is whether an ei
+// was pending before it ran.
+static inline void RetireInstruction(GB *gb, bool enableIME)
+{
+    gb->instructions += 1;
+
+    // A di right after ei cancels it
+    if (enableIME && gb->imePending)
+    {
+        gb->IME        = true;
+        gb->imePending = false;
+        gb->irqCheck   = true;
+    }
+}
+
+// Dispatches pending interrupts and due events once cycles have passed
+static inline uint8_t FinishStep(GB *gb, uint8_t cycles)
+{
+    if (gb->irqCheck)
+    {
+        cycles += DoInterrupts(gb);
+    }
+
+    gb->cycles += cycles;
+    if (gb->cycles >= gb->nextEvent)
+    {
+        RunEvents(gb);
+    }
+
+    return cycles;
+}
+
+// Executes one instruction (or one idle step while halted) followed by any
+// pending interrupt. Returns the elapsed cycles, 0 if execution failed.
+uint8_t StepGB(GB *gb)
+{
+    // Time still passes while halted
+    uint8_t cycles = 4;
+
+    if (!gb->halted)
+    {
+        bool enableIME = gb->imePending;
+
+        // Stops in front of the instruction, nothing has run yet
+        if (gb->debugger != NULL && CheckBreakpoint(gb))
+        {
+            return 0;
+        }
+
+        cycles = DoInstruction(gb);
+        if (cycles == 0)
+        {
+            gb->stopped = true;
+            return 0;
+        }
+
+        RetireInstruction(gb, enableIME);
+    }
+
+    return FinishStep(gb, cycles);
+}
+
+//-------------Block cache-------------
+// Straight line runs of instructions are decoded once into blocks holding
+// their handlers and operands, so running them skips the opcode and operand
+// reads and the table lookups. A block ends at the first jump, call, return
+// or halt, before anything the interpreter has to report, and at the end of
+// its 256 byte page. Blocks are looked up by the host address of their first
+// byte, which tells ROM banks apart without invalidating anything on a bank
+// switch.
+//
+// Instructions still run one at a time with the same bookkeeping as StepGB
+// in between, so events and interrupts land on exactly the same instruction
+// as in the interpreter.
+//
+// Code in RAM is tracked per dirty page. Decoding from a page routes its
+// writes through the slow path (see ApplyWriteTracking) where the first one
+// bumps the page's generation, which drops every block decoded from it.
+
+#define BLOCK_CACHE_BITS 11
+#define BLOCK_CACHE_SIZE (1 << BLOCK_CACHE_BITS)
+#define BLOCK_MAX_OPS 32
+// Pages rewritten this often stay interpreted, decoding them over and over
+// would cost more than it saves
+#define BLOCK_MAX_GENERATIONS 64
+// Upper bound of a register only instruction's cycles
+#define BLOCK_REG_OP_CYCLES 12
+
+// Flags as bits of F
+#define FLAGS_ZNH 0xE0
+#define FLAGS_ZNHC 0xF0
+
+typedef struct BlockOpstruct
+{
+    OpcodeHandler handler;
+    // Same instruction without the flags, run instead of handler when they
+    // are overwritten before anything can see them
+    OpcodeHandler flagless;
+    uint16_t      operand;
+    uint8_t       opcode;
+    uint8_t       length;
+    // Upper bound of the cycles until the flags are overwritten, where no
+    // event may come due for flagless to be used
+    uint8_t flaglessCycles;
+} BlockOp;
+
+typedef struct Blockstruct
+{
+    // First byte of the block in host memory, NULL for an empty slot
+    const uint8_t *code;
+    // Host page the block was decoded from, the block stops as soon as its
+    // address maps elsewhere
+    const uint8_t *page;
+    uint16_t       pc;
+    // Dirty page of the code and its generation when decoded, -1 for ROM
+    int16_t  pageId;
+    uint32_t generation;
+
+    uint8_t count;
+    BlockOp ops[BLOCK_MAX_OPS];
+
+    // Nothing but reads and register ops up to a jump, so if it jumps back
+    // to itself it may be a poll loop (see SkipPollLoop)
+    bool poll;
+} Block;
+
+// CPU state at the start of a poll loop iteration
+typedef struct PollStatestruct
+{
+    uint64_t cycles;
+    uint64_t nextEvent;
+    uint16_t regs[8];
+    uint8_t  lazyOp;
+    uint8_t  lazyA;
+    uint8_t  lazyB;
+    uint8_t  lazyCarry;
+} PollState;
+
+// ALU ops for when their flags are dead, register and immediate forms only
+// so nothing else can happen while the flags are stale
+uint8_t OpAddARFlagless(GB *gb, uint8_t opcode)
+{
+    Set8Reg(gb, REG_A, Get8Reg(gb, REG_A) + Get8Reg(gb, opcode & 0b111));
+    return 4;
+}
+
+uint8_t OpAddANFlagless(GB *gb, uint8_t opcode)
+{
+    Set8Reg(gb, REG_A, Get8Reg(gb, REG_A) + GetImm8(gb));
+    return 8;
+}
+
+uint8_t OpSubARFlagless(GB *gb, uint8_t opcode)
+{
+    Set8Reg(gb, REG_A, Get8Reg(gb, REG_A) - Get8Reg(gb, opcode & 0b111));
+    return 4;
+}
+
+uint8_t OpSubANFlagless(GB *gb, uint8_t opcode)
+{
+    Set8Reg(gb, REG_A, Get8Reg(gb, REG_A) - GetImm8(gb));
+    return 8;
+}
+
+uint8_t OpAndARFlagless(GB *gb, uint8_t opcode)
+{
+    Set8Reg(gb, REG_A, Get8Reg(gb, REG_A) & Get8Reg(gb, opcode & 0b111));
+    return 4;
+}
+
+uint8_t OpAndANFlagless(GB *gb, uint8_t opcode)
+{
+    Set8Reg(gb, REG_A, Get8Reg(gb, REG_A) & GetImm8(gb));
+    return 8;
+}
+
+uint8_t OpXorARFlagless(GB *gb, uint8_t opcode)
+{
+    Set8Reg(gb, REG_A, Get8Reg(gb, REG_A) ^ Get8Reg(gb, opcode & 0b111));
+    return 4;
+}
+
+uint8_t OpXorANFlagless(GB *gb, uint8_t opcode)
+{
+    Set8Reg(gb, REG_A, Get8Reg(gb, REG_A) ^ GetImm8(gb));
+    return 8;
+}
+
+uint8_t OpOrARFlagless(GB *gb, uint8_t opcode)
+{
+    Set8Reg(gb, REG_A, Get8Reg(gb, REG_A) | Get8Reg(gb, opcode & 0b111));
+    return 4;
+}
+
+uint8_t OpOrANFlagless(GB *gb, uint8_t opcode)
+{
+    Set8Reg(gb, REG_A, Get8Reg(gb, REG_A) | GetImm8(gb));
+    return 8;
+}
+
+// cp only sets flags
+uint8_t OpCpARFlagless(GB *gb, uint8_t opcode)
+{
+    return 4;
+}
+
+uint8_t OpCpANFlagless(GB *gb, uint8_t opcode)
+{
+    return 8;
+}
+
+uint8_t OpIncRFlagless(GB *gb, uint8_t opcode)
+{
+    uint8_t reg = (opcode >> 3) & 0b111;
+
+    Set8Reg(gb, reg, Get8Reg(gb, reg) + 1);
+    return 4;
+}
+
+uint8_t OpDecRFlagless(GB *gb, uint8_t opcode)
+{
+    uint8_t reg = (opcode >> 3) & 0b111;
+
+    Set8Reg(gb, reg, Get8Reg(gb, reg) - 1);
+    return 4;
+}
+
+typedef struct FlagUsestruct
+{
+    OpcodeHandler handler;
+    OpcodeHandler flagless;
+    // Flags always overwritten without being read first
+    uint8_t writes;
+} FlagUse;
+
+const FlagUse flagUses[] = {
+    {OpAddAR, OpAddARFlagless, FLAGS_ZNHC},
+    {OpAddAN, OpAddANFlagless, FLAGS_ZNHC},
+    {OpAddAPtrHL, NULL, FLAGS_ZNHC},
+    {OpSubAR, OpSubARFlagless, FLAGS_ZNHC},
+    {OpSubAN, OpSubANFlagless, FLAGS_ZNHC},
+    {OpSubAPtrHL, NULL, FLAGS_ZNHC},
+    {OpAndAR, OpAndARFlagless, FLAGS_ZNHC},
+    {OpAndAN, OpAndANFlagless, FLAGS_ZNHC},
+    {OpAndAPtrHL, NULL, FLAGS_ZNHC},
+    {OpXorAR, OpXorARFlagless, FLAGS_ZNHC},
+    {OpXorAN, OpXorANFlagless, FLAGS_ZNHC},
+    {OpXorAPtrHL, NULL, FLAGS_ZNHC},
+    {OpOrAR, OpOrARFlagless, FLAGS_ZNHC},
+    {OpOrAN, OpOrANFlagless, FLAGS_ZNHC},
+    {OpOrAPtrHL, NULL, FLAGS_ZNHC},
+    {OpCpAR, OpCpARFlagless, FLAGS_ZNHC},
+    {OpCpAN, OpCpANFlagless, FLAGS_ZNHC},
+    {OpCpAPtrHL, NULL, FLAGS_ZNHC},
+    {OpIncR, OpIncRFlagless, FLAGS_ZNH},
+    {OpIncPtrHL, NULL, FLAGS_ZNH},
+    {OpDecR, OpDecRFlagless, FLAGS_ZNH},
+    {OpDecPtrHL, NULL, FLAGS_ZNH},
+};
+
+const FlagUse *GetFlagUse(OpcodeHandler handler)
+{
+    for (size_t i = 0; i < sizeof(flagUses) / sizeof(flagUses[0]); ++i)
+    {
+        if (flagUses[i].handler == handler)
+        {
+            return &flagUses[i];
+        }
+    }
+
+    return NULL;
+}
+
+// Instructions that only touch registers other than F, so nothing can
+// observe the flags while they run
+bool IsRegisterOnly(OpcodeHandler handler)
+{
+    return handler == OpNop || handler == OpLdRR || handler == OpLdRN ||
+           handler == OpLdRRNN || handler == OpIncRR || handler == OpDecRR;
+}
+
+bool EndsBlock(OpcodeHandler handler)
+{
+    return handler == OpJpNN || handler == OpJpHL || handler == OpJpFNN ||
+           handler == OpJrFDD || handler == OpJrDD || handler == OpCallNN ||
+           handler == OpCallFNN || handler == OpRet || handler == OpRetF ||
+           handler == OpReti || handler == OpRstN || handler == OpHalt ||
+           handler == OpStop;
+}
+
+// Picks the flagless form of every instruction whose flags are overwritten
+// by a later one with only register moves in between
+void FindDeadFlags(Block *block)
+{
+    for (uint8_t i = 0; i < block->count; ++i)
+    {
+        const FlagUse *use = GetFlagUse(block->ops[i].handler);
+        if (use == NULL || use->flagless == NULL)
+        {
+            continue;
+        }
+
+        for (uint8_t j = i + 1; j < block->count; ++j)
+        {
+            const FlagUse *next = GetFlagUse(block->ops[j].handler);
+
+            if (next != NULL && (next->writes & use->writes) == use->writes)
+            {
+                block->ops[i].flagless       = use->flagless;
+                block->ops[i].flaglessCycles = (j - i) * BLOCK_REG_OP_CYCLES;
+                break;
+            }
+            if (!IsRegisterOnly(block->ops[j].handler))
+            {
+                break;
+            }
+        }
+    }
+}
+
+// Instructions allowed in a poll loop: none of them write memory or change
+// anything but registers
+bool IsPollOp(const BlockOp *op)
+{
+    OpcodeHandler handler = op->handler;
+
+    if (GetFlagUse(handler) != NULL)
+    {
+        return handler != OpIncPtrHL && handler != OpDecPtrHL;
+    }
+
+    // Only the bit tests of the CB instructions leave their operand alone
+    if (handler == DoCBInstruction)
+    {
+        return (op->operand & 0xC0) == 0x40;
+    }
+
+    return IsRegisterOnly(handler) || handler == OpLdAIOn ||
+           handler == OpLdAIOC || handler == OpLdAPtrBC ||
+           handler == OpLdAPtrDE || handler == OpLdAPtrnn ||
+           handler == OpLdRPtrHL || handler == OpAdcAR || handler == OpAdcAN ||
+           handler == OpAdcAPtrHL || handler == OpSbcAR ||
+           handler == OpSbcAN || handler == OpSbcAPtrHL || handler == OpCpl;
+}
+
+bool IsPollLoop(const Block *block)
+{
+    OpcodeHandler last = block->ops[block->count - 1].handler;
+    if (last != OpJrFDD && last != OpJrDD && last != OpJpFNN && last != OpJpNN)
+    {
+        return false;
+    }
+
+    for (uint8_t i = 0; i < block->count; ++i)
+    {
+        if (!IsPollOp(&block->ops[i]))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// DIV and TIMA count up with the cycles, every other register only changes
+// through writes and events
+bool ReadsTimer(GB *gb, const BlockOp *op)
+{
+    OpcodeHandler handler = op->handler;
+    uint16_t      addr;
+
+    if (handler == OpLdAIOn)
+    {
+        addr = 0xFF00 | (op->operand & 0xFF);
+    }
+    else if (handler == OpLdAIOC)
+    {
+        addr = 0xFF00 | Get8Reg(gb, REG_C);
+    }
+    else if (handler == OpLdAPtrnn)
+    {
+        addr = op->operand;
+    }
+    else if (handler == OpLdAPtrBC)
+    {
+        addr = gb->regs[REG_BC];
+    }
+    else if (handler == OpLdAPtrDE)
+    {
+        addr = gb->regs[REG_DE];
+    }
+    else if (handler == OpLdRPtrHL || handler == OpAddAPtrHL ||
+             handler == OpAdcAPtrHL || handler == OpSubAPtrHL ||
+             handler == OpSbcAPtrHL || handler == OpAndAPtrHL ||
+             handler == OpXorAPtrHL || handler == OpOrAPtrHL ||
+             handler == OpCpAPtrHL ||
+             (handler == DoCBInstruction && (op->operand & 0b111) == 6))
+    {
+        addr = gb->regs[REG_HL];
+    }
+    else
+    {
+        return false;
+    }
+
+    return addr == IO_DIV || addr == IO_TIMA;
+}
+
+// Every block becomes stale, whenever the memory behind them is replaced
+void FlushBlocks(GB *gb)
+{
+    if (gb->blocks != NULL)
+    {
+        for (int i = 0; i < BLOCK_CACHE_SIZE; ++i)
+        {
+            gb->blocks[i].code = NULL;
+        }
+    }
+
+    memset(gb->codePages, false, sizeof(gb->codePages));
+    memset(gb->codeGenerations, 0, sizeof(gb->codeGenerations));
+}
+
+bool DecodeBlock(GB *gb, Block *block, uint16_t pc)
+{
+    const uint8_t *page   = gb->readPages[pc >> 8];
+    int16_t        id     = gb->pageIds[pc >> 8];
+    uint16_t       offset = pc & 0xFF;
+
+    block->code  = NULL;
+    block->count = 0;
+
+    while (block->count < BLOCK_MAX_OPS)
+    {
+        // Ends in front of breakpoints, the interpreter stops at them
+        if (gb->debugger != NULL && IsBreakpoint(gb, (pc & 0xFF00) | offset))
+        {
+            break;
+        }
+
+        uint8_t       opcode  = page[offset];
+        uint8_t       length  = opcodeLengths[opcode];
+        OpcodeHandler handler = opcodeTable[opcode];
+
+        // Left to the interpreter: unknown opcodes so they get reported and
+        // instructions running into the next page
+        if (handler == NULL || offset + length > 0x100 ||
+            (opcode == OP_PREFIX_CB && cbOpcodeTable[page[offset + 1]] == NULL))
+        {
+            break;
+        }
+
+        BlockOp *op        = &block->ops[block->count++];
+        op->handler        = handler;
+        op->flagless       = NULL;
+        op->flaglessCycles = 0;
+        op->opcode         = opcode;
+        op->length         = length;
+        op->operand        = 0;
+
+        if (length > 1)
+        {
+            op->operand = page[offset + 1];
+        }
+        if (length > 2)
+        {
+            op->operand |= page[offset + 2] << 8;
+        }
+        offset += length;
+
+        if (EndsBlock(handler))
+        {
+            break;
+        }
+    }
+
+    if (block->count == 0)
+    {
+        return false;
+    }
+
+    FindDeadFlags(block);
+
+    block->poll       = IsPollLoop(block);
+    block->code       = &page[pc & 0xFF];
+    block->page       = page;
+    block->pc         = pc;
+    block->pageId     = id;
+    block->generation = id >= 0 ? gb->codeGenerations[id] : 0;
+
+    if (id >= 0 && !gb->codePages[id])
+    {
+        gb->codePages[id] = true;
+        ApplyWriteTracking(gb);
+    }
+
+    return true;
+}
+
+// Returns the block starting at PC, decoding it if needed. NULL where code
+// can't be cached.
+Block *GetBlock(GB *gb)
+{
+    uint16_t       pc   = gb->regs[REG_PC];
+    const uint8_t *page = gb->readPages[pc >> 8];
+
+    if (gb->blocks == NULL || page == NULL)
+    {
+        return NULL;
+    }
+
+    const uint8_t *code = &page[pc & 0xFF];
+    int16_t        id   = gb->pageIds[pc >> 8];
+    uint32_t       hash =
+        ((uintptr_t)code * 0x9E3779B97F4A7C15ull) >> (64 - BLOCK_CACHE_BITS);
+    Block *block = &gb->blocks[hash];
+
+    if (block->code == code && block->pc == pc &&
+        (id < 0 || block->generation == gb->codeGenerations[id]))
+    {
+        return block;
+    }
+
+    if (id >= 0 && gb->codeGenerations[id] >= BLOCK_MAX_GENERATIONS)
+    {
+        return NULL;
+    }
+
+    return DecodeBlock(gb, block, pc) ? block : NULL;
+}
+
+// While halted without an interrupt to wake up to, nothing can happen before
+// the next event. Runs all the idle steps up to it (or to limit) at once.
+void SkipHalt(GB *gb, uint64_t limit)
+{
+    uint64_t target = gb->nextEvent < limit ? gb->nextEvent : limit;
+    uint64_t steps  = 1;
+
+    if (target > gb->cycles)
+    {
+        steps = (target - gb->cycles + 3) / 4;
+    }
+
+    gb->cycles += steps * 4;
+    if (gb->cycles >= gb->nextEvent)
+    {
+        RunEvents(gb);
+    }
+}
+
+void SavePollState(GB *gb, PollState *state)
+{
+    state->cycles    = gb->cycles;
+    state->nextEvent = gb->nextEvent;
+    memcpy(state->regs, gb->regs, sizeof(state->regs));
+    state->lazyOp    = gb->lazyOp;
+    state->lazyA     = gb->lazyA;
+    state->lazyB     = gb->lazyB;
+    state->lazyCarry = gb->lazyCarry;
+}
+
+// A poll loop that jumped back to itself with the same registers it started
+// with, and without an event in between, will do the same on every iteration
+// until some memory it reads changes. Without writes of its own that takes an
+// event, so the iterations ending before the next one (or limit) are skipped.
+// Events then land on exactly the same instruction as when running them all.
+void SkipPollLoop(GB *gb, const Block *block, const PollState *state,
+                  uint64_t limit)
+{
+    if (gb->regs[REG_PC] != block->pc || gb->irqCheck || gb->imePending ||
+        gb->nextEvent != state->nextEvent ||
+        memcmp(state->regs, gb->regs, sizeof(state->regs)) != 0 ||
+        state->lazyOp != gb->lazyOp || state->lazyA != gb->lazyA ||
+        state->lazyB != gb->lazyB || state->lazyCarry != gb->lazyCarry)
+    {
+        return;
+    }
+
+    for (uint8_t i = 0; i < block->count; ++i)
+    {
+        if (ReadsTimer(gb, &block->ops[i]))
+        {
+            return;
+        }
+    }
+
+    uint64_t iteration = gb->cycles - state->cycles;
+    uint64_t target    = gb->nextEvent < limit ? gb->nextEvent : limit;
+
+    if (gb->cycles + iteration < target)
+    {
+        uint64_t skipped = (target - 1 - gb->cycles) / iteration;
+
+        gb->cycles += skipped * iteration;
+        gb->instructions += skipped * block->count;
+    }
+}
+
+// Runs the block at PC, or a single StepGB where there is none. Returns
+// early once the cycles reach limit, and at the end of the frame if toFrame.
+void RunBlock(GB *gb, uint64_t limit, bool toFrame)
+{
+    if (gb->halted && !gb->irqCheck)
+    {
+        SkipHalt(gb, limit);
+        return;
+    }
+
+    Block *block = gb->halted ? NULL : GetBlock(gb);
+    if (block == NULL)
+    {
+        StepGB(gb);
+        return;
+    }
+
+    PollState state;
+    if (block->poll)
+    {
+        SavePollState(gb, &state);
+    }
+
+    for (uint8_t i = 0; i < block->count; ++i)
+    {
+        const BlockOp *op        = &block->ops[i];
+        const uint16_t instrPC   = gb->regs[REG_PC];
+        const uint16_t nextPC    = instrPC + op->length;
+        bool           enableIME = gb->imePending;
+
+        // The flags may only be stale while nothing can interrupt the
+        // instructions up to the one overwriting them, or trace them
+        OpcodeHandler handler = op->handler;
+        if (op->flagless != NULL && !enableIME && !gb->irqCheck &&
+            gb->trace == NULL &&
+            gb->cycles + op->flaglessCycles < gb->nextEvent &&
+            gb->cycles + op->flaglessCycles < limit)
+        {
+            handler = op->flagless;
+        }
+
+        gb->operand      = op->operand;
+        gb->regs[REG_PC] = nextPC;
+
+        uint8_t cycles = ExecuteInstruction(gb, handler, op->opcode, instrPC);
+        if (cycles == 0)
+        {
+            gb->stopped = true;
+            return;
+        }
+
+        RetireInstruction(gb, enableIME);
+        FinishStep(gb, cycles);
+        bool frameEnd = toFrame && gb->frameDone;
+
+        // The jump back to the start of a poll loop ends it like any other
+        if (block->poll && i == block->count - 1 && !frameEnd &&
+            !gb->debugBreak && gb->cycles < limit)
+        {
+            SkipPollLoop(gb, block, &state, limit);
+        }
+
+        // Interrupts, frame ends, watchpoints, bank switches and writes to
+        // the block's own page all end it early
+        if (gb->regs[REG_PC] != nextPC || frameEnd || gb->debugBreak ||
+            gb->cycles >= limit || gb->readPages[block->pc >> 8] != block->page ||
+            (block->pageId >= 0 &&
+             gb->codeGenerations[block->pageId] != block->generation))
+        {
+            return;
+        }
+    }
+}
+
+//-------------Library API-------------
+
+bool GB_LoadRom(GB *gb, const char *rom, const char *bootRom)
+{
+    if (gb->bootRom != NULL)
+    {
+        ReleaseRom(gb->bootRom);
+        gb->bootRom = NULL;
+    }
+    if (gb->cart != NULL)
+    {
+        ReleaseRom(gb->cart);
+        gb->cart = NULL;
+    }
+    FreeCartRam(gb);
+
+    if (bootRom != NULL)
+    {
+        gb->bootRom = AcquireRom(bootRom, &gb->bootRomSize);
+        if (gb->bootRom == NULL)
+        {
+            printf("Failed to load boot ROM: %s\n", bootRom);
+            return false;
+        }
+    }
+
+    gb->cart = AcquireRom(rom, &gb->cartSize);
+    if (gb->cart == NULL)
+    {
+        printf("Failed to load ROM: %s\n", rom);
+        return false;
+    }
+
+    if (!InitCart(gb))
+    {
+        return false;
+    }
+
+    GB_Reset(gb);
+
+    return true;
+}
+
+bool GB_IsCGB(GB *gb)
+{
+    return gb->cgb;
+}
+
+void GB_Reset(GB *gb)
+{
+    memset(gb->io, 0, sizeof(gb->io));
+    memset(gb->hram, 0, sizeof(gb->hram));
+    memset(gb->oam, 0, sizeof(gb->oam));
+    memset(gb->vram, 0, sizeof(gb->vram));
+    memset(gb->wram, 0, sizeof(gb->wram));
+    gb->ie = 0;
+    memset(gb->tileDirty, true, sizeof(gb->tileDirty));
+    gb->spritesDirty = true;
+    memset(gb->dirtyPages, true, sizeof(gb->dirtyPages));
+
+    ResetCart(gb);
+
+    // Info from
+    // https://realboyemulator.files.wordpress.com/2013/01/gbcpuman.pdf
+    // Power Up Sequence (Found on Page 18)
+
+    gb->regs[REG_BC] = 0x0013;
+    gb->regs[REG_DE] = 0x00D8;
+    gb->regs[REG_HL] = 0x014D;
+    gb->regs[REG_SP] = 0xFFFE;
+    gb->regs[REG_AF] = 0x0000;
+    gb->lazyOp       = LAZY_NONE;
+
+    gb->regs[REG_PC] = 0x0;
+    gb->IME          = false;
+    gb->imePending   = false;
+    gb->halted       = false;
+    gb->stopped      = false;
+    gb->irqCheck     = false;
+    gb->frameDone    = false;
+    gb->cycles       = 0;
+    gb->instructions = 0;
+    gb->divBase      = 0;
+    gb->timerSync    = 0;
+    gb->serialBits   = 0;
+    gb->ppuMode      = PPU_MODE_HBLANK;
+
+    gb->serialOutLength = 0;
+    gb->statLine     = false;
+
+    gb->doubleSpeed = false;
+    gb->hdmaSource  = 0;
+    gb->hdmaDest    = 0;
+    gb->hdmaBlocks  = 0;
+    gb->hdmaActive  = false;
+
+    // The CGB boot ROM leaves every color white, colors are RGB555 little
+    // endian
+    for (int i = 0; i < CGB_PALETTE_SIZE; i += 2)
+    {
+        gb->bgPalettes[i]      = 0xFF;
+        gb->bgPalettes[i + 1]  = 0x7F;
+        gb->objPalettes[i]     = 0xFF;
+        gb->objPalettes[i + 1] = 0x7F;
+    }
+
+    memset(gb->apuChannels, 0, sizeof(gb->apuChannels));
+    gb->sweepFrequency = 0;
+    gb->sweepTimer     = 0;
+    gb->sweepEnabled   = false;
+    gb->apuStep        = 0;
+    gb->apuStepCycle   = 0;
+    ResetAudio(gb);
+
+    for (int i = 0; i < EVENT_COUNT; ++i)
+    {
+        gb->events[i] = EVENT_NEVER;
+    }
+    gb->nextEvent = EVENT_NEVER;
+
+    // Without a boot ROM start where it would have handed over
+    if (gb->bootRom == NULL)
+    {
+        gb->regs[REG_AF]          = 0x01B0;
+        gb->regs[REG_PC]          = CART_ENTRYPOINT;
+        gb->io[IO_BOOT - IO_BASE] = 1;
+    }
+
+    if (gb->bootRom == NULL && gb->cgb)
+    {
+        gb->regs[REG_AF] = 0x1180;
+        gb->regs[REG_BC] = 0x0000;
+        gb->regs[REG_DE] = 0xFF56;
+        gb->regs[REG_HL] = 0x000D;
+    }
+
+    MapMemory(gb);
+
+    WriteMem(gb, 0xFF05, 0x00);
+    WriteMem(gb, 0xFF06, 0x00);
+    WriteMem(gb, 0xFF07, 0x00);
+    // Powered on first, the sound registers are read only while off
+    WriteMem(gb, 0xFF26, 0xF1);
+    WriteMem(gb, 0xFF10, 0x80);
+    WriteMem(gb, 0xFF11, 0xBF);
+    WriteMem(gb, 0xFF12, 0xF3);
+    WriteMem(gb, 0xFF14, 0xBF);
+    WriteMem(gb, 0xFF16, 0x3F);
+    WriteMem(gb, 0xFF17, 0x00);
+    WriteMem(gb, 0xFF19, 0xBF);
+    WriteMem(gb, 0xFF1A, 0x7F);
+    WriteMem(gb, 0xFF1B, 0xFF);
+    WriteMem(gb, 0xFF1C, 0x9F);
+    WriteMem(gb, 0xFF1E, 0xBF);
+    WriteMem(gb, 0xFF20, 0xFF);
+    WriteMem(gb, 0xFF21, 0x00);
+    WriteMem(gb, 0xFF22, 0x00);
+    WriteMem(gb, 0xFF23, 0xBF);
+    WriteMem(gb, 0xFF24, 0x77);
+    WriteMem(gb, 0xFF25, 0xF3);
+    WriteMem(gb, 0xFF40, 0x91);
+    WriteMem(gb, 0xFF42, 0x00);
+    WriteMem(gb, 0xFF43, 0x00);
+    WriteMem(gb, 0xFF45, 0x00);
+    WriteMem(gb, 0xFF47, 0xFC);
+    WriteMem(gb, 0xFF48, 0xFF);
+    WriteMem(gb, 0xFF49, 0xFF);
+    WriteMem(gb, 0xFF4A, 0x00);
+    WriteMem(gb, 0xFF4B, 0x00);
+    WriteMem(gb, 0xFFFF, 0x00);
+
+    WriteMem(gb, IO_JOYP, 0xFF);
+    WriteMem(gb, IO_IF, 0x00);
+}
+
+bool GB_RunCycles(GB *gb, uint64_t cycles)
+{
+    uint64_t end = gb->cycles + cycles;
+
+    // VBlanks don't end the run, only GB_RunFrame cares about them
+    gb->debugBreak = false;
+    gb->frameDone  = false;
+    while (!gb->stopped && !gb->debugBreak && gb->cycles < end)
+    {
+        RunBlock(gb, end, false);
+    }
+
+    return !gb->stopped;
+}
+
+bool GB_RunFrame(GB *gb)
+{
+    // A frame's worth of cycles also ends the frame while the LCD is off
+    uint64_t end = gb->cycles + GetPPUCycles(gb, PPU_FRAME_CYCLES);
+
+    gb->debugBreak = false;
+    while (!gb->stopped && !gb->frameDone && !gb->debugBreak &&
+           gb->cycles < end)
+    {
+        RunBlock(gb, end, true);
+    }
+    gb->frameDone = false;
+
+    return !gb->stopped;
+}
+
+const uint32_t *GB_GetFramebuffer(GB *gb)
+{
+    return gb->framebuffer;
+}
+
+// Multiplies in 8 bytes at a time, finished with the MurmurHash3 mixer
+uint64_t GB_Hash(const void *data, size_t size)
+{
+    const uint8_t *bytes = data;
+    uint64_t       hash  = 0xCBF29CE484222325 ^ size;
+    uint64_t       word;
+
+    for (; size >= 8; size -= 8, bytes += 8)
+    {
+        memcpy(&word, bytes, 8);
+        hash = (hash ^ word) * 0x100000001B3;
+        hash ^= hash >> 29;
+    }
+
+    word = 0;
+    memcpy(&word, bytes, size);
+    hash = (hash ^ word) * 0x100000001B3;
+
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCD;
+    hash ^= hash >> 33;
+    hash *= 0xC4CEB9FE1A85EC53;
+    hash ^= hash >> 33;
+
+    return hash;
+}
+
+uint64_t GB_HashFramebuffer(GB *gb)
+{
+    return GB_Hash(gb->framebuffer, sizeof(gb->framebuffer));
+}
+
+size_t GB_ReadSerial(GB *gb, uint8_t *out, size_t count)
+{
+    if (count > gb->serialOutLength)
+    {
+        count = gb->serialOutLength;
+    }
+
+    memcpy(out, gb->serialOut, count);
+    memmove(gb->serialOut, &gb->serialOut[count],
+            gb->serialOutLength - count);
+    gb->serialOutLength -= count;
+
+    return count;
+}
+
+void GB_SetButtons(GB *gb, uint8_t buttons)
+{
+    uint8_t lines = GetJoypadLines(gb);
+
+    // Only newly pressed buttons of a selected group raise the interrupt
+    gb->buttons = buttons;
+    UpdateJoypad(gb, lines);
+}
+
+uint64_t GB_GetCycles(GB *gb)
+{
+    return gb->cycles;
+}
+
+uint64_t GB_GetInstructions(GB *gb)
+{
+    return gb->instructions;
+}
+
+bool GB_SetAudio(GB *gb, uint32_t sampleRate)
+{
+    free(gb->synth);
+    gb->synth = NULL;
+
+    if (sampleRate == 0)
+    {
+        return true;
+    }
+
+    gb->synth = calloc(1, sizeof(APUSynth));
+    if (gb->synth == NULL)
+    {
+        return false;
+    }
+
+    gb->synth->sampleRate = sampleRate;
+    InitBlipKernel(gb->synth);
+    ResetAudio(gb);
+
+    return true;
+}
+
+size_t GB_ReadSamples(GB *gb, int16_t *samples, size_t count)
+{
+    if (gb->synth == NULL)
+    {
+        return 0;
+    }
+
+    SyncAudio(gb);
+
+    uint32_t available = GetAvailableSamples(gb->synth);
+    if (count > available)
+    {
+        count = available;
+    }
+
+    TakeSamples(gb->synth, samples, count);
+    return count;
+}
+
+bool GB_SetBlockCache(GB *gb, bool enabled)
+{
+    if (enabled && gb->blocks == NULL)
+    {
+        gb->blocks = calloc(BLOCK_CACHE_SIZE, sizeof(Block));
+    }
+    else if (!enabled && gb->blocks != NULL)
+    {
+        free(gb->blocks);
+        gb->blocks = NULL;
+    }
+
+    // Pages that held blocks go back to fast writes
+    memset(gb->codePages, false, sizeof(gb->codePages));
+    ApplyWriteTracking(gb);
+
+    return enabled == (gb->blocks != NULL);
+}
+
+bool GB_HasBattery(GB *gb)
+{
+    return gb->hasBattery && gb->cartRamSize > 0;
+}
+
+bool GB_SetSaveFile(GB *gb, const char *path)
+{
+    if (!GB_HasBattery(gb))
+    {
+        return false;
+    }
+
+    char *savePath = strdup(path);
+    if (savePath == NULL)
+    {
+        return false;
+    }
+
+    bool     mapped = true;
+    uint8_t *ram    = MapSaveFile(path, gb->cartRam, gb->cartRamSize);
+
+    // Fall back to a copy written back whole where mmap isn't available
+    if (ram == NULL)
+    {
+        mapped = false;
+        ram    = LoadSaveFile(path, gb->cartRam, gb->cartRamSize);
+    }
+
+    if (ram == NULL)
+    {
+        printf("Failed to open save file: %s\n", path);
+        free(savePath);
+        return false;
+    }
+
+    FreeCartRam(gb);
+    gb->cartRam    = ram;
+    gb->savePath   = savePath;
+    gb->saveMapped = mapped;
+
+    // The page tables point into the old RAM
+    MapMemory(gb);
+
+    return true;
+}
+
+//-------------Save states-------------
+// A state is a header followed by the fields below packed back to back, then
+// the cartridge RAM. Copying field by field keeps the layout independent of
+// struct padding. Pointers and caches (page tables, decoded tiles) are
+// rebuilt on load. New fields go at the end along with a version bump.
+
+typedef struct StateHeaderstruct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    // Header and global checksums of the cartridge the state belongs to
+    uint8_t  headerChecksum;
+    // Whether the state is a Game Boy Color's
+    uint8_t  cgb;
+    uint16_t globalChecksum;
+} StateHeader;
+
+typedef struct StateFieldstruct
+{
+    size_t offset;
+    size_t size;
+} StateField;
+
+#define STATE_FIELD(field) {offsetof(GB, field), sizeof(((GB *)0)->field)}
+
+const StateField stateFields[] = {
+    STATE_FIELD(regs),       STATE_FIELD(IME),        STATE_FIELD(imePending),
+    STATE_FIELD(halted),     STATE_FIELD(stopped),    STATE_FIELD(buttons),
+    STATE_FIELD(irqCheck),   STATE_FIELD(cycles),     STATE_FIELD(events),
+    STATE_FIELD(nextEvent),  STATE_FIELD(divBase),    STATE_FIELD(timerSync),
+    STATE_FIELD(ppuMode),    STATE_FIELD(statLine),   STATE_FIELD(frameDone),
+    STATE_FIELD(serialBits), STATE_FIELD(windowLine), STATE_FIELD(io),
+    STATE_FIELD(hram),       STATE_FIELD(ie),         STATE_FIELD(oam),
+    STATE_FIELD(vram),       STATE_FIELD(wram),       STATE_FIELD(romBank0),
+    STATE_FIELD(romBank),    STATE_FIELD(ramBank),    STATE_FIELD(ramEnabled),
+    STATE_FIELD(mbc1Bank1),  STATE_FIELD(mbc1Bank2),  STATE_FIELD(mbc1Mode),
+    STATE_FIELD(rtcTime),    STATE_FIELD(rtcCycle),   STATE_FIELD(rtcHalt),
+    STATE_FIELD(rtcCarry),   STATE_FIELD(rtcLatched), STATE_FIELD(rtcLatch),
+    STATE_FIELD(apuChannels),
+    STATE_FIELD(sweepFrequency), STATE_FIELD(sweepTimer),
+    STATE_FIELD(sweepEnabled),   STATE_FIELD(apuStep),
+    STATE_FIELD(apuStepCycle),   STATE_FIELD(doubleSpeed),
+    STATE_FIELD(hdmaSource),     STATE_FIELD(hdmaDest),
+    STATE_FIELD(hdmaBlocks),     STATE_FIELD(hdmaActive),
+    STATE_FIELD(bgPalettes),     STATE_FIELD(objPalettes),
+};
+
+#define STATE_FIELD_COUNT (sizeof(stateFields) / sizeof(stateFields[0]))
+
+void FillStateHeader(GB *gb, StateHeader *header)
+{
+    memset(header, 0, sizeof(StateHeader));
+
+    header->magic          = GB_STATE_MAGIC;
+    header->version        = GB_STATE_VERSION;
+    header->size           = GB_StateSize(gb);
+    header->headerChecksum = gb->cart[CART_HEADER_CHECKSUM];
+    header->cgb            = gb->cgb;
+    header->globalChecksum = (gb->cart[CART_GLOBAL_CHECKSUM] << 8) |
+                             gb->cart[CART_GLOBAL_CHECKSUM_END];
+}
+
+// Where a field of GB starts in the packed fields
+size_t GetStateOffset(size_t fieldOffset)
+{
+    size_t offset = 0;
+
+    for (size_t i = 0; i < STATE_FIELD_COUNT; ++i)
+    {
+        if (stateFields[i].offset == fieldOffset)
+        {
+            break;
+        }
+        offset += stateFields[i].size;
+    }
+
+    return offset;
+}
+
+size_t GB_StateSize(GB *gb)
+{
+    size_t size = sizeof(StateHeader) + gb->cartRamSize;
+
+    for (size_t i = 0; i < STATE_FIELD_COUNT; ++i)
+    {
+        size += stateFields[i].size;
+    }
+
+    return size;
+}
+
+size_t GB_SaveState(GB *gb, void *buf, size_t size)
+{
+    size_t needed = GB_StateSize(gb);
+    if (gb->cart == NULL || size < needed)
+    {
+        return 0;
+    }
+
+    uint8_t *out = buf;
+
+    // States hold F as the program sees it
+    MaterializeFlags(gb);
+
+    FillStateHeader(gb, (StateHeader *)out);
+    out += sizeof(StateHeader);
+
+    for (size_t i = 0; i < STATE_FIELD_COUNT; ++i)
+    {
+        memcpy(out, (uint8_t *)gb + stateFields[i].offset,
+               stateFields[i].size);
+        out += stateFields[i].size;
+    }
+
+    if (gb->cartRamSize > 0)
+    {
+        memcpy(out, gb->cartRam, gb->cartRamSize);
+    }
+
+    return needed;
+}
+
+bool GB_LoadState(GB *gb, const void *buf, size_t size)
+{
+    if (gb->cart == NULL || size < sizeof(StateHeader))
+    {
+        return false;
+    }
+
+    StateHeader expected;
+    StateHeader header;
+
+    FillStateHeader(gb, &expected);
+    memcpy(&header, buf, sizeof(StateHeader));
+
+    if (memcmp(&header, &expected, sizeof(StateHeader)) != 0 ||
+        size < expected.size)
+    {
+        printf("Save state doesn't match the loaded cartridge\n");
+        return false;
+    }
+
+    const uint8_t *in  = (const uint8_t *)buf + sizeof(StateHeader);
+    const uint8_t *io = in + GetStateOffset(offsetof(GB, io));
+
+    // The boot ROM can only still be mapped if there is one
+    if (io[IO_BOOT - IO_BASE] == 0 && gb->bootRom == NULL)
+    {
+        printf("Save state needs a boot ROM\n");
+        return false;
+    }
+
+    for (size_t i = 0; i < STATE_FIELD_COUNT; ++i)
+    {
+        memcpy((uint8_t *)gb + stateFields[i].offset, in,
+               stateFields[i].size);
+        in += stateFields[i].size;
+    }
+
+    if (gb->cartRamSize > 0)
+    {
+        memcpy(gb->cartRam, in, gb->cartRamSize);
+    }
+
+    // F was saved with every flag in place
+    gb->lazyOp = LAZY_NONE;
+    ResetAudio(gb);
+
+    // Memory changed behind the back of any snapshot ring
+    memset(gb->tileDirty, true, sizeof(gb->tileDirty));
+    gb->spritesDirty = true;
+    memset(gb->dirtyPages, true, sizeof(gb->dirtyPages));
+    MapMemory(gb);
+
+    return true;
+}
+
+//-------------Delta snapshots-------------
+
+typedef struct Snapshotstruct
+{
+    bool keyframe;
+
+    // Everything in stateFields but vram and wram
+    uint8_t *core;
+
+    // Pages stored, see dirtyPages for the ids
+    uint16_t  pageCount;
+    uint16_t *pageIds;
+    uint8_t * pages;
+} Snapshot;
+
+struct SnapshotRingstruct
+{
+    // The GB whose writes are tracked
+    GB *gb;
+
+    Snapshot *snapshots;
+    uint32_t  capacity;
+    uint32_t  keyframeInterval;
+
+    // Oldest snapshot and number of snapshots held
+    uint32_t first;
+    uint32_t count;
+
+    size_t coreSize;
+};
+
+// VRAM and WRAM are stored as pages, see GetStatePage
+bool IsPagedStateField(const StateField *field)
+{
+    return field->offset == offsetof(GB, vram) ||
+           field->offset == offsetof(GB, wram);
+}
+
+// Size of the state fields except the paged ones
+size_t GetCoreStateSize()
+{
+    size_t size = 0;
+
+    for (size_t i = 0; i < STATE_FIELD_COUNT; ++i)
+    {
+        size += stateFields[i].size;
+    }
+
+    return size - sizeof(((GB *)0)->vram) - sizeof(((GB *)0)->wram);
+}
+
+void PackCoreState(GB *gb, uint8_t *out)
+{
+    MaterializeFlags(gb);
+
+    for (size_t i = 0; i < STATE_FIELD_COUNT; ++i)
+    {
+        if (IsPagedStateField(&stateFields[i]))
+        {
+            continue;
+        }
+
+        memcpy(out, (uint8_t *)gb + stateFields[i].offset,
+               stateFields[i].size);
+        out += stateFields[i].size;
+    }
+}
+
+void UnpackCoreState(GB *gb, const uint8_t *in)
+{
+    for (size_t i = 0; i < STATE_FIELD_COUNT; ++i)
+    {
+        if (IsPagedStateField(&stateFields[i]))
+        {
+            continue;
+        }
+
+        memcpy((uint8_t *)gb + stateFields[i].offset, in,
+               stateFields[i].size);
+        in += stateFields[i].size;
+    }
+
+    gb->lazyOp = LAZY_NONE;
+    ResetAudio(gb);
+}
+
+// A DMG never maps VRAM bank 1 or WRAM banks 2-7, snapshots leave them out
+bool IsStatePageUsed(GB *gb, uint16_t id)
+{
+    if (gb->cgb || id >= DIRTY_MEM_PAGES)
+    {
+        return true;
+    }
+
+    return id < DIRTY_VRAM_PAGES ? id < (VRAM_SIZE >> 8)
+                                 : id < DIRTY_VRAM_PAGES + (WRAM_SIZE >> 8);
+}
+
+uint8_t *GetStatePage(GB *gb, uint16_t id)
+{
+    if (id < DIRTY_VRAM_PAGES)
+    {
+        return &gb->vram[id << 8];
+    }
+
+    if (id < DIRTY_MEM_PAGES)
+    {
+        return &gb->wram[(id - DIRTY_VRAM_PAGES) << 8];
+    }
+
+    return &gb->cartRam[(id - DIRTY_MEM_PAGES) << 8];
+}
+
+Snapshot *GetSnapshot(SnapshotRing *ring, uint32_t index)
+{
+    return &ring->snapshots[(ring->first + index) % ring->capacity];
+}
+
+void FreeSnapshot(Snapshot *snap)
+{
+    // The core state owns the single allocation
+    free(snap->core);
+    memset(snap, 0, sizeof(Snapshot));
+}
+
+SnapshotRing *GB_CreateSnapshotRing(GB *gb, uint32_t capacity,
+                                    uint32_t keyframeInterval)
+{
+    if (gb->cart == NULL || capacity == 0)
+    {
+        return NULL;
+    }
+
+    SnapshotRing *ring = calloc(1, sizeof(SnapshotRing));
+    if (ring == NULL)
+    {
+        return NULL;
+    }
+
+    ring->snapshots = calloc(capacity, sizeof(Snapshot));
+    if (ring->snapshots == NULL)
+    {
+        free(ring);
+        return NULL;
+    }
+
+    ring->gb               = gb;
+    ring->capacity         = capacity;
+    ring->keyframeInterval = keyframeInterval > 0 ? keyframeInterval : 1;
+    ring->coreSize         = GetCoreStateSize();
+
+    if (ring->keyframeInterval > capacity)
+    {
+        ring->keyframeInterval = capacity;
+    }
+
+    gb->trackWrites = true;
+    ApplyWriteTracking(gb);
+
+    return ring;
+}
+
+void GB_DestroySnapshotRing(SnapshotRing *ring)
+{
+    if (ring == NULL)
+    {
+        return;
+    }
+
+    for (uint32_t i = 0; i < ring->count; ++i)
+    {
+        FreeSnapshot(GetSnapshot(ring, i));
+    }
+
+    ring->gb->trackWrites = false;
+    ApplyWriteTracking(ring->gb);
+
+    free(ring->snapshots);
+    free(ring);
+}
+
+bool GB_TakeSnapshot(SnapshotRing *ring)
+{
+    GB *gb = ring->gb;
+
+    // Make room by dropping the oldest keyframe and its deltas
+    if (ring->count == ring->capacity)
+    {
+        do
+        {
+            FreeSnapshot(GetSnapshot(ring, 0));
+            ring->first = (ring->first + 1) % ring->capacity;
+            ring->count -= 1;
+        } while (ring->count > 0 && !GetSnapshot(ring, 0)->keyframe);
+    }
+
+    // Deltas since the newest keyframe
+    uint32_t deltas = 0;
+    while (deltas < ring->count &&
+           !GetSnapshot(ring, ring->count - 1 - deltas)->keyframe)
+    {
+        deltas += 1;
+    }
+
+    bool keyframe = ring->count == 0 || deltas + 1 >= ring->keyframeInterval;
+    uint16_t ramPages = gb->cartRamSize >> 8;
+
+    uint16_t pageIds[DIRTY_PAGES];
+    uint16_t pageCount = 0;
+
+    for (uint16_t id = 0; id < DIRTY_MEM_PAGES + ramPages; ++id)
+    {
+        if ((keyframe || gb->dirtyPages[id]) && IsStatePageUsed(gb, id))
+        {
+            pageIds[pageCount++] = id;
+        }
+    }
+
+    uint8_t *block = malloc(ring->coreSize + pageCount * sizeof(uint16_t) +
+                            pageCount * 0x100);
+    if (block == NULL)
+    {
+        return false;
+    }
+
+    Snapshot *snap  = GetSnapshot(ring, ring->count);
+    snap->keyframe  = keyframe;
+    snap->core      = block;
+    snap->pageCount = pageCount;
+    snap->pageIds   = (uint16_t *)(block + ring->coreSize);
+    snap->pages     = block + ring->coreSize + pageCount * sizeof(uint16_t);
+
+    PackCoreState(gb, snap->core);
+    memcpy(snap->pageIds, pageIds, pageCount * sizeof(uint16_t));
+
+    for (uint16_t i = 0; i < pageCount; ++i)
+    {
+        memcpy(&snap->pages[i << 8], GetStatePage(gb, pageIds[i]), 0x100);
+    }
+
+    ring->count += 1;
+
+    // Start tracking the next delta
+    memset(gb->dirtyPages, false, sizeof(gb->dirtyPages));
+    ApplyWriteTracking(gb);
+
+    return true;
+}
+
+uint32_t GB_GetSnapshotCount(SnapshotRing *ring)
+{
+    return ring->count;
+}
+
+bool GB_RestoreSnapshot(SnapshotRing *ring, uint32_t index, GB *gb)
+{
+    if (index >= ring->count || gb->cart != ring->gb->cart ||
+        gb->cartRamSize != ring->gb->cartRamSize)
+    {
+        return false;
+    }
+
+    // Replay the pages from the keyframe the snapshot depends on
+    uint32_t keyframe = index;
+    while (!GetSnapshot(ring, keyframe)->keyframe)
+    {
+        keyframe -= 1;
+    }
+
+    for (uint32_t i = keyframe; i <= index; ++i)
+    {
+        Snapshot *snap = GetSnapshot(ring, i);
+
+        for (uint16_t j = 0; j < snap->pageCount; ++j)
+        {
+            memcpy(GetStatePage(gb, snap->pageIds[j]), &snap->pages[j << 8],
+                   0x100);
+        }
+    }
+
+    UnpackCoreState(gb, GetSnapshot(ring, index)->core);
+
+    if (gb == ring->gb)
+    {
+        // Newer deltas don't follow from this state anymore
+        for (uint32_t i = index + 1; i < ring->count; ++i)
+        {
+            FreeSnapshot(GetSnapshot(ring, i));
+        }
+        ring->count = index + 1;
+
+        memset(gb->dirtyPages, false, sizeof(gb->dirtyPages));
+    }
+    else
+    {
+        memset(gb->dirtyPages, true, sizeof(gb->dirtyPages));
+    }
+
+    memset(gb->tileDirty, true, sizeof(gb->tileDirty));
+    gb->spritesDirty = true;
+    MapMemory(gb);
+
+    return true;
+}
+
+
+//-------------Movies-------------
+
+#define MOVIE_FLAG_BOOT_ROM 0x1
+
+// Header of movie files, followed by one byte of buttons per frame
+typedef struct MovieHeaderstruct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t frameCount;
+    // Checksums of the cartridge, see StateHeader
+    uint8_t  headerChecksum;
+    uint8_t  flags;
+    uint16_t globalChecksum;
+} MovieHeader;
+
+struct Moviestruct
+{
+    MovieHeader header;
+
+    uint8_t *frames;
+    uint32_t capacity;
+};
+
+void FillMovieHeader(GB *gb, MovieHeader *header)
+{
+    memset(header, 0, sizeof(MovieHeader));
+
+    header->magic          = GB_MOVIE_MAGIC;
+    header->version        = GB_MOVIE_VERSION;
+    header->headerChecksum = gb->cart[CART_HEADER_CHECKSUM];
+    header->flags          = gb->bootRom != NULL ? MOVIE_FLAG_BOOT_ROM : 0;
+    header->globalChecksum = (gb->cart[CART_GLOBAL_CHECKSUM] << 8) |
+                             gb->cart[CART_GLOBAL_CHECKSUM_END];
+}
+
+Movie *GB_CreateMovie(GB *gb)
+{
+    if (gb->cart == NULL)
+    {
+        return NULL;
+    }
+
+    Movie *movie = calloc(1, sizeof(Movie));
+    if (movie != NULL)
+    {
+        FillMovieHeader(gb, &movie->header);
+    }
+
+    return movie;
+}
+
+Movie *GB_LoadMovie(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)
+    {
+        printf("Failed to open movie: %s\n", path);
+        return NULL;
+    }
+
+    Movie *movie = calloc(1, sizeof(Movie));
+    if (movie == NULL)
+    {
+        fclose(f);
+        return NULL;
+    }
+
+    MovieHeader *header = &movie->header;
+    if (fread(header, sizeof(MovieHeader), 1, f) != 1 ||
+        header->magic != GB_MOVIE_MAGIC || header->version != GB_MOVIE_VERSION)
+    {
+        printf("Not a movie: %s\n", path);
+        GB_DestroyMovie(movie);
+        fclose(f);
+        return NULL;
+    }
+
+    movie->capacity = header->frameCount;
+    movie->frames   = malloc(movie->capacity > 0 ? movie->capacity : 1);
+
+    if (movie->frames == NULL ||
+        fread(movie->frames, 1, header->frameCount, f) != header->frameCount)
+    {
+        printf("Truncated movie: %s\n", path);
+        GB_DestroyMovie(movie);
+        fclose(f);
+        return NULL;
+    }
+
+    fclose(f);
+    return movie;
+}
+
+bool GB_SaveMovie(Movie *movie, const char *path)
+{
+    FILE *f = fopen(path, "wb");
+    if (f == NULL)
+    {
+        printf("Failed to create movie: %s\n", path);
+        return false;
+    }
+
+    bool ok = fwrite(&movie->header, sizeof(MovieHeader), 1, f) == 1 &&
+              fwrite(movie->frames, 1, movie->header.frameCount, f) ==
+                  movie->header.frameCount;
+
+    ok = fclose(f) == 0 && ok;
+    if (!ok)
+    {
+        printf("Failed to write movie: %s\n", path);
+    }
+
+    return ok;
+}
+
+void GB_DestroyMovie(Movie *movie)
+{
+    if (movie != NULL)
+    {
+        free(movie->frames);
+        free(movie);
+    }
+}
+
+bool GB_RecordFrame(Movie *movie, uint8_t buttons)
+{
+    if (movie->header.frameCount == movie->capacity)
+    {
+        uint32_t capacity = movie->capacity > 0 ? movie->capacity * 2 : 4096;
+        uint8_t *frames   = realloc(movie->frames, capacity);
+        if (frames == NULL)
+        {
+            return false;
+        }
+
+        movie->frames   = frames;
+        movie->capacity = capacity;
+    }
+
+    movie->frames[movie->header.frameCount++] = buttons;
+    return true;
+}
+
+uint32_t GB_GetMovieLength(Movie *movie)
+{
+    return movie->header.frameCount;
+}
+
+uint8_t GB_GetMovieButtons(Movie *movie, uint32_t frame)
+{
+    return frame < movie->header.frameCount ? movie->frames[frame] : 0;
+}
+
+bool GB_CheckMovie(GB *gb, Movie *movie)
+{
+    if (gb->cart == NULL)
+    {
+        return false;
+    }
+
+    MovieHeader expected;
+    FillMovieHeader(gb, &expected);
+
+    return movie->header.headerChecksum == expected.headerChecksum &&
+           movie->header.globalChecksum == expected.globalChecksum &&
+           movie->header.flags == expected.flags;
+}
+
+uint32_t GB_PlayMovie(GB *gb, Movie *movie, uint32_t frames)
+{
+    if (!GB_CheckMovie(gb, movie))
+    {
+        printf("Movie doesn't match the loaded cartridge\n");
+        return 0;
+    }
+
+    if (frames > movie->header.frameCount)
+    {
+        frames = movie->header.frameCount;
+    }
+
+    // Recorded from power on with nothing held before the first frame
+    GB_Reset(gb);
+    gb->buttons = 0;
+
+    for (uint32_t i = 0; i < frames; ++i)
+    {
+        GB_SetButtons(gb, movie->frames[i]);
+        if (!GB_RunFrame(gb))
+        {
+            return i + 1;
+        }
+    }
+
+    return frames;
+}
+
+//-------------Trace-------------
+
+bool GB_SetTrace(GB *gb, uint32_t capacity)
+{
+    TraceEntry *trace = NULL;
+    if (capacity > 0)
+    {
+        trace = malloc(capacity * sizeof(TraceEntry));
+        if (trace == NULL)
+        {
+            return false;
+        }
+    }
+
+    free(gb->trace);
+    gb->trace         = trace;
+    gb->traceCapacity = capacity;
+    gb->traceNext     = 0;
+    gb->traceCount    = 0;
+
+    return true;
+}
+
+bool GB_SaveTrace(GB *gb, const char *path)
+{
+    FILE *f = fopen(path, "wb");
+    if (f == NULL)
+    {
+        printf("Failed to create trace: %s\n", path);
+        return false;
+    }
+
+    TraceHeader header = {0};
+    header.magic       = GB_TRACE_MAGIC;
+    header.version     = GB_TRACE_VERSION;
+    header.entrySize   = sizeof(TraceEntry);
+    header.total       = gb->traceCount;
+    header.entryCount  = gb->traceCount < gb->traceCapacity ? gb->traceCount
+                                                            : gb->traceCapacity;
+
+    // Once the ring wrapped the oldest entry is the next to be overwritten
+    uint32_t oldest = header.entryCount < gb->traceCapacity ? 0 : gb->traceNext;
+    uint32_t first  = header.entryCount - oldest;
+
+    bool ok = fwrite(&header, sizeof(TraceHeader), 1, f) == 1;
+    if (header.entryCount > 0)
+    {
+        ok = ok &&
+             fwrite(&gb->trace[oldest], sizeof(TraceEntry), first, f) == first &&
+             fwrite(gb->trace, sizeof(TraceEntry), oldest, f) == oldest;
+    }
+
+    ok = fclose(f) == 0 && ok;
+    if (!ok)
+    {
+        printf("Failed to write trace: %s\n", path);
+    }
+
+    return ok;
+}
+
+// Operand of the r fields of an opcode, 6 being the byte at HL
+const char *GetOperandName(uint8_t reg)
+{
+    return reg == 6 ? "(HL)" : GetReg8Name(reg);
+}
+
+// Register pair of the rr fields of push and pop, which take AF for SP
+const char *GetStackRegName(uint8_t reg)
+{
+    return reg == REG_SP ? "AF" : GetRegName(reg);
+}
+
+uint8_t GB_Disassemble(uint16_t pc, const uint8_t *bytes, char *out,
+                       size_t size)
+{
+    static const char *conditions[4] = {"NZ", "Z", "NC", "C"};
+    static const char *alu[8]        = {"ADD A,", "ADC A,", "SUB ", "SBC A,",
+                                 "AND ",   "XOR ",   "OR ",  "CP "};
+    static const char *shifts[8]     = {"RLC", "RRC", "RL",   "RR",
+                                    "SLA", "SRA", "SWAP", "SRL"};
+    static const char *accumulator[8] = {"RLCA", "RRCA", "RLA", "RRA",
+                                         "DAA",  "CPL",  "SCF", "CCF"};
+    static const char *indirect[8]    = {"LD (BC),A",  "LD A,(BC)",
+                                      "LD (DE),A",  "LD A,(DE)",
+                                      "LD (HL+),A", "LD A,(HL+)",
+                                      "LD (HL-),A", "LD A,(HL-)"};
+
+    uint8_t  opcode = bytes[0];
+    uint8_t  n      = bytes[1];
+    uint16_t nn     = bytes[1] | bytes[2] << 8;
+    uint16_t target = pc + 2 + (int8_t)n;
+
+    // Fields of the opcode, xxyyyzzz with yyy being ppq
+    uint8_t x = opcode >> 6;
+    uint8_t y = (opcode >> 3) & 7;
+    uint8_t z = opcode & 7;
+    uint8_t p = y >> 1;
+    uint8_t q = y & 1;
+
+    if (opcode == OP_PREFIX_CB)
+    {
+        x = n >> 6;
+        y = (n >> 3) & 7;
+        z = n & 7;
+
+        if (x == 0)
+        {
+            snprintf(out, size, "%s %s", shifts[y], GetOperandName(z));
+        }
+        else
+        {
+            static const char *bits[4] = {"", "BIT", "RES", "SET"};
+            snprintf(out, size, "%s %u,%s", bits[x], y, GetOperandName(z));
+        }
+
+        return opcodeLengths[opcode];
+    }
+
+    snprintf(out, size, "DB $%02X", opcode);
+
+    if (x == 0)
+    {
+        switch (z)
+        {
+            case 0:
+                if (y == 0)
+                {
+                    snprintf(out, size, "NOP");
+                }
+                else if (y == 1)
+                {
+                    snprintf(out, size, "LD ($%04X),SP", nn);
+                }
+                else if (y == 2)
+                {
+                    snprintf(out, size, "STOP");
+                }
+                else if (y == 3)
+                {
+                    snprintf(out, size, "JR $%04X", target);
+                }
+                else
+                {
+                    snprintf(out, size, "JR %s,$%04X", conditions[y - 4],
+                             target);
+                }
+                break;
+
+            case 1:
+                if (q == 0)
+                {
+                    snprintf(out, size, "LD %s,$%04X", GetRegName(p), nn);
+                }
+                else
+                {
+                    snprintf(out, size, "ADD HL,%s", GetRegName(p));
+                }
+                break;
+
+            case 2:
+                snprintf(out, size, "%s", indirect[y]);
+                break;
+
+            case 3:
+                snprintf(out, size, "%s %s", q == 0 ? "INC" : "DEC",
+                         GetRegName(p));
+                break;
+
+            case 4:
+            case 5:
+                snprintf(out, size, "%s %s", z == 4 ? "INC" : "DEC",
+                         GetOperandName(y));
+                break;
+
+            case 6:
+                snprintf(out, size, "LD %s,$%02X", GetOperandName(y), n);
+                break;
+
+            case 7:
+                snprintf(out, size, "%s", accumulator[y]);
+                break;
+        }
+    }
+    else if (x == 1)
+    {
+        if (opcode == OP_HALT)
+        {
+            snprintf(out, size, "HALT");
+        }
+        else
+        {
+            snprintf(out, size, "LD %s,%s", GetOperandName(y),
+                     GetOperandName(z));
+        }
+    }
+    else if (x == 2)
+    {
+        snprintf(out, size, "%s%s", alu[y], GetOperandName(z));
+    }
+    else
+    {
+        switch (z)
+        {
+            case 0:
+                if (y < 4)
+                {
+                    snprintf(out, size, "RET %s", conditions[y]);
+                }
+                else if (y == 4)
+                {
+                    snprintf(out, size, "LDH ($FF%02X),A", n);
+                }
+                else if (y == 5)
+                {
+                    snprintf(out, size, "ADD SP,%d", (int8_t)n);
+                }
+                else if (y == 6)
+                {
+                    snprintf(out, size, "LDH A,($FF%02X)", n);
+                }
+                else
+                {
+                    snprintf(out, size, "LD HL,SP%+d", (int8_t)n);
+                }
+                break;
+
+            case 1:
+                if (q == 0)
+                {
+                    snprintf(out, size, "POP %s", GetStackRegName(p));
+                }
+                else
+                {
+                    static const char *names[4] = {"RET", "RETI", "JP HL",
+                                                   "LD SP,HL"};
+                    snprintf(out, size, "%s", names[p]);
+                }
+                break;
+
+            case 2:
+                if (y < 4)
+                {
+                    snprintf(out, size, "JP %s,$%04X", conditions[y], nn);
+                }
+                else if (y == 4)
+                {
+                    snprintf(out, size, "LD ($FF00+C),A");
+                }
+                else if (y == 5)
+                {
+                    snprintf(out, size, "LD ($%04X),A", nn);
+                }
+                else if (y == 6)
+                {
+                    snprintf(out, size, "LD A,($FF00+C)");
+                }
+                else
+                {
+                    snprintf(out, size, "LD A,($%04X)", nn);
+                }
+                break;
+
+            case 3:
+                if (y == 0)
+                {
+                    snprintf(out, size, "JP $%04X", nn);
+                }
+                else if (y == 6 || y == 7)
+                {
+                    snprintf(out, size, "%s", y == 6 ? "DI" : "EI");
+                }
+                break;
+
+            case 4:
+                if (y < 4)
+                {
+                    snprintf(out, size, "CALL %s,$%04X", conditions[y], nn);
+                }
+                break;
+
+            case 5:
+                if (q == 0)
+                {
+                    snprintf(out, size, "PUSH %s", GetStackRegName(p));
+                }
+                else if (p == 0)
+                {
+                    snprintf(out, size, "CALL $%04X", nn);
+                }
+                break;
+
+            case 6:
+                snprintf(out, size, "%s$%02X", alu[y], n);
+                break;
+
+            case 7:
+                snprintf(out, size, "RST $%02X", y * 8);
+                break;
+        }
+    }
+
+    return opcodeLengths[opcode];
+}
+
+//-------------Debugger-------------
+// Nothing is checked on the fast paths. Breakpoints end blocks in front of
+// them (see DecodeBlock) so that only the interpreter, which checks for one
+// in StepGB, ever reaches their address. Watched pages are left out of the
+// page tables, their accesses go through the slow paths of ReadMem and
+// WriteMem which are the only ones to look at watchpoints.
+
+typedef struct Debuggerstruct
+{
+    // GB_BREAKPOINT and GB_WATCH_* bits of every address
+    uint8_t points[0x10000];
+    // Addresses with a bit set, the debugger goes away with the last one
+    uint32_t pointCount;
+
+    // Watchpoints in each page of the address space
+    uint16_t readWatches[0x100];
+    uint16_t writeWatches[0x100];
+} Debugger;
+
+bool IsWatchedPage(GB *gb, uint8_t page, uint8_t type)
+{
+    const Debugger *debugger = gb->debugger;
+
+    return type == GB_WATCH_READ ? debugger->readWatches[page] > 0
+                                 : debugger->writeWatches[page] > 0;
+}
+
+bool IsBreakpoint(GB *gb, uint16_t addr)
+{
+    return (gb->debugger->points[addr] & GB_BREAKPOINT) != 0;
+}
+
+// The first hit stops the instruction, any more accesses it makes are let
+// through
+void RecordHit(GB *gb, uint8_t type, uint16_t addr, uint8_t val)
+{
+    if (gb->debugBreak)
+    {
+        return;
+    }
+
+    gb->debugHit.type   = type;
+    gb->debugHit.addr   = addr;
+    gb->debugHit.val    = val;
+    gb->debugHit.cycles = gb->cycles;
+    gb->debugBreak      = true;
+}
+
+// Called in front of every interpreted instruction, returns true to stop
+bool CheckBreakpoint(GB *gb)
+{
+    uint16_t pc = gb->regs[REG_PC];
+
+    if (!IsBreakpoint(gb, pc))
+    {
+        return false;
+    }
+
+    // Resuming from this very stop runs the instruction
+    if (gb->debugHit.type == GB_BREAKPOINT && gb->debugHit.addr == pc &&
+        gb->debugHit.cycles == gb->cycles)
+    {
+        return false;
+    }
+
+    // Reading the opcode once stopped can't hit a watchpoint instead
+    RecordHit(gb, GB_BREAKPOINT, pc, 0);
+    gb->debugHit.val = ReadMem(gb, pc);
+    return true;
+}
+
+void CheckWatchpoint(GB *gb, uint16_t addr, uint8_t type, uint8_t val)
+{
+    if (gb->debugger->points[addr] & type)
+    {
+        RecordHit(gb, type, addr, val);
+    }
+}
+
+// Slow path of ReadMem while the debugger is on
+uint8_t ReadWatched(GB *gb, uint16_t addr)
+{
+    const uint8_t *page = gb->mappedReadPages[addr >> 8];
+    uint8_t        val;
+
+    if (page != NULL)
+    {
+        val = page[addr & 0xFF];
+    }
+    else
+    {
+        val = ReadUnmapped(gb, addr);
+    }
+
+    CheckWatchpoint(gb, addr, GB_WATCH_READ, val);
+    return val;
+}
+
+// Sets the bits of mask at addr to those of bits and brings the page tables
+// and blocks in line
+bool SetDebugPoint(GB *gb, uint16_t addr, uint8_t mask, uint8_t bits)
+{
+    Debugger *debugger = gb->debugger;
+    if (debugger == NULL)
+    {
+        if ((bits & mask) == 0)
+        {
+            return true;
+        }
+
+        debugger = calloc(1, sizeof(Debugger));
+        if (debugger == NULL)
+        {
+            return false;
+        }
+        gb->debugger = debugger;
+    }
+
+    uint8_t old  = debugger->points[addr];
+    uint8_t set  = (old & ~mask) | (bits & mask);
+    uint8_t page = addr >> 8;
+
+    debugger->points[addr] = set;
+    debugger->pointCount += (set != 0) - (old != 0);
+    debugger->readWatches[page] +=
+        ((set & GB_WATCH_READ) != 0) - ((old & GB_WATCH_READ) != 0);
+    debugger->writeWatches[page] +=
+        ((set & GB_WATCH_WRITE) != 0) - ((old & GB_WATCH_WRITE) != 0);
+
+    if (debugger->pointCount == 0)
+    {
+        free(debugger);
+        gb->debugger = NULL;
+    }
+
+    // Blocks decoded across a new breakpoint must not run it
+    if ((old ^ set) & GB_BREAKPOINT)
+    {
+        FlushBlocks(gb);
+    }
+
+    ApplyReadWatches(gb);
+    ApplyWriteTracking(gb);
+
+    return true;
+}
+
+bool GB_SetBreakpoint(GB *gb, uint16_t addr, bool enabled)
+{
+    return SetDebugPoint(gb, addr, GB_BREAKPOINT,
+                         enabled ? GB_BREAKPOINT : 0);
+}
+
+bool GB_SetWatchpoint(GB *gb, uint16_t addr, uint8_t flags)
+{
+    return SetDebugPoint(gb, addr, GB_WATCH_READ | GB_WATCH_WRITE, flags);
+}
+
+bool GB_GetHit(GB *gb, DebugHit *hit)
+{
+    if (gb->debugBreak)
+    {
+        *hit = gb->debugHit;
+    }
+
+    return gb->debugBreak;
+}
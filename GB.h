@@ -1,30 +1,43 @@
 // GB.h - Main structure for the GameBoy
+//
+// The emulator core, built as the gb library. It never touches a window,
+// frontends drive it with GB_RunFrame/GB_RunCycles and present
+// GB_GetFramebuffer themselves.
+
+#pragma once
 
 #include "GBOpcodes.h"
 
 #include <assert.h>
+#include <inttypes.h>
 #include <memory.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
-
-#ifdef WIN32
-#include <SDL2/SDL.h>
-#elif __APPLE__
-#include <SDL.h>
-#endif
+#include <string.h>
 
 #define GB_VID_WIDTH 160
 #define GB_VID_HEIGHT 144
 
-#define RENDER_SCALE 4
+// Buttons for GB_SetButtons, a set bit means pressed
+#define GB_BUTTON_RIGHT 0x01
+#define GB_BUTTON_LEFT 0x02
+#define GB_BUTTON_UP 0x04
+#define GB_BUTTON_DOWN 0x08
+#define GB_BUTTON_A 0x10
+#define GB_BUTTON_B 0x20
+#define GB_BUTTON_SELECT 0x40
+#define GB_BUTTON_START 0x80
 
 #define CART_ENTRYPOINT 0x100
 #define CART_LOGO 0x104
 #define CART_LOGO_END 0x133
 #define CART_TITLE 0x134
 #define CART_TITLE_END 0x143
+// Last byte of the title on newer cartridges, see CGB_FLAG
+#define CART_CGB_FLAG 0x143
 #define CART_CART_TYPE 0x147
 #define CART_ROMSIZE 0x148
 #define CART_RAMSIZE 0x149
@@ -35,39 +48,155 @@
 #define CART_GLOBAL_CHECKSUM 0x14E
 #define CART_GLOBAL_CHECKSUM_END 0x14F
 
-#define instr(opcode, val, name) else if (opcode == val)
-
-#define instr_ld_r_r(opcode, base, shift, name)  \
-    else if ((opcode & base) == base &&          \
-             ((opcode >> shift & 0b111) <= 7 &&  \
-              (opcode >> shift & 0b111) != 6) && \
-             ((opcode & 0b111) <= 7 && (opcode & 0b111) != 6))
-
-#define instr_bit(opcode, name)                                         \
-    else if ((opcode & 0x40) == 0x40 && (opcode >> 3 & 0b111) >= 0x8 && \
-             (opcode >> 3 & 0b111) < 0xF &&                             \
-             ((opcode & 0b111) <= 7 && (opcode & 0b111) != 6))
-
-#define instr_res_bit(opcode, name)                                    \
-    else if ((opcode & 0x0) == 0x80 && (opcode >> 3 & 0b111) >= 0x8 && \
-             (opcode >> 3 & 0b111) < 0xF &&                            \
-             ((opcode & 0b111) <= 7 && (opcode & 0b111) != 6))
-
-#define instr_rst(opcode, name) \
-    else if ((opcode & 0xC7) == 0xC7 && ((opcode & 0b111) <= 7))
-
-#define instr_left_r(opcode, base, shift, name)                            \
-    else if ((opcode & base) == base && ((opcode >> shift & 0b111) <= 7 && \
-                                         (opcode >> shift & 0b111) != 6))
-
-#define instr_left_f(opcode, base, shift, name) \
-    else if ((opcode & base) == base && ((opcode >> shift & 0b11) <= 3))
-
-#define instr_right_r(opcode, base, name) \
-    else if ((opcode & base) == base &&   \
-             ((opcode & 0b111) <= 7 && (opcode & 0b111) != 6))
-
-#define instr_invalid() else
+// I/O registers
+#define IO_JOYP 0xFF00
+#define IO_SB 0xFF01
+#define IO_SC 0xFF02
+#define IO_DIV 0xFF04
+#define IO_TIMA 0xFF05
+#define IO_TMA 0xFF06
+#define IO_TAC 0xFF07
+#define IO_IF 0xFF0F
+#define IO_NR10 0xFF10
+#define IO_NR14 0xFF14
+#define IO_NR50 0xFF24
+#define IO_NR51 0xFF25
+#define IO_NR52 0xFF26
+#define IO_WAVE 0xFF30
+#define IO_WAVE_END 0xFF40
+#define IO_LCDC 0xFF40
+#define IO_STAT 0xFF41
+#define IO_SCY 0xFF42
+#define IO_SCX 0xFF43
+#define IO_LY 0xFF44
+#define IO_LYC 0xFF45
+#define IO_DMA 0xFF46
+#define IO_BGP 0xFF47
+#define IO_OBP0 0xFF48
+#define IO_OBP1 0xFF49
+#define IO_WY 0xFF4A
+#define IO_WX 0xFF4B
+#define IO_BOOT 0xFF50
+#define IO_IE 0xFFFF
+
+// Game Boy Color registers, plain storage on a DMG
+#define IO_KEY1 0xFF4D
+#define IO_VBK 0xFF4F
+#define IO_HDMA1 0xFF51
+#define IO_HDMA2 0xFF52
+#define IO_HDMA3 0xFF53
+#define IO_HDMA4 0xFF54
+#define IO_HDMA5 0xFF55
+#define IO_BCPS 0xFF68
+#define IO_BCPD 0xFF69
+#define IO_OCPS 0xFF6A
+#define IO_OCPD 0xFF6B
+#define IO_SVBK 0xFF70
+
+// CART_CGB_FLAG bit 7, set by cartridges made for (or also for) the CGB
+#define CGB_FLAG 0x80
+// Boot ROM sizes, the CGB's is mapped at 0x0000-0x00FF and 0x0200-0x08FF
+#define DMG_BOOT_ROM_SIZE 0x100
+#define CGB_BOOT_ROM_SIZE 0x900
+
+// Timing, in clock cycles (4.194304 MHz). In CGB double speed the CPU
+// clock runs at twice that, cycles count CPU clocks and the PPU and APU take
+// twice as many of them (see GetPPUCycles).
+#define CPU_CLOCK 4194304
+#define PPU_OAM_CYCLES 80
+#define PPU_TRANSFER_CYCLES 172
+#define PPU_LINE_CYCLES 456
+#define PPU_LINES 154
+#define PPU_FRAME_CYCLES (PPU_LINE_CYCLES * PPU_LINES)
+
+// LCD Status modes (lower two bits of 0xFF41)
+#define PPU_MODE_HBLANK 0
+#define PPU_MODE_VBLANK 1
+#define PPU_MODE_OAM 2
+#define PPU_MODE_TRANSFER 3
+
+// One serial bit every 512 cycles with the internal 8192 Hz clock
+#define SERIAL_BIT_CYCLES 512
+// Bytes sent over the serial port kept until read with GB_ReadSerial
+#define SERIAL_OUT_SIZE 1024
+
+// OAM DMA copies a byte per machine cycle after a one cycle delay
+#define DMA_CYCLES (4 + 160 * 4)
+
+// CGB VRAM DMA copies 16 byte blocks, stopping the CPU for this long for
+// each (at normal speed)
+#define HDMA_BLOCK_SIZE 16
+#define HDMA_BLOCK_CYCLES 32
+
+// Switching to or from double speed stops the CPU this long
+#define SPEED_SWITCH_CYCLES 8200
+
+// The APU frame sequencer steps at 512 Hz, off bit 12 of the divider
+#define APU_FRAME_CYCLES 8192
+#define APU_CHANNELS 4
+
+// Scheduled events, see ScheduleEvent
+#define EVENT_PPU 0
+#define EVENT_TIMER 1
+#define EVENT_SERIAL 2
+#define EVENT_APU 3
+#define EVENT_DMA 4
+#define EVENT_COUNT 5
+
+#define EVENT_NEVER UINT64_MAX
+
+// Last flag setting ALU operation, its flags are only merged into F when
+// something reads them (see GetFlags). The first three cover all of Z, N, H
+// and C, inc and dec leave C in F.
+#define LAZY_NONE 0
+#define LAZY_ADD 1
+#define LAZY_SUB 2
+#define LAZY_LOGIC 3
+#define LAZY_INC 4
+#define LAZY_DEC 5
+
+// Tile data, 0x8000-0x97FF holds 384 tiles of 16 bytes per VRAM bank
+#define VRAM_TILES_END 0x9800
+#define TILE_COUNT 384
+
+// The CGB has two VRAM banks and 8 WRAM banks of 4KB, bank 0 always at
+// 0xC000-0xCFFF and 1-7 at 0xD000-0xDFFF. A DMG only has the first of them.
+#define VRAM_BANKS 2
+#define WRAM_BANKS 8
+#define WRAM_BANK_SIZE 0x1000
+
+// CGB palette RAM, 8 palettes of 4 little endian RGB555 colors for the
+// background and as many for sprites
+#define CGB_PALETTE_SIZE 64
+
+// BG map attributes in VRAM bank 1, and the CGB's sprite flags beyond the
+// DMG's
+#define BG_ATTR_PRIORITY 0x80
+#define BG_ATTR_FLIP_Y 0x40
+#define BG_ATTR_FLIP_X 0x20
+#define BG_ATTR_BANK 0x08
+#define BG_ATTR_PALETTE 0x07
+#define SPRITE_BANK 0x08
+#define SPRITE_CGB_PALETTE 0x07
+
+// Pages tracked for delta snapshots, gb->vram and gb->wram followed by up
+// to 128KB of cartridge RAM
+#define DIRTY_VRAM_PAGES 0x40
+#define DIRTY_MEM_PAGES 0xC0
+#define DIRTY_RAM_PAGES 0x200
+#define DIRTY_PAGES (DIRTY_MEM_PAGES + DIRTY_RAM_PAGES)
+
+// Object Attribute Memory, 40 sprites of 4 bytes (Y, X, tile, flags)
+#define OAM_BASE 0xFE00
+#define OAM_END 0xFEA0
+#define OAM_SPRITES 40
+#define SPRITES_PER_LINE 10
+
+// Sprite flags
+#define SPRITE_BEHIND_BG 0x80
+#define SPRITE_FLIP_Y 0x40
+#define SPRITE_FLIP_X 0x20
+#define SPRITE_PALETTE 0x10
 
 // 0xFF40 - LCD Control Register
 // Bit 7 - LCD Power           (0=Off, 1=On)
@@ -78,24 +207,108 @@
 // Bit 2 - Sprite Size         (0=8×8, 1=8×16)
 // Bit 1 - Sprites Enabled     (0=Disabled, 1=Enabled)
 // Bit 0 - BG Enabled (in DMG) (0=Disabled, 1=Enabled)
-typedef struct RenderContextstruct
+
+struct GBstruct;
+
+#ifdef GB_PROFILE
+// Executions and cycles per opcode and per PC, only built with GB_PROFILE.
+// PCs are addresses, code in switchable ROM banks shares its counters.
+typedef struct ProfileCounterstruct
 {
-    SDL_Window *  window;
-    SDL_Renderer *renderer;
+    uint64_t count;
+    uint64_t cycles;
+} ProfileCounter;
 
-    SDL_Texture *backbufferTexture;
+typedef struct Profilestruct
+{
+    ProfileCounter opcodes[256];
+    ProfileCounter cbOpcodes[256];
+    ProfileCounter pcs[0x10000];
+} Profile;
+#endif
 
-    uint32_t *pixels;
-    int       pitch;
-} RenderContext;
+// One traced instruction, the state before it ran. F is as the program
+// sees it, bytes holds the opcode and operand bytes (zero past its length).
+#define GB_TRACE_IME 0x01
+
+typedef struct TraceEntrystruct
+{
+    uint64_t cycles;
+    uint16_t pc;
+    uint16_t af;
+    uint16_t bc;
+    uint16_t de;
+    uint16_t hl;
+    uint16_t sp;
+    uint8_t  bytes[3];
+    // GB_TRACE_IME while interrupts were enabled
+    uint8_t flags;
+} TraceEntry;
+
+// What stopped a run, see GB_SetBreakpoint
+#define GB_BREAKPOINT 0x1
+#define GB_WATCH_READ 0x2
+#define GB_WATCH_WRITE 0x4
+
+typedef struct DebugHitstruct
+{
+    // GB_BREAKPOINT, GB_WATCH_READ or GB_WATCH_WRITE
+    uint8_t  type;
+    uint16_t addr;
+    // Byte read or written, the opcode for breakpoints
+    uint8_t  val;
+    uint64_t cycles;
+} DebugHit;
+
+// State of a sound channel beyond its registers
+typedef struct APUChannelstruct
+{
+    // Length counter, the channel stops once it runs out
+    uint16_t length;
+    // Playing, NR52 bits 0-3. Never set while the DAC is off.
+    bool enabled;
+    bool dacEnabled;
+    // Volume envelope, unused by the wave channel. A timer of 0 means it
+    // stopped at the end of its range or has no period.
+    uint8_t volume;
+    uint8_t envelopeTimer;
+} APUChannel;
+
+// Cartridge memory bank controller. write handles writes to 0x0000-0x7FFF,
+// readRam/writeRam handle 0xA000-0xBFFF whenever it isn't mapped straight
+// to gb->cartRam (RAM disabled, MBC2's 4 bit RAM, MBC3's clock registers).
+typedef struct MBCstruct
+{
+    const char *name;
+
+    void (*write)(struct GBstruct *gb, uint16_t addr, uint8_t val);
+    uint8_t (*readRam)(struct GBstruct *gb, uint16_t addr);
+    void (*writeRam)(struct GBstruct *gb, uint16_t addr, uint8_t val);
+
+    // Enabled RAM banks can be mapped into the page tables
+    bool    directRam;
+    // Banks selecting RAM, MBC3 selects its RTC registers with the ones above
+    uint8_t ramBanks;
+} MBC;
 
 // CPU Opcode information (Found on Page 65)
 // Memory Info (Found on Page 8)
-// RAM: 8K = uint8_t[0x8000]
+#define VRAM_BASE 0x8000
+#define VRAM_SIZE 0x2000
+#define WRAM_BASE 0xC000
+#define WRAM_SIZE 0x2000
+#define IO_BASE 0xFF00
+#define IO_SIZE 0x80
+#define HRAM_BASE 0xFF80
+#define HRAM_SIZE 0x7F
+
+// The CPU state every instruction touches is kept in the first line of GB,
+// followed by the page tables. CreateGB aligns GB to it.
+#define GB_CACHE_LINE 64
 
 typedef struct GBstruct
 {
-    RenderContext *ctx;
+    //-------------Hot, the first cache line-------------
 
     // Info From http://problemkaputt.de/pandocs.htm#cpuregistersandflags
 
@@ -109,1657 +322,416 @@ typedef struct GBstruct
     // Bit 5 - Half Carry Flag (BCD)
     // Bit 4 - Carry
     // Bit 3->0 - Unused (always zero)
+    // Only valid in regs[REG_AF] while lazyOp is LAZY_NONE
+
+    // Operands of lazyOp: a + b + carry for add and sub, the result and the
+    // fixed H and C bits for logic, the result for inc and dec
+    uint8_t lazyOp;
+    uint8_t lazyA;
+    uint8_t lazyB;
+    uint8_t lazyCarry;
 
     // Interrupt Master Enable flag
     bool IME;
+    // Set by ei, IME is enabled after the next instruction
+    bool imePending;
     bool halted;
 
-    // Main Memory
-    uint8_t mem[0x8000];
+    // Set whenever IE, IF or IME change so interrupts are only checked
+    // when one could actually be dispatched
+    bool irqCheck;
+
+    // Set once an unknown instruction was hit, nothing runs after that
+    bool stopped;
+    // Set when the PPU enters VBlank, cleared by GB_RunFrame (which ends
+    // there) and GB_RunCycles (which doesn't)
+    bool frameDone;
+    // Set when a breakpoint or watchpoint stopped the run, see debugHit
+    bool debugBreak;
+
+    // Currently pressed GB_BUTTON_* bits
+    uint8_t buttons;
+
+    // Immediate operand of the instruction being executed
+    uint16_t operand;
+
+    // Clock cycles executed since the GB was started
+    uint64_t cycles;
+    // Earliest of events, the CPU runs uninterrupted until then
+    uint64_t nextEvent;
+    // Instructions executed since the last reset, idle steps while halted
+    // are not counted
+    uint64_t instructions;
+
+    // Ring of the last traceCapacity instructions, traceNext being the
+    // oldest once traceCount passed it. NULL while tracing is off.
+    TraceEntry *trace;
+
+    // Where each 256 byte page of the address space is read from and
+    // written to, following the current banks. NULL pages go through the
+    // slow path (I/O registers, OAM, VRAM tile data and the cartridge
+    // controller), see MapMemory.
+    uint8_t *readPages[0x100];
+    uint8_t *writePages[0x100];
+
+    //-------------Warm, touched by the hardware as it runs-------------
+
+    // Cycle at which each EVENT_* is due (EVENT_NEVER if unscheduled)
+    uint64_t events[EVENT_COUNT];
+
+    // Cycle at which the internal 16 bit divider was reset, DIV (0xFF04) is
+    // the upper byte of the cycles elapsed since then
+    uint64_t divBase;
+    // Cycle up to which TIMA has been counted
+    uint64_t timerSync;
+
+    uint8_t ppuMode;
+    // Combined STAT interrupt line, the interrupt fires on its rising edge
+    bool statLine;
+
+    // Line of the window that will be drawn next, only advances on lines
+    // where the window is visible
+    uint8_t windowLine;
+
+    // Bits left in the current serial transfer
+    uint8_t serialBits;
+
+    // Square 1, square 2, wave and noise
+    APUChannel apuChannels[APU_CHANNELS];
+    // Channel 1 frequency sweep, working on its own copy of the frequency
+    uint16_t sweepFrequency;
+    uint8_t  sweepTimer;
+    bool     sweepEnabled;
+    // Next step of the frame sequencer, which clocks the length counters,
+    // the sweep and the envelopes, and when it is due. It is only scheduled
+    // as EVENT_APU while it has something to clock.
+    uint8_t  apuStep;
+    uint64_t apuStepCycle;
+
+    // Running as a Game Boy Color, for CGB cartridges unless they are
+    // started by a DMG boot ROM
+    bool cgb;
+    // CGB double speed, switched by STOP after setting KEY1 bit 0
+    bool doubleSpeed;
+
+    // CGB VRAM DMA, the next block's source and destination (relative to
+    // 0x8000) and the blocks left. hdmaActive while an HBlank transfer runs,
+    // one block at the start of every HBlank.
+    uint16_t hdmaSource;
+    uint16_t hdmaDest;
+    uint8_t  hdmaBlocks;
+    bool     hdmaActive;
+
+    // CGB palette RAM, written through BCPD and OCPD
+    uint8_t bgPalettes[CGB_PALETTE_SIZE];
+    uint8_t objPalettes[CGB_PALETTE_SIZE];
+
+    // Banks mapped at 0x0000-0x3FFF, 0x4000-0x7FFF and 0xA000-0xBFFF, set by
+    // the controller before calling MapCart
+    uint16_t romBank0;
+    uint16_t romBank;
+    uint8_t  ramBank;
+    bool     ramEnabled;
+
+    // I/O registers (0xFF00-0xFF7F), high RAM (0xFF80-0xFFFE) and IE
+    // (0xFFFF), all on the slow path
+    uint8_t io[IO_SIZE];
+    uint8_t hram[HRAM_SIZE];
+    uint8_t ie;
+
+    // Object Attribute Memory, 0xFEA0-0xFEFF behind it is unused
+    uint8_t oam[OAM_END - OAM_BASE];
+
+    // Video and work RAM of every bank, 0xE000-0xFDFF echoes 0xC000-0xDDFF
+    uint8_t vram[VRAM_BANKS * VRAM_SIZE];
+    uint8_t wram[WRAM_BANKS * WRAM_BANK_SIZE];
+
+    // Color indices of every tile of both banks, decoded on first use after
+    // a VRAM write sets its dirty flag
+    uint8_t tileCache[VRAM_BANKS * TILE_COUNT][8][8];
+    bool    tileDirty[VRAM_BANKS * TILE_COUNT];
+
+    // OAM indices of the sprites drawn on each line, in drawing order. Only
+    // rebuilt when OAM was written or the sprite height changed since.
+    uint8_t lineSprites[GB_VID_HEIGHT][SPRITES_PER_LINE];
+    uint8_t lineSpriteCounts[GB_VID_HEIGHT];
+    uint8_t lineSpriteHeight;
+    bool    spritesDirty;
+
+    // Shades of the frame being drawn, filled one scanline at a time
+    uint32_t framebuffer[GB_VID_WIDTH * GB_VID_HEIGHT];
+
+    //-------------Cold, only touched on bank switches and by tools---------
+
+    // Read pages as mapped, readPages only differs while reads are watched,
+    // see ApplyReadWatches
+    uint8_t *mappedReadPages[0x100];
+
+    // Write pages as mapped, writePages only differs while writes are
+    // tracked, see ApplyWriteTracking
+    uint8_t *mappedPages[0x100];
+    // Which of dirtyPages each page of the address space belongs to, -1
+    // for pages that aren't stored in them
+    int16_t pageIds[0x100];
+
+    // Pages of vram, wram and cartRam written since the last snapshot
+    bool trackWrites;
+    bool dirtyPages[DIRTY_PAGES];
+
+    // Decoded blocks of straight line code, NULL with the block cache off
+    struct Blockstruct *blocks;
+    // Pages of vram, wram and cartRam that blocks were decoded from. Their
+    // writes take the slow path, where the first one bumps the generation
+    // to drop the blocks.
+    bool     codePages[DIRTY_PAGES];
+    uint32_t codeGenerations[DIRTY_PAGES];
 
     // Cartridge Memory
     uint8_t *cart;
     uint32_t cartSize;
 
+    // External RAM, or MBC2's built in 512x4 bits
+    uint8_t *cartRam;
+    uint32_t cartRamSize;
+    bool     hasBattery;
+
+    // Save file backing battery buffered RAM, NULL without one. cartRam is
+    // then the file mapped into memory, or a copy of it written back whole
+    // where it can't be mapped.
+    char *savePath;
+    bool  saveMapped;
+
+    const MBC *mbc;
+
+    // Raw MBC1 registers, the banks depend on all three
+    uint8_t mbc1Bank1;
+    uint8_t mbc1Bank2;
+    uint8_t mbc1Mode;
+
+    // MBC3 clock, rtcTime seconds at cycle rtcCycle. Reads see the copy
+    // latched by writing 0 then 1 to 0x6000-0x7FFF.
+    uint64_t rtcTime;
+    uint64_t rtcCycle;
+    bool     rtcHalt;
+    bool     rtcCarry;
+    uint8_t  rtcLatched[5];
+    uint8_t  rtcLatch;
+
     // Boot ROM
     uint8_t *bootRom;
     uint32_t bootRomSize;
-} GB;
-
-void DestroyGBRenderContext(RenderContext *ctx)
-{
-    if (ctx != NULL)
-    {
-        printf("Destroying Rendering Context\n");
-        if (ctx->renderer != NULL)
-        {
-            SDL_DestroyRenderer(ctx->renderer);
-            ctx->renderer = NULL;
-            ctx->pixels   = NULL;
-        }
-        if (ctx->window != NULL)
-        {
-            SDL_DestroyWindow(ctx->window);
-            ctx->window = NULL;
-        }
-        if (ctx->pixels != NULL)
-        {
-            free(ctx->pixels);
-            ctx->pixels = NULL;
-        }
-
-        free(ctx);
-        SDL_Quit();
-    }
-}
-
-void DestroyGB(GB *gb)
-{
-    printf("Destroying GB\n");
-    if (gb != NULL)
-    {
-        DestroyGBRenderContext(gb->ctx);
-        gb->ctx = NULL;
-
-        if (gb->cart != NULL)
-        {
-            free(gb->cart);
-        }
-
-        free(gb);
-    }
-}
-
-RenderContext *CreateRenderContext()
-{
-    RenderContext *ctx = malloc(sizeof(RenderContext));
-
-    ctx->window = SDL_CreateWindow(
-        "pc_gb", -1080, SDL_WINDOWPOS_CENTERED, GB_VID_WIDTH * RENDER_SCALE,
-        GB_VID_HEIGHT * RENDER_SCALE, SDL_WINDOW_SHOWN);
-
-    if (ctx->window == NULL)
-    {
-        DestroyGBRenderContext(ctx);
-        return NULL;
-    }
-
-    ctx->renderer =
-        SDL_CreateRenderer(ctx->window, -1, SDL_RENDERER_ACCELERATED);
-    if (ctx->renderer == NULL)
-    {
-        DestroyGBRenderContext(ctx);
-        return NULL;
-    }
-
-    ctx->backbufferTexture = SDL_CreateTexture(
-        ctx->renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING,
-        GB_VID_WIDTH * RENDER_SCALE, GB_VID_HEIGHT * RENDER_SCALE);
-    if (ctx->backbufferTexture == NULL)
-    {
-        DestroyGBRenderContext(ctx);
-        return NULL;
-    }
-
-    ctx->pixels = malloc(sizeof(uint32_t) * GB_VID_WIDTH * GB_VID_HEIGHT *
-                         RENDER_SCALE * RENDER_SCALE);
-    if (ctx->pixels == NULL)
-    {
-        DestroyGBRenderContext(ctx);
-        return NULL;
-    }
-    ctx->pitch = sizeof(uint32_t) * GB_VID_WIDTH * RENDER_SCALE;
-
-    printf("Created Rendering Context\n");
-    return ctx;
-}
-
-GB *CreateGB(const char *rom)
-{
-    RenderContext *ctx = CreateRenderContext();
-    if (ctx == NULL)
-    {
-        printf("Failed to create Rendering Context\n");
-        return NULL;
-    }
-
-    GB *gb  = malloc(sizeof(GB));
-    gb->ctx = ctx;
-
-    return gb;
-}
-
-uint8_t ReadMem(GB *gb, uint16_t addr)
-{
-    if (addr >= 0x8000)
-    {
-        return gb->mem[addr - 0x8000];
-    }
-    else if (addr <= 0xFF && gb->mem[0xFF50 - 0x8000] == 0)
-    {
-        return gb->bootRom[addr % 0x100];
-    }
-    else if (addr >= 0x4000 && addr <= 0x7FFF)
-    {
-        uint8_t bank = gb->mem[0x2000] & 0b11111;
-
-        return gb->cart[(addr + (bank - 1) * 0x4000) % gb->cartSize];
-    }
-    else
-    {
-        return gb->cart[addr];
-    }
-
-    return 0;
-}
-
-void WriteMemRomOnly(GB *gb, uint16_t addr, uint8_t val)
-{
-    if (addr >= 0x8000)
-    {
-        if (addr == 0xFF44)
-        {
-            gb->mem[addr - 0x8000] = 0;
-        }
-        else
-        {
-            gb->mem[addr - 0x8000] = val;
-        }
-    }
-}
-
-void WriteMemMBC1(GB *gb, uint16_t addr, uint8_t val)
-{
-    printf("Not Implemented!\n");
-    assert(false);
-}
-
-void WriteMemMBC1Ram(GB *gb, uint16_t addr, uint8_t val)
-{
-    printf("Not Implemented!\n");
-    assert(false);
-}
 
-void WriteMemMBC1RamBat(GB *gb, uint16_t addr, uint8_t val)
-{
-    printf("Not Implemented!\n");
-    assert(false);
-}
-
-void WriteMemMBC2(GB *gb, uint16_t addr, uint8_t val)
-{
-    printf("Not Implemented!\n");
-    assert(false);
-}
-
-void WriteMemMBC2Bat(GB *gb, uint16_t addr, uint8_t val)
-{
-    printf("Not Implemented!\n");
-    assert(false);
-}
-
-void WriteMem(GB *gb, uint16_t addr, uint8_t val)
-{
-    switch (gb->cart[CART_CART_TYPE])
-    {
-        case CART_TYPE_ROM_ONLY:
-        {
-            WriteMemRomOnly(gb, addr, val);
-        }
-        break;
-
-        case CART_TYPE_MBC1:
-        {
-            WriteMemMBC1(gb, addr, val);
-        }
-        break;
-
-        case CART_TYPE_MBC1_RAM:
-        {
-            WriteMemMBC1Ram(gb, addr, val);
-        }
-        break;
-
-        case CART_TYPE_MBC1_RAM_BATTERY:
-        {
-            WriteMemMBC1RamBat(gb, addr, val);
-        }
-        break;
-
-        case CART_TYPE_MBC2:
-        {
-            WriteMemMBC2(gb, addr, val);
-        }
-        break;
-
-        case CART_TYPE_MBC2_BATTERY:
-        {
-            WriteMemMBC2Bat(gb, addr, val);
-        }
-        break;
-
-        default:
-            return;
-    }
-
-    // if (addr >= 0x8000)
-    // {
-    //     if (addr == 0xFF44)
-    //     {
-    //         gb->mem[addr - 0x8000] = 0;
-    //     }
-    //     else
-    //     {
-    //         gb->mem[addr - 0x8000] = val;
-    //     }
-    // }
-    // else if (addr >= 0x2000 && addr <= 0x3FFF)
-    // {
-    //     if (val == 0)
-    //         val = 1;
-    //     gb->mem[0x2000] = val & 0b11111;
-    // }
-    // else if (addr >= 0x4000 && addr <= 0x5FFF)
-    // {
-    //     gb->mem[0x2000] = (val & 0b11) << 5;
-    // }
-}
-
-uint8_t *LoadRom(const char *filename, uint32_t *romSize)
-{
-    FILE *f = fopen(filename, "rb");
-    if (f == NULL)
-    {
-        return NULL;
-    }
+    // Sound synthesis, NULL unless enabled with GB_SetAudio
+    struct APUSynthstruct *synth;
 
-    fseek(f, 0, SEEK_END);
-    (*romSize) = ftell(f);
-    fseek(f, 0, SEEK_SET);
+    // Bytes sent that haven't been read yet, not part of save states
+    uint8_t  serialOut[SERIAL_OUT_SIZE];
+    uint16_t serialOutLength;
 
-    uint8_t *rom = malloc(sizeof(uint8_t) * (*romSize));
+    uint32_t traceCapacity;
+    uint32_t traceNext;
+    uint64_t traceCount;
 
-    fread(rom, (*romSize), 1, f);
+    // Breakpoints and watchpoints, NULL while none are set. debugHit is
+    // the last one hit.
+    struct Debuggerstruct *debugger;
+    DebugHit               debugHit;
 
-    fclose(f);
-
-    return rom;
-}
-
-void DumpCPURegisters(GB *gb)
-{
-    printf("CPU Registers\n");
-    printf("\tA: 0x%01x\n", gb->regs[REG_AF]);
-    printf("\tBC: 0x%02x\n", gb->regs[REG_BC]);
-    printf("\tDE: 0x%02x\n", gb->regs[REG_DE]);
-    printf("\tHL: 0x%02x\n", gb->regs[REG_HL]);
-    printf("\tSP: 0x%02x\n", gb->regs[REG_SP]);
-    printf("PC: 0x%02x\n", gb->regs[REG_PC]);
-}
-
-void DumpRomInfo(GB *gb)
-{
-    printf("Rom Info\n");
-    printf("\tTitle: %s\n", &gb->cart[CART_TITLE]);
-    printf("\tCart Type: 0x%01X\n", gb->cart[CART_CART_TYPE]);
-    printf("\tROM Size: 0x%01X\n", gb->cart[CART_ROMSIZE]);
-    printf("\tRAM Size: 0x%01X\n", gb->cart[CART_RAMSIZE]);
-}
-
-void SimpleRender(GB *gb, RenderContext *ctx)
-{
-    SDL_LockTexture(ctx->backbufferTexture, NULL, (void **)(&ctx->pixels),
-                    &ctx->pitch);
-
-    // Get Color shades
-    uint32_t colors[4] = {
-        0xFFFFFFFF,
-        0x7E7E7EFF,
-        0x3F3F3FFF,
-        0xFF,
-    };
-
-    uint32_t color0 = colors[(ReadMem(gb, 0xFF47)) & 0b11];
-    uint32_t color1 = colors[(ReadMem(gb, 0xFF47) >> 2) & 0b11];
-    uint32_t color2 = colors[(ReadMem(gb, 0xFF47) >> 4) & 0b11];
-    uint32_t color3 = colors[(ReadMem(gb, 0xFF47) >> 6) & 0b11];
-
-    // Render Each Tile
-    uint8_t lcdControl = ReadMem(gb, 0xFF40);
-
-    uint16_t tileBase = (lcdControl & 0x10) > 0 ? 0x8000 : 0x8800;
-    uint16_t bgBase   = (lcdControl & 0x8) > 0 ? 0x9C00 : 0x9800;
-    for (int i = 0; i < 32; ++i)
-    {
-        for (int j = 0; j < 32; ++j)
-        {
-            // TODO: use LCD register to get tilemap location
-            // Get each row of the tile
-            for (int ty = 0; ty < 8; ++ty)
-            {
-                uint8_t tileIndex = ReadMem(gb, bgBase + i + j * 32);
-
-                uint16_t rowIndex = tileBase + (ty * 2);
-                if (tileBase == 0x8800)
-                {
-                    rowIndex = 0x9000;
-                    if ((tileIndex & 0x80) > 0)
-                    {
-                        rowIndex -= ((~tileIndex) + 1) * 16;
-                    }
-                    else
-                    {
-                        rowIndex += tileIndex * 16;
-                    }
-                }
-                else
-                {
-                    rowIndex += tileIndex * 16;
-                }
-
-                // tileBase + tileIndex + tileY
-                uint8_t row1 = ReadMem(gb, rowIndex);
-                uint8_t row2 = ReadMem(gb, rowIndex + 1);
-
-                for (int tx = 0; tx < 8; ++tx)
-                {
-                    uint8_t color = (row1 >> (7 - tx)) & 1;
-                    color |= ((row2 >> (7 - tx)) & 1) << 1;
-
-                    int px = (i * 8 + tx) * RENDER_SCALE;
-                    int py = (j * 8 + ty) * RENDER_SCALE;
-
-                    if (px >= GB_VID_WIDTH * RENDER_SCALE ||
-                        py >= GB_VID_HEIGHT * RENDER_SCALE)
-                        continue;
-
-                    // 5*3 = 15
-                    // (5*3)*2 = 15*2 = 30
-                    // (5*2) * (3*2) = 10 * 6 = 60
-                    // (5*3)*2*2 = (5*3)*4 = 15 * 4 = 60
-
-                    for (int scalex = 0; scalex < RENDER_SCALE; ++scalex)
-                    {
-                        for (int scaley = 0; scaley < RENDER_SCALE; ++scaley)
-                        {
-                            if (color == 0)
-                            {
-                                ctx->pixels[px + scalex +
-                                            (py + scaley) * GB_VID_WIDTH *
-                                                RENDER_SCALE] = color0;
-                            }
-                            else if (color == 1)
-                            {
-                                ctx->pixels[px + scalex +
-                                            (py + scaley) * GB_VID_WIDTH *
-                                                RENDER_SCALE] = color1;
-                            }
-                            else if (color == 2)
-                            {
-                                ctx->pixels[px + scalex +
-                                            (py + scaley) * GB_VID_WIDTH *
-                                                RENDER_SCALE] = color2;
-                            }
-                            else if (color == 3)
-                            {
-                                ctx->pixels[px + scalex +
-                                            (py + scaley) * GB_VID_WIDTH *
-                                                RENDER_SCALE] = color3;
-                            }
-                        }
-                    }
-                }
-            }
-        }
-    }
-
-    SDL_UnlockTexture(ctx->backbufferTexture);
-
-    SDL_RenderCopy(ctx->renderer, ctx->backbufferTexture, NULL, NULL);
-    SDL_RenderPresent(ctx->renderer);
-}
-
-uint8_t FetchByte(GB *gb)
-{
-    gb->regs[REG_PC] += 1;
-    return ReadMem(gb, gb->regs[REG_PC] - 1);
-}
-
-uint16_t FetchWord(GB *gb)
-{
-    return FetchByte(gb) | (FetchByte(gb) << 8);
-}
-
-void Set8Reg(GB *gb, uint8_t reg, uint8_t val)
-{
-    assert(reg != 6 && reg <= 7);
-
-    size_t   index  = reg == REG_A ? 7 : reg / 2;
-    uint16_t bigVal = val;
-    uint16_t mask   = 0xFF00;
-    if (reg % 2 == 0 || reg == REG_A)
-    {
-        bigVal <<= 8;
-        mask >>= 8;
-    }
-
-    gb->regs[index] &= mask;
-    gb->regs[index] |= bigVal;
-}
-
-uint8_t Get8Reg(GB *gb, uint8_t reg)
-{
-    assert(reg != 6 && reg <= 7);
-
-    size_t   index = reg == REG_A ? 7 : reg / 2;
-    uint16_t val   = gb->regs[index];
-    if ((reg % 2) == 0 || reg == REG_A)
-    {
-        val >>= 8;
-    }
-
-    return val & 0xFF;
-}
-
-char *GetReg8Name(uint8_t reg)
-{
-    switch (reg)
-    {
-        case REG_B:
-            return "B";
-
-        case REG_C:
-            return "C";
-
-        case REG_D:
-            return "D";
-
-        case REG_E:
-            return "E";
-
-        case REG_H:
-            return "H";
-
-        case REG_L:
-            return "L";
-
-        case REG_A:
-            return "A";
-        default:
-            assert(false);
-    }
-}
-
-char *GetRegName(uint8_t reg)
-{
-    switch (reg)
-    {
-        case REG_BC:
-            return "BC";
-
-        case REG_DE:
-            return "DE";
-
-        case REG_HL:
-            return "HL";
-
-        case REG_SP:
-            return "SP";
-
-        case REG_AF:
-            return "A(F)";
-
-        default:
-            assert(false);
-    }
-}
-
-char *GetFlagName(uint8_t flag)
-{
-    switch (flag)
-    {
-        case FLAG_NZ:
-            return "NZ";
-
-        case FLAG_Z:
-            return "Z";
-
-        case FLAG_NC:
-            return "NC";
-
-        case FLAG_C:
-            return "C";
-
-        default:
-            assert(false);
-    }
-}
-
-void SetFlag(GB *gb, uint8_t flag, uint8_t val)
-{
-    uint8_t mask = 1;
-
-    switch (flag)
-    {
-        case FLAG_Z:
-        {
-            mask <<= 7;
-        }
-        break;
-
-        case FLAG_C:
-        {
-            mask <<= 4;
-        }
-        break;
-
-        case FLAG_N:
-        {
-            mask <<= 6;
-        }
-        break;
-
-        case FLAG_H:
-        {
-            mask <<= 5;
-        }
-        break;
-
-        default:
-            assert(false);
-            return;
-    }
-
-    if (val > 0)
-    {
-        gb->regs[REG_AF] |= mask;
-    }
-    else
-    {
-        gb->regs[REG_AF] &= ~mask;
-    }
-}
-
-bool CheckFlag(GB *gb, uint8_t flag)
-{
-    switch (flag)
-    {
-        case FLAG_NZ:
-        {
-            return (gb->regs[REG_AF] & 0x80) == 0;
-        }
-        break;
-
-        case FLAG_Z:
-        {
-            return (gb->regs[REG_AF] & 0x80) > 0;
-        }
-        break;
-
-        case FLAG_NC:
-        {
-            return (gb->regs[REG_AF] & 0x8) == 0;
-        }
-        break;
-
-        case FLAG_C:
-        {
-            return (gb->regs[REG_AF] & 0x8) >= 0;
-        }
-        break;
-
-        default:
-            printf("Checking flag that doesn't not exist. This should not have "
-                   "been called!\n");
-            assert(false);
-    }
-}
-
-bool CheckInterrupt(GB *gb, uint8_t mask)
-{
-    uint8_t ienable = ReadMem(gb, 0xFFFF);
-    uint8_t iflag   = ReadMem(gb, 0xFF0F);
-
-    if (gb->IME && (ienable & mask) > 0 && (iflag & mask) > 0)
-    {
-        WriteMem(gb, 0xFF0F, iflag & ~mask);
-
-        return true;
-    }
-
-    return false;
-}
-
-void Push16(GB *gb, uint16_t val)
-{
-    gb->regs[REG_SP] -= 2;
-    WriteMem(gb, gb->regs[REG_SP] + 1, (val & 0xFF00) >> 8);
-    WriteMem(gb, gb->regs[REG_SP] + 2, val & 0xFF);
-}
-
-void CallInterrupt(GB *gb, uint8_t vector)
-{
-    Push16(gb, gb->regs[REG_PC]);
-    gb->regs[REG_PC] = vector;
-
-    gb->halted = false;
-}
-
-uint16_t Pop16(GB *gb)
-{
-    gb->regs[REG_SP] += 2;
-    uint16_t val = ReadMem(gb, gb->regs[REG_SP]);
-    val |= ReadMem(gb, gb->regs[REG_SP] - 1) << 8;
-
-    return val;
-}
-
-bool DoCBInstruction(GB *gb, uint16_t instrPC)
-{
-    uint8_t opcode = FetchByte(gb);
-
-    if (false)
-    {
-    }
-
-    instr_right_r(opcode, 0x10, "rl r")
-    {
-        uint8_t reg = opcode & 0b111;
-        uint8_t val = Get8Reg(gb, reg);
-
-        val <<= 1;
-        val |= (gb->regs[REG_AF] & 0x8) >> 4;
-
-        SetFlag(gb, FLAG_Z, val == 0);
-        SetFlag(gb, FLAG_C, Get8Reg(gb, reg) >> 7);
-
-        Set8Reg(gb, reg, val);
-    }
-
-    instr_right_r(opcode, 0x18, "rr r")
-    {
-        uint8_t reg = opcode & 0b111;
-        uint8_t val = Get8Reg(gb, reg);
-
-        val >>= 1;
-        val |= (gb->regs[REG_AF] & 0x8) << 3;
-
-        SetFlag(gb, FLAG_Z, val == 0);
-        SetFlag(gb, FLAG_C, Get8Reg(gb, reg) & 1);
-
-        Set8Reg(gb, reg, val);
-    }
-
-    instr(opcode, 0x1E, "rr (hl)")
-    {
-        uint8_t val = ReadMem(gb, gb->regs[REG_HL]);
-
-        val >>= 1;
-        val |= (gb->regs[REG_AF] & 0x8) << 3;
-
-        SetFlag(gb, FLAG_Z, val == 0);
-        SetFlag(gb, FLAG_C, ReadMem(gb, gb->regs[REG_HL]) & 1);
-
-        WriteMem(gb, gb->regs[REG_HL], val);
-    }
-
-    instr_right_r(opcode, 0x20, "sla r")
-    {
-        uint8_t reg = opcode & 0b111;
-        uint8_t val = Get8Reg(gb, reg);
-
-        val <<= 1;
-
-        Set8Reg(gb, reg, val);
-    }
-
-    instr_right_r(opcode, 0x30, "swap r")
-    {
-        uint8_t reg = opcode & 0b111;
-        uint8_t val = Get8Reg(gb, reg);
-        uint8_t lo  = val & 0xF;
-
-        val = (val >> 4) | (lo << 4);
-
-        Set8Reg(gb, reg, val);
-    }
-
-    instr_right_r(opcode, 0x38, "srl r")
-    {
-        uint8_t reg = opcode & 0b111;
-        uint8_t val = Get8Reg(gb, reg);
-
-        val >>= 1;
-
-        Set8Reg(gb, reg, val);
-    }
-
-    instr_bit(opcode, "bit n,r")
-    {
-        uint8_t bit = opcode >> 4;
-        uint8_t reg = Get8Reg(gb, opcode & 0b111);
-
-        SetFlag(gb, FLAG_Z, (reg & (1 << bit)) == 0);
-        SetFlag(gb, FLAG_N, 0);
-        SetFlag(gb, FLAG_H, 1);
-    }
-
-    instr_res_bit(opcode, "res n,r")
-    {
-        uint8_t bit = opcode >> 4;
-        uint8_t reg = Get8Reg(gb, opcode & 0b111);
-
-        Set8Reg(gb, opcode & 0b111, (reg & ~(1 << bit)));
-    }
-
-    instr_invalid()
-    {
-        DumpCPURegisters(gb);
-        printf("PC: $%02X: Unknown CB-prefixed instruction: 0x%01X\n", instrPC,
-               opcode);
-        return false;
-    }
-
-    return true;
-}
+#ifdef GB_PROFILE
+    // Accumulated over the lifetime of the GB, resets don't clear it
+    Profile *profile;
+#endif
+} GB;
 
-bool DoInstruction(GB *gb)
-{
-    const uint16_t instrPC = gb->regs[REG_PC];
-    uint8_t        opcode  = FetchByte(gb);
-
-    if (opcode == 0xCB)
-    {
-        return DoCBInstruction(gb, instrPC);
-    }
-
-    if (opcode == 0x00)
-    {
-    }
-
-    //-------------8 bit Load Commands-------------
-    instr(opcode, 0x08, "ld (nn), sp")
-    {
-        uint8_t addr = FetchWord(gb);
-
-        WriteMem(gb, addr, gb->regs[REG_SP] >> 8);
-        WriteMem(gb, addr + 1, gb->regs[REG_SP] & 0xFF);
-    }
-
-    instr_ld_r_r(opcode, 0x40, 3, "ld r,r")
-    {
-        uint8_t regDst = (opcode >> 3) & 0b111;
-        uint8_t regSrc = opcode & 0b111;
-
-        Set8Reg(gb, regDst, Get8Reg(gb, regSrc));
-    }
-
-    instr_left_r(opcode, 0x6, 3, "ld r,n")
-    {
-        uint8_t regDst = (opcode >> 3) & 0b111;
-        uint8_t val    = FetchByte(gb);
-
-        Set8Reg(gb, regDst, val);
-    }
-
-    instr(opcode, 0x12, "ld (de),a")
-    {
-        WriteMem(gb, gb->regs[REG_DE], Get8Reg(gb, REG_A));
-    }
-
-    instr(opcode, 0xF0, "ld a,($FF00+n)")
-    {
-        uint8_t offset = FetchByte(gb);
-        Set8Reg(gb, REG_A, ReadMem(gb, 0xFF00 + offset));
-    }
-
-    instr(opcode, 0xE0, "ld ($FF00+n), a")
-    {
-        uint8_t offset = FetchByte(gb);
-        WriteMem(gb, 0xFF00 + offset, Get8Reg(gb, REG_A));
-    }
-
-    instr(opcode, 0xE2, "ld ($FF00+c), a")
-    {
-        uint8_t offset = Get8Reg(gb, REG_C);
-        WriteMem(gb, 0xFF00 + offset, Get8Reg(gb, REG_A));
-    }
-
-    instr(opcode, 0x2A, "ldi a,(hl)")
-    {
-        uint8_t val = ReadMem(gb, gb->regs[REG_HL]);
-
-        Set8Reg(gb, REG_A, val);
-
-        gb->regs[REG_HL] += 1;
-    }
-
-    instr(opcode, 0x22, "ldi a,(hl)")
-    {
-        uint8_t val = Get8Reg(gb, REG_A);
-        WriteMem(gb, gb->regs[REG_HL], val);
-
-        gb->regs[REG_HL] += 1;
-    }
-
-    instr(opcode, 0x32, "ldd a,(hl)")
-    {
-        uint8_t val = Get8Reg(gb, REG_A);
-        WriteMem(gb, gb->regs[REG_HL], val);
-
-        gb->regs[REG_HL] -= 1;
-    }
-
-    instr_left_r(opcode, 0x46, 3, "ld a,(hl)")
-    {
-        uint8_t reg = (opcode >> 3) & 0b111;
-        uint8_t val = ReadMem(gb, gb->regs[REG_HL]);
-
-        Set8Reg(gb, reg, val);
-    }
-
-    instr_right_r(opcode, 0x70, "ld (hl),r")
-    {
-        uint8_t reg = opcode & 0b111;
-        uint8_t val = Get8Reg(gb, reg);
-        WriteMem(gb, gb->regs[REG_HL], val);
-    }
-
-    instr(opcode, 0x36, "ld (hl),n")
-    {
-        uint8_t val = FetchByte(gb);
-        WriteMem(gb, gb->regs[REG_HL], val);
-    }
-
-    instr(opcode, 0x0A, "ld a,(bc)")
-    {
-        uint8_t val = ReadMem(gb, gb->regs[REG_BC]);
-
-        Set8Reg(gb, REG_A, val);
-    }
-
-    instr(opcode, 0x1A, "ld a,(de)")
-    {
-        uint8_t val = ReadMem(gb, gb->regs[REG_DE]);
-
-        Set8Reg(gb, REG_A, val);
-    }
-
-    instr(opcode, 0xFA, "ld a,(nn)")
-    {
-        uint8_t addr = FetchWord(gb);
-        uint8_t val  = ReadMem(gb, addr);
-
-        Set8Reg(gb, REG_A, val);
-    }
-
-    instr(opcode, 0x02, "ld (bc),a")
-    {
-        uint8_t val = Get8Reg(gb, REG_A);
-        WriteMem(gb, gb->regs[REG_BC], val);
-    }
-
-    instr(opcode, 0xEA, "ld (nn),a")
-    {
-        uint16_t addr = FetchWord(gb);
-
-        WriteMem(gb, addr, Get8Reg(gb, REG_A));
-    }
-
-    //-------------8 bit Arthimetic/Logical Commands-------------
-    instr_right_r(opcode, 0x80, "add a,r")
-    {
-        uint8_t reg = opcode & 0b111;
-        uint8_t val = Get8Reg(gb, REG_A) + Get8Reg(gb, reg);
-
-        SetFlag(gb, FLAG_Z, val == 0);
-        SetFlag(gb, FLAG_C, val < Get8Reg(gb, REG_A));
-        SetFlag(gb, FLAG_N, 0);
-        SetFlag(gb, FLAG_H, (val & 0xF) < (Get8Reg(gb, REG_A) & 0xF));
-
-        Set8Reg(gb, REG_A, val);
-    }
-
-    instr(opcode, 0xC6, "add a,n")
-    {
-        uint8_t val    = FetchByte(gb);
-        uint8_t newVal = Get8Reg(gb, REG_A) + val;
-
-        SetFlag(gb, FLAG_Z, newVal == 0);
-        SetFlag(gb, FLAG_C, newVal < Get8Reg(gb, REG_A));
-        SetFlag(gb, FLAG_N, 0);
-        SetFlag(gb, FLAG_H, (newVal & 0xF) < (Get8Reg(gb, REG_A) & 0xF));
-
-        Set8Reg(gb, REG_A, newVal);
-    }
-
-    instr_right_r(opcode, 0x88, "adc a,r")
-    {
-        uint8_t reg = opcode & 0b111;
-        uint8_t val = Get8Reg(gb, REG_A) + Get8Reg(gb, reg) +
-                      (gb->regs[REG_AF] & 0x8 >> 3);
-
-        SetFlag(gb, FLAG_Z, val == 0);
-        SetFlag(gb, FLAG_C, val < Get8Reg(gb, REG_A));
-        SetFlag(gb, FLAG_N, 0);
-        SetFlag(gb, FLAG_H, (val & 0xF) < (Get8Reg(gb, REG_A) & 0xF));
-
-        Set8Reg(gb, REG_A, val);
-    }
-
-    instr(opcode, 0x86, "add a,(hl)")
-    {
-        uint8_t val    = ReadMem(gb, gb->regs[REG_HL]);
-        uint8_t newVal = Get8Reg(gb, REG_A) + val;
-
-        SetFlag(gb, FLAG_Z, newVal == 0);
-        SetFlag(gb, FLAG_C, newVal < Get8Reg(gb, REG_A));
-        SetFlag(gb, FLAG_N, 0);
-        SetFlag(gb, FLAG_H, (newVal & 0xF) < (Get8Reg(gb, REG_A) & 0xF));
-
-        Set8Reg(gb, REG_A, newVal);
-    }
-
-    instr(opcode, 0x8E, "adc a,(hl)")
-    {
-        uint8_t val = ReadMem(gb, gb->regs[REG_HL]);
-        uint8_t newVal =
-            Get8Reg(gb, REG_A) + val + (gb->regs[REG_AF] & 0x8 >> 3);
-
-        SetFlag(gb, FLAG_Z, newVal == 0);
-        SetFlag(gb, FLAG_C, newVal < Get8Reg(gb, REG_A));
-        SetFlag(gb, FLAG_N, 0);
-        SetFlag(gb, FLAG_H, (newVal & 0xF) < (Get8Reg(gb, REG_A) & 0xF));
-
-        Set8Reg(gb, REG_A, newVal);
-    }
-
-    instr_right_r(opcode, 0x90, "sub a,r")
-    {
-        uint8_t reg = opcode & 0b111;
-        uint8_t val = Get8Reg(gb, REG_A) - Get8Reg(gb, reg);
-
-        SetFlag(gb, FLAG_Z, val == 0);
-        SetFlag(gb, FLAG_C, val > Get8Reg(gb, REG_A));
-        SetFlag(gb, FLAG_N, 1);
-        SetFlag(gb, FLAG_H, (val & 0xF) > (Get8Reg(gb, REG_A) & 0xF));
-
-        Set8Reg(gb, REG_A, val);
-    }
-
-    instr(opcode, 0xD6, "sub a,n")
-    {
-        uint8_t val    = FetchByte(gb);
-        uint8_t newVal = Get8Reg(gb, REG_A) - val;
-
-        SetFlag(gb, FLAG_Z, newVal == 0);
-        SetFlag(gb, FLAG_C, newVal > Get8Reg(gb, REG_A));
-        SetFlag(gb, FLAG_N, 1);
-        SetFlag(gb, FLAG_H, (newVal & 0xF) > (Get8Reg(gb, REG_A) & 0xF));
-
-        Set8Reg(gb, REG_A, newVal);
-    }
-
-    instr_right_r(opcode, 0x98, "sbc a,r")
-    {
-        uint8_t reg = opcode & 0b111;
-        uint8_t val = Get8Reg(gb, REG_A) - Get8Reg(gb, reg) -
-                      (gb->regs[REG_AF] & 0x8 >> 3);
-
-        SetFlag(gb, FLAG_Z, val == 0);
-        SetFlag(gb, FLAG_C, val > Get8Reg(gb, REG_A));
-        SetFlag(gb, FLAG_N, 1);
-        SetFlag(gb, FLAG_H, (val & 0xF) > (Get8Reg(gb, REG_A) & 0xF));
-
-        Set8Reg(gb, REG_A, val);
-    }
-
-    instr(opcode, 0x9E, "sbc a,(hl)")
-    {
-        uint8_t reg = opcode & 0b111;
-        uint8_t val = Get8Reg(gb, REG_A) - ReadMem(gb, gb->regs[REG_HL]) -
-                      (gb->regs[REG_AF] & 0x8 >> 3);
-
-        SetFlag(gb, FLAG_Z, val == 0);
-        SetFlag(gb, FLAG_C, val > Get8Reg(gb, REG_A));
-        SetFlag(gb, FLAG_N, 1);
-        SetFlag(gb, FLAG_H, (val & 0xF) > (Get8Reg(gb, REG_A) & 0xF));
-
-        Set8Reg(gb, REG_A, val);
-    }
-
-    instr_right_r(opcode, 0xA0, "and a,r")
-    {
-        uint8_t reg = opcode & 0b111;
-        uint8_t val = Get8Reg(gb, REG_A) & Get8Reg(gb, reg);
-        Set8Reg(gb, REG_A, val);
-
-        SetFlag(gb, FLAG_Z, val == 0);
-        SetFlag(gb, FLAG_C, 0);
-        SetFlag(gb, FLAG_N, 0);
-        SetFlag(gb, FLAG_H, 1);
-    }
-
-    instr(opcode, 0xE6, "and a,n")
-    {
-        uint8_t val    = FetchByte(gb);
-        uint8_t newVal = Get8Reg(gb, REG_A) & val;
-        Set8Reg(gb, REG_A, newVal);
-
-        SetFlag(gb, FLAG_Z, newVal == 0);
-        SetFlag(gb, FLAG_C, 0);
-        SetFlag(gb, FLAG_N, 0);
-        SetFlag(gb, FLAG_H, 1);
-    }
-
-    instr(opcode, 0xF6, "or a,n")
-    {
-        uint8_t val    = FetchByte(gb);
-        uint8_t newVal = Get8Reg(gb, REG_A) | val;
-        Set8Reg(gb, REG_A, newVal);
-
-        SetFlag(gb, FLAG_Z, newVal == 0);
-        SetFlag(gb, FLAG_C, 0);
-        SetFlag(gb, FLAG_N, 0);
-        SetFlag(gb, FLAG_H, 0);
-    }
-
-    instr(opcode, 0xB6, "or a,(hl)")
-    {
-        uint8_t newVal = Get8Reg(gb, REG_A) | ReadMem(gb, gb->regs[REG_HL]);
-        Set8Reg(gb, REG_A, newVal);
-
-        SetFlag(gb, FLAG_Z, newVal == 0);
-        SetFlag(gb, FLAG_C, 0);
-        SetFlag(gb, FLAG_N, 0);
-        SetFlag(gb, FLAG_H, 0);
-    }
-
-    instr_right_r(opcode, 0xA8, "xor a,r")
-    {
-        uint8_t reg = opcode & 0b111;
-        uint8_t val = Get8Reg(gb, REG_A) ^ Get8Reg(gb, reg);
-
-        SetFlag(gb, FLAG_Z, val == 0);
-        SetFlag(gb, FLAG_C, 0);
-        SetFlag(gb, FLAG_N, 0);
-        SetFlag(gb, FLAG_H, 0);
-    }
-
-    instr(opcode, 0xAE, "xor a,(hl)")
-    {
-        uint8_t val = Get8Reg(gb, REG_A) ^ ReadMem(gb, gb->regs[REG_HL]);
-
-        SetFlag(gb, FLAG_Z, val == 0);
-        SetFlag(gb, FLAG_C, 0);
-        SetFlag(gb, FLAG_N, 0);
-        SetFlag(gb, FLAG_H, 0);
-    }
-
-    instr_right_r(opcode, 0xB0, "or a,r")
-    {
-        uint8_t reg = opcode & 0b111;
-        uint8_t val = Get8Reg(gb, REG_A) | Get8Reg(gb, reg);
-        Set8Reg(gb, REG_A, val);
-
-        SetFlag(gb, FLAG_Z, val == 0);
-        SetFlag(gb, FLAG_C, 0);
-        SetFlag(gb, FLAG_N, 0);
-        SetFlag(gb, FLAG_H, 0);
-    }
-
-    instr_right_r(opcode, 0xB8, "cp a,r")
-    {
-        uint8_t reg = opcode & 0b111;
-        uint8_t val = Get8Reg(gb, REG_A) - Get8Reg(gb, reg);
-
-        SetFlag(gb, FLAG_Z, val == 0);
-        SetFlag(gb, FLAG_C, val > Get8Reg(gb, REG_A));
-        SetFlag(gb, FLAG_N, 1);
-        SetFlag(gb, FLAG_H, (val & 0xF) > (Get8Reg(gb, REG_A) & 0xF));
-    }
-
-    instr(opcode, 0xFE, "cp a,n")
-    {
-        uint8_t val    = FetchByte(gb);
-        uint8_t newVal = Get8Reg(gb, REG_A) - val;
-
-        SetFlag(gb, FLAG_Z, newVal == 0);
-        SetFlag(gb, FLAG_C, newVal > Get8Reg(gb, REG_A));
-        SetFlag(gb, FLAG_N, 1);
-        SetFlag(gb, FLAG_H, (newVal & 0xF) > (Get8Reg(gb, REG_A) & 0xF));
-    }
-
-    instr(opcode, 0xBE, "cp a,(hl)")
-    {
-        uint8_t val    = ReadMem(gb, gb->regs[REG_HL]);
-        uint8_t newVal = Get8Reg(gb, REG_A) - val;
-
-        SetFlag(gb, FLAG_Z, newVal == 0);
-        SetFlag(gb, FLAG_C, newVal > Get8Reg(gb, REG_A));
-        SetFlag(gb, FLAG_N, 1);
-        SetFlag(gb, FLAG_H, (newVal & 0xF) > (Get8Reg(gb, REG_A) & 0xF));
-    }
-
-    instr_left_r(opcode, 0x4, 3, "inc r")
-    {
-        uint8_t reg = (opcode >> 3) & 0b111;
-        uint8_t val = Get8Reg(gb, reg) + 1;
-
-        SetFlag(gb, FLAG_Z, val == 0);
-        SetFlag(gb, FLAG_N, 0);
-        SetFlag(gb, FLAG_H, (val & 0xF) < (Get8Reg(gb, reg) & 0xF));
-
-        Set8Reg(gb, reg, val);
-    }
-
-    instr(opcode, 0x34, "inc (hl)")
-    {
-        uint8_t data = ReadMem(gb, gb->regs[REG_HL]);
-        uint8_t val  = data + 1;
-
-        SetFlag(gb, FLAG_Z, val == 0);
-        SetFlag(gb, FLAG_N, 0);
-        SetFlag(gb, FLAG_H, (val & 0xF) < (data & 0xF));
-
-        WriteMem(gb, gb->regs[REG_HL], val);
-    }
-
-    instr_left_r(opcode, 0x5, 3, "dec r")
-    {
-        uint8_t reg = (opcode >> 3) & 0b111;
-        uint8_t val = Get8Reg(gb, reg) - 1;
-
-        SetFlag(gb, FLAG_Z, val == 0);
-        SetFlag(gb, FLAG_N, 1);
-        SetFlag(gb, FLAG_H, (val & 0xF) > (Get8Reg(gb, reg) & 0xF));
-
-        Set8Reg(gb, reg, val);
-    }
-
-    instr(opcode, 0x35, "dec (hl)")
-    {
-        uint8_t data = ReadMem(gb, gb->regs[REG_HL]);
-        uint8_t val  = data - 1;
-
-        SetFlag(gb, FLAG_Z, val == 0);
-        SetFlag(gb, FLAG_N, 1);
-        SetFlag(gb, FLAG_H, (val & 0xF) > (data & 0xF));
-
-        WriteMem(gb, gb->regs[REG_HL], val);
-    }
-
-    instr(opcode, 0x27, "daa")
-    {
-        uint8_t val = Get8Reg(gb, REG_A);
-
-        if ((val & 0xF) > 9 || (gb->regs[REG_AF] & 0x20) > 0)
-        {
-            if ((gb->regs[REG_AF] & 0x10) > 0)
-            {
-                val -= 6;
-            }
-            else
-            {
-                val += 6;
-            }
-
-            SetFlag(gb, FLAG_C, 0);
-        }
-
-        if ((val & 0xF0) > 9 || (gb->regs[REG_AF] & 0x20) > 0)
-        {
-            if ((gb->regs[REG_AF] & 0x4) > 0)
-            {
-                val -= 0x60;
-            }
-            else
-            {
-                val += 0x60;
-            }
-
-            SetFlag(gb, FLAG_C, 1);
-        }
-
-        SetFlag(gb, FLAG_Z, val == 0);
-        SetFlag(gb, FLAG_H, 0);
-
-        Set8Reg(gb, REG_A, val);
-    }
-
-    instr(opcode, 0x2F, "cpl")
-    {
-        uint8_t val = Get8Reg(gb, REG_A) ^ 0xFF;
-        Set8Reg(gb, REG_A, val);
-
-        SetFlag(gb, FLAG_N, 1);
-        SetFlag(gb, FLAG_H, 1);
-    }
-
-    //-------------16 bit Load/Arithmetic/Logical Commands-------------
-    instr_left_r(opcode, 0x01, 4, "ld rr, nn")
-    {
-        uint8_t  reg = (opcode & 0xF0) >> 4;
-        uint16_t val = FetchWord(gb);
-
-        gb->regs[reg] = val;
-    }
-
-    instr_left_r(opcode, 0xC5, 4, "push rr")
-    {
-        uint8_t reg = (opcode >> 4) & 0b11;
-        Push16(gb, gb->regs[reg]);
-    }
-
-    instr_left_r(opcode, 0xC1, 4, "pop rr")
-    {
-        uint8_t reg   = (opcode >> 4) & 0b11;
-        gb->regs[reg] = Pop16(gb);
-    }
-
-    instr_left_r(opcode, 0x09, 4, "add hl, rr")
-    {
-        uint8_t reg    = (opcode >> 4) & 0b11;
-        uint8_t newVal = gb->regs[REG_HL] + gb->regs[reg];
-
-        SetFlag(gb, FLAG_C, newVal < gb->regs[REG_HL]);
-        SetFlag(gb, FLAG_N, 0);
-        SetFlag(gb, FLAG_H, (newVal & 0xF) < (gb->regs[REG_HL] & 0xF));
-
-        gb->regs[REG_HL] = newVal;
-    }
-
-    instr_left_r(opcode, 0x03, 4, "inc rr")
-    {
-        uint8_t reg = (opcode >> 4) & 0b11;
-
-        gb->regs[reg] += 1;
-    }
-
-    instr_left_r(opcode, 0x0B, 4, "dec rr")
-    {
-        uint8_t reg = (opcode >> 4) & 0b11;
-
-        gb->regs[reg] -= 1;
-    }
-
-    instr(opcode, 0xE8, "add sp, dd")
-    {
-        uint8_t val    = FetchByte(gb);
-        uint8_t newVal = gb->regs[REG_SP];
-
-        if ((val & 0x80) > 0)
-        {
-            val = ~val;
-            val += 1;
-
-            newVal -= val;
-            SetFlag(gb, FLAG_H, (newVal & 0xF) > (gb->regs[REG_SP] & 0xF));
-        }
-        else
-        {
-            newVal += val;
-            SetFlag(gb, FLAG_H, (newVal & 0xF) < (gb->regs[REG_SP] & 0xF));
-        }
-
-        SetFlag(gb, FLAG_Z, 0);
-        SetFlag(gb, FLAG_C, ((newVal ^ gb->regs[REG_SP]) & 0x80) > 0);
-        SetFlag(gb, FLAG_N, 0);
-
-        gb->regs[REG_SP] = newVal;
-    }
-
-    //-------------Rotate/Shift Commands-------------
-    instr(opcode, 0x07, "rlca")
-    {
-        uint8_t val = Get8Reg(gb, REG_A);
-
-        uint8_t tmp = val >> 7;
-        val <<= 1;
-        val |= tmp;
-
-        SetFlag(gb, FLAG_Z, 0);
-        SetFlag(gb, FLAG_C, (Get8Reg(gb, REG_A) & 0x80) > 0);
-        SetFlag(gb, FLAG_N, 0);
-        SetFlag(gb, FLAG_H, 0);
-
-        Set8Reg(gb, REG_A, val);
-    }
-
-    instr(opcode, 0x17, "rla")
-    {
-        uint8_t val = Get8Reg(gb, REG_A);
-
-        val <<= 1;
-        val |= gb->regs[REG_AF] & 0x8;
-
-        SetFlag(gb, FLAG_Z, 0);
-        SetFlag(gb, FLAG_C, Get8Reg(gb, REG_A) >> 7);
-        SetFlag(gb, FLAG_N, 0);
-        SetFlag(gb, FLAG_H, 0);
-
-        Set8Reg(gb, REG_A, val);
-    }
-
-    instr(opcode, 0x1F, "rra")
-    {
-        uint8_t val = Get8Reg(gb, REG_A);
-
-        val >>= 1;
-        val |= (gb->regs[REG_AF] & 0x8) << 3;
-
-        SetFlag(gb, FLAG_Z, 0);
-        SetFlag(gb, FLAG_C, Get8Reg(gb, REG_A) & 1);
-        SetFlag(gb, FLAG_N, 0);
-        SetFlag(gb, FLAG_H, 0);
-
-        Set8Reg(gb, REG_A, val);
-    }
-
-    //-------------CPU Control Commands-------------
-    instr(opcode, 0x3F, "ccf")
-    {
-        SetFlag(gb, FLAG_C, 0);
-    }
-
-    instr(opcode, 0x37, "scf")
-    {
-        SetFlag(gb, FLAG_C, 1);
-    }
-
-    instr(opcode, 0x76, "halt")
-    {
-        gb->halted = true;
-    }
-
-    instr(opcode, 0x10, "stop")
-    {
-        // TODO: actualy stop instead of nop'ing
-        FetchByte(gb);
-    }
-
-    instr(opcode, 0xF3, "di")
-    {
-        gb->IME = false;
-    }
-
-    instr(opcode, 0xFB, "ei")
-    {
-        gb->IME = true;
-    }
-
-    //-------------Jump Commands-------------
-    instr(opcode, 0xC3, "jp nn")
-    {
-        uint16_t addr = FetchWord(gb);
-
-        gb->regs[REG_PC] = addr + 1;
-    }
-
-    instr(opcode, 0xE9, "jp hl")
-    {
-        uint16_t addr = gb->regs[REG_HL];
-
-        gb->regs[REG_PC] = addr;
-    }
-
-    instr_left_f(opcode, 0xC2, 3, "jp f,nn")
-    {
-        uint8_t addr = FetchWord(gb);
-        uint8_t flag = (opcode >> 3) & 0b11;
-
-        if (CheckFlag(gb, flag))
-        {
-            gb->regs[REG_PC] = addr;
-        }
-        else
-        {
-            // printf("didn't jump\n");
-        }
-    }
-
-    instr_left_f(opcode, 0x20, 3, "jp f,dd")
-    {
-        uint8_t offset = FetchByte(gb);
-        uint8_t flag   = (opcode >> 3) & 0b11;
-
-        if (CheckFlag(gb, flag))
-        {
-            if ((offset & 0x80) > 0)
-            {
-                offset = ~offset;
-                offset += 1;
-
-                gb->regs[REG_PC] -= offset;
-            }
-            else
-            {
-                gb->regs[REG_PC] += offset;
-            }
-        }
-        else
-        {
-            // printf("didn't jump\n");
-        }
-    }
-
-    instr(opcode, 0x18, "jr dd")
-    {
-        uint8_t offset = FetchByte(gb);
-
-        if ((offset & 0x80) > 0)
-        {
-            offset = ~offset;
-            offset += 1;
-
-            gb->regs[REG_PC] -= offset;
-        }
-        else
-        {
-            gb->regs[REG_PC] += offset;
-        }
-    }
-
-    instr(opcode, 0xCD, "call nn")
-    {
-        uint16_t addr = FetchWord(gb);
-        Push16(gb, gb->regs[REG_PC]);
-
-        gb->regs[REG_PC] = addr;
-    }
-
-    instr_left_r(opcode, 0xC4, 3, "call f,nn")
-    {
-        uint8_t  flag = opcode >> 3 & 0b111;
-        uint16_t addr = FetchWord(gb);
-
-        if (CheckFlag(gb, flag))
-        {
-            gb->regs[REG_SP] -= 2;
-            WriteMem(gb, gb->regs[REG_SP], gb->regs[REG_PC]);
-
-            gb->regs[REG_PC] = addr;
-        }
-    }
-
-    instr(opcode, 0xC9, "ret")
-    {
-        gb->regs[REG_PC] = Pop16(gb);
-    }
-
-    instr_left_r(opcode, 0xC0, 3, "ret f,nn")
-    {
-        uint8_t flag = opcode >> 3 & 0b111;
-
-        if (CheckFlag(gb, flag))
-        {
-            gb->regs[REG_PC] = Pop16(gb);
-        }
-    }
-
-    instr(opcode, 0xD9, "reti")
-    {
-        gb->regs[REG_PC] = Pop16(gb);
-        gb->IME          = true;
-    }
-
-    instr_rst(opcode, "rst n")
-    {
-        uint8_t val = (FetchByte(gb) >> 3) & 0b111;
-        Push16(gb, gb->regs[REG_PC]);
-
-        gb->regs[REG_PC] = val;
-    }
-
-    instr_invalid()
-    {
-        DumpCPURegisters(gb);
-        printf("PC: $%02X: Unknown instruction: 0x%01X\n", instrPC, opcode);
-        return false;
-    }
-    return true;
-}
-
-void StartGB(GB *gb, const char *rom)
-{
-    if (gb == NULL)
-    {
-        return;
-    }
-
-    printf("GB Starting...\n");
-
-    uint8_t bootstrapROMSize = 0;
-    gb->bootRom              = LoadRom("DMG_ROM.bin", &gb->bootRomSize);
-    if (gb->bootRom == NULL)
-    {
-        return;
-    }
-
-    gb->cart = LoadRom(rom, &gb->cartSize);
-    if (gb->cart == NULL)
-    {
-        return;
-    }
-
-    DumpRomInfo(gb);
-
-    // Info from
-    // https://realboyemulator.files.wordpress.com/2013/01/gbcpuman.pdf
-    // Power Up Sequence (Found on Page 18)
-
-    gb->regs[REG_BC] = 0x0013;
-    gb->regs[REG_DE] = 0x00D8;
-    gb->regs[REG_HL] = 0x014D;
-    gb->regs[REG_SP] = 0xFFFE;
-    gb->regs[REG_AF] = 0x0000;
-
-    gb->regs[REG_PC] = 0x0;
-    gb->IME          = false;
-    gb->halted       = false;
-
-    WriteMem(gb, 0xFF05, 0x00);
-    WriteMem(gb, 0xFF06, 0x00);
-    WriteMem(gb, 0xFF07, 0x00);
-    WriteMem(gb, 0xFF10, 0x80);
-    WriteMem(gb, 0xFF11, 0xBF);
-    WriteMem(gb, 0xFF12, 0xF3);
-    WriteMem(gb, 0xFF14, 0xBF);
-    WriteMem(gb, 0xFF16, 0x3F);
-    WriteMem(gb, 0xFF17, 0x00);
-    WriteMem(gb, 0xFF19, 0xBF);
-    WriteMem(gb, 0xFF1A, 0x7F);
-    WriteMem(gb, 0xFF1B, 0xFF);
-    WriteMem(gb, 0xFF1C, 0x9F);
-    WriteMem(gb, 0xFF1E, 0xBF);
-    WriteMem(gb, 0xFF20, 0xFF);
-    WriteMem(gb, 0xFF21, 0x00);
-    WriteMem(gb, 0xFF22, 0x00);
-    WriteMem(gb, 0xFF23, 0xBF);
-    WriteMem(gb, 0xFF24, 0x77);
-    WriteMem(gb, 0xFF25, 0xF3);
-    WriteMem(gb, 0xFF26, 0xF1);
-    WriteMem(gb, 0xFF40, 0x91);
-    WriteMem(gb, 0xFF42, 0x00);
-    WriteMem(gb, 0xFF43, 0x00);
-    WriteMem(gb, 0xFF45, 0x00);
-    WriteMem(gb, 0xFF47, 0xFC);
-    WriteMem(gb, 0xFF48, 0xFF);
-    WriteMem(gb, 0xFF49, 0xFF);
-    WriteMem(gb, 0xFF4A, 0x00);
-    WriteMem(gb, 0xFF4B, 0x00);
-    WriteMem(gb, 0xFFFF, 0x00);
-
-    SimpleRender(gb, gb->ctx);
-
-    uint64_t count = 0;
-
-    bool running = true;
-    while (running)
-    {
-        SDL_Event e;
-        while (SDL_PollEvent(&e))
-        {
-            if (e.type == SDL_QUIT)
-            {
-                running = false;
-            }
-        }
-
-        if (!gb->halted && !DoInstruction(gb))
-        {
-            running = false;
-        }
-
-        // Check for interrupt requests
-        if (CheckInterrupt(gb, VBLANK_MASK))
-        {
-            CallInterrupt(gb, 0x40);
-        }
-        else if (CheckInterrupt(gb, LCD_STAT_MASK))
-        {
-            CallInterrupt(gb, 0x48);
-        }
-        else if (CheckInterrupt(gb, TIMER_MASK))
-        {
-            CallInterrupt(gb, 0x50);
-        }
-        else if (CheckInterrupt(gb, SERIAL_MASK))
-        {
-            CallInterrupt(gb, 0x58);
-        }
-        else if (CheckInterrupt(gb, JOYPAD_MASK))
-        {
-            CallInterrupt(gb, 0x60);
-        }
-
-        uint8_t LY = ReadMem(gb, 0xFF44);
-        // if ((count % 8) == 0)
-        {
-            // SimpleRender(gb, gb->ctx);
-            LY += 1;
-
-            if (LY == 144)
-            {
-                uint8_t val = ReadMem(gb, 0xFF0F);
-                val |= 1;
-                WriteMem(gb, 0xFF0F, val);
-            }
-            if (LY > 153)
-            {
-                LY = 0;
-            }
-        }
-
-        if ((count % 1024 * 8) == 0)
-        {
-            SimpleRender(gb, gb->ctx);
-        }
-
-        gb->mem[0xFF44 - 0x8000] = LY;
-        count += 1;
-    }
-
-    SimpleRender(gb, gb->ctx);
-    DumpCPURegisters(gb);
-}
\ No newline at end of file
+//-------------Library API-------------
+
+GB * CreateGB();
+void DestroyGB(GB *gb);
+
+// Loads a cartridge and resets. Without a boot ROM (bootRom is NULL) the GB
+// starts at 0x100 in the state the boot ROM would have left it in. CGB
+// cartridges run as a Game Boy Color unless the boot ROM is a DMG one.
+bool GB_LoadRom(GB *gb, const char *rom, const char *bootRom);
+
+// Whether the loaded cartridge runs as a Game Boy Color
+bool GB_IsCGB(GB *gb);
+
+// Power cycles the loaded cartridge, cartridge RAM is kept
+void GB_Reset(GB *gb);
+
+// Runs for at least the given number of clock cycles, or until the next
+// VBlank. Both return false once an unknown instruction stopped the CPU, and
+// return early at a breakpoint or watchpoint (see GB_GetHit).
+bool GB_RunCycles(GB *gb, uint64_t cycles);
+bool GB_RunFrame(GB *gb);
+
+// The last completed frame, GB_VID_WIDTH * GB_VID_HEIGHT RGBA8888 pixels
+const uint32_t *GB_GetFramebuffer(GB *gb);
+
+// Fast 64 bit hash for comparing results against known good ones. Hashes
+// the bytes as stored, so the values are native endian.
+uint64_t GB_Hash(const void *data, size_t size);
+uint64_t GB_HashFramebuffer(GB *gb);
+
+// Moves up to count of the bytes sent over the serial port since the last
+// call to out, returns the bytes moved. Once SERIAL_OUT_SIZE are waiting
+// any more are dropped. Test ROMs report their results this way.
+size_t GB_ReadSerial(GB *gb, uint8_t *out, size_t count);
+
+// Sets the currently pressed GB_BUTTON_* bits
+void GB_SetButtons(GB *gb, uint8_t buttons);
+
+uint64_t GB_GetCycles(GB *gb);
+uint64_t GB_GetInstructions(GB *gb);
+
+// Synthesizes the sound at sampleRate Hz, 0 turns it off. Off by default,
+// the channels still run then but no samples are made. Returns false if it
+// could not be allocated.
+bool GB_SetAudio(GB *gb, uint32_t sampleRate);
+
+// Moves up to count stereo frames (interleaved left and right samples) of
+// the sound made so far to samples. Returns the frames moved.
+size_t GB_ReadSamples(GB *gb, int16_t *samples, size_t count);
+
+// Runs straight line code from a cache of decoded blocks instead of decoding
+// every instruction. On by default, the results are identical either way.
+// Returns false if the cache could not be allocated.
+bool GB_SetBlockCache(GB *gb, bool enabled);
+
+// Whether the loaded cartridge keeps its RAM powered by a battery
+bool GB_HasBattery(GB *gb);
+
+// Keeps battery buffered RAM in a save file, usually named after the ROM
+// with .sav. The file is mapped into memory so games write straight into
+// it, and its writing back is only started (never waited for) when a game
+// disables RAM and when the cartridge is unloaded. The RAM is loaded from
+// the file, a new one starts out with the RAM as it is. Lasts until the
+// next GB_LoadRom, returns false if the cartridge has no battery or the
+// file can't be opened.
+bool GB_SetSaveFile(GB *gb, const char *path);
+
+// Save states are a fixed layout, see stateFields in GB.c. They only
+// restore into a GB running the same cartridge and are native endian.
+#define GB_STATE_MAGIC 0x42474350 // "PCGB"
+#define GB_STATE_VERSION 5
+
+// Bytes needed to save the state of a GB with its cartridge loaded
+size_t GB_StateSize(GB *gb);
+
+// Returns the bytes written, 0 if the buffer is too small
+size_t GB_SaveState(GB *gb, void *buf, size_t size);
+bool   GB_LoadState(GB *gb, const void *buf, size_t size);
+
+// Ring of delta snapshots for rewind and forking. Only pages of VRAM, WRAM and
+// cartridge RAM written since the previous snapshot are stored, with a full
+// keyframe every keyframeInterval snapshots. When full the oldest keyframe
+// and the deltas depending on it are dropped.
+typedef struct SnapshotRingstruct SnapshotRing;
+
+SnapshotRing *GB_CreateSnapshotRing(GB *gb, uint32_t capacity,
+                                    uint32_t keyframeInterval);
+void          GB_DestroySnapshotRing(SnapshotRing *ring);
+
+bool     GB_TakeSnapshot(SnapshotRing *ring);
+uint32_t GB_GetSnapshotCount(SnapshotRing *ring);
+
+// Index 0 is the oldest snapshot. Restoring into the ring's own GB drops
+// every newer snapshot, any other GB running the same cartridge can be
+// forked from any snapshot.
+bool GB_RestoreSnapshot(SnapshotRing *ring, uint32_t index, GB *gb);
+
+// Movies are the buttons held during each frame since power on, replayed
+// by setting them before every GB_RunFrame. Like save states they belong to
+// one cartridge (and to starting with or without a boot ROM) and are native
+// endian. Cartridge RAM is not part of them.
+#define GB_MOVIE_MAGIC 0x4D474350 // "PCGM"
+#define GB_MOVIE_VERSION 1
+
+typedef struct Moviestruct Movie;
+
+// Starts an empty movie of the cartridge loaded in gb, to be recorded from
+// its power on
+Movie *GB_CreateMovie(GB *gb);
+Movie *GB_LoadMovie(const char *path);
+bool   GB_SaveMovie(Movie *movie, const char *path);
+void   GB_DestroyMovie(Movie *movie);
+
+// Appends the buttons held during the next frame
+bool     GB_RecordFrame(Movie *movie, uint8_t buttons);
+uint32_t GB_GetMovieLength(Movie *movie);
+// Buttons held during a frame, none past the end
+uint8_t GB_GetMovieButtons(Movie *movie, uint32_t frame);
+
+// Whether the movie was recorded on the cartridge loaded in gb, started the
+// same way
+bool GB_CheckMovie(GB *gb, Movie *movie);
+
+// Power cycles gb and replays up to frames frames of the movie in one go.
+// Returns the frames run, fewer if the CPU stopped and none if the movie
+// doesn't belong to gb.
+uint32_t GB_PlayMovie(GB *gb, Movie *movie, uint32_t frames);
+
+// Execution trace for post mortem debugging. Records every instruction into
+// a preallocated ring of the last capacity ones without formatting anything,
+// 0 turns it off. Off by default, resets keep it. Skipped iterations of a
+// poll loop (see SkipPollLoop in GB.c) are not recorded. Returns false if the
+// ring could not be allocated.
+bool GB_SetTrace(GB *gb, uint32_t capacity);
+
+// Trace files are a TraceHeader followed by its entries, oldest first. Read
+// them with pc_gb_trace. Native endian.
+#define GB_TRACE_MAGIC 0x54474350 // "PCGT"
+#define GB_TRACE_VERSION 1
+
+typedef struct TraceHeaderstruct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t entrySize;
+    uint32_t entryCount;
+    // Instructions traced in all, older ones were overwritten
+    uint64_t total;
+} TraceHeader;
+
+bool GB_SaveTrace(GB *gb, const char *path);
+
+// Writes the instruction at bytes (at least 3 of them) as it would be at pc,
+// returns its length
+uint8_t GB_Disassemble(uint16_t pc, const uint8_t *bytes, char *out,
+                       size_t size);
+
+// Debugger. Breakpoints stop in front of the instruction at their address,
+// in every ROM bank, watchpoints right after the instruction that read or
+// wrote theirs. Running again resumes from there.
+//
+// Only what is set costs anything. Blocks end in front of breakpoints, which
+// are checked by the interpreter, and only pages holding watchpoints are
+// left out of the page tables to go through the slow path. Returns false if
+// the debugger could not be allocated.
+bool GB_SetBreakpoint(GB *gb, uint16_t addr, bool enabled);
+
+// GB_WATCH_* bits of the accesses to stop at, 0 removes the watchpoint.
+// These are CPU accesses, instruction fetches included, and OAM DMA reads.
+bool GB_SetWatchpoint(GB *gb, uint16_t addr, uint8_t flags);
+
+// Whether the last run stopped at a breakpoint or watchpoint, and which
+bool GB_GetHit(GB *gb, DebugHit *hit);
+
+// Executes one instruction or idle step, returns its cycles (0 on failure
+// or in front of a breakpoint)
+uint8_t StepGB(GB *gb);
+
+// Draws line LY into the framebuffer, normally called by the PPU at the end
+// of each line's transfer
+void RenderScanline(GB *gb);
+
+uint8_t ReadMem(GB *gb, uint16_t addr);
+void    WriteMem(GB *gb, uint16_t addr, uint8_t val);
+
+void DumpCPURegisters(GB *gb);
+void DumpRomInfo(GB *gb);
+
+#ifdef GB_PROFILE
+// Prints the executed opcodes and the hottest PCs, by cycles spent
+void DumpProfile(GB *gb);
+#endif
@@ -144,6 +144,9 @@
 // ld (FF00+C),A
 #define OP_LD_IOC_A 0xE2
 
+// ld A,(FF00+C)
+#define OP_LD_A_IOC 0xF2
+
 // ldi A, (HL)
 #define OP_LDI_A_ptrHL 0x2A
 
@@ -153,6 +156,9 @@
 // ldd (HL), A
 #define OP_LDD_ptrHL_A 0x32
 
+// ldd A, (HL)
+#define OP_LDD_A_ptrHL 0x3A
+
 // ld r,(HL)
 #define OP_LD_B_ptrHL (REG_B << 3 | 0x46)
 #define OP_LD_C_ptrHL (REG_C << 3 | 0x46)
@@ -215,6 +221,9 @@
 #define OP_ADC_L (0x88 | REG_L)
 #define OP_ADC_A (0x88 | REG_A)
 
+// adc A,n
+#define OP_ADC_A_n 0xCE
+
 // adc A,(HL)
 #define OP_ADC_A_ptrHL 0x8E
 
@@ -230,6 +239,9 @@
 // sub A,n
 #define OP_SUB_A_n 0xD6
 
+// sub A,(HL)
+#define OP_SUB_A_ptrHL 0x96
+
 // sbc A,r
 #define OP_SBC_B (0x98 | REG_B)
 #define OP_SBC_C (0x98 | REG_C)
@@ -239,6 +251,9 @@
 #define OP_SBC_L (0x98 | REG_L)
 #define OP_SBC_A (0x98 | REG_A)
 
+// sbc A,n
+#define OP_SBC_A_n 0xDE
+
 // sbc A,(HL)
 #define OP_SBC_ptrHL 0x9E
 
@@ -254,6 +269,9 @@
 // and n
 #define OP_AND_A_nn 0xE6
 
+// and (HL)
+#define OP_AND_ptrHL 0xA6
+
 // xor r
 #define OP_XOR_B (0xA8 | REG_B)
 #define OP_XOR_C (0xA8 | REG_C)
@@ -263,6 +281,9 @@
 #define OP_XOR_L (0xA8 | REG_L)
 #define OP_XOR_A (0xA8 | REG_A)
 
+// xor n
+#define OP_XOR_n 0xEE
+
 // xor (HL)
 #define OP_XOR_ptrHL 0xAE
 
@@ -336,6 +357,9 @@
 // ld SP, HL
 #define OP_LD_SP_HL 0xF9
 
+// ld HL, SP+dd
+#define OP_LD_HL_SPdd 0xF8
+
 // push rr
 #define OP_PUSH_BC (REG_BC << 4 | 0xC5)
 #define OP_PUSH_DE (REG_DE << 4 | 0xC5)
@@ -379,9 +403,39 @@
 // rla
 #define OP_RLA 0x17
 
+// rrca
+#define OP_RRCA 0x0F
+
 // rra
 #define OP_RRA 0x1F
 
+// 0xCB prefixed opcodes (OP_CB_*) are decoded from the byte following it
+#define OP_PREFIX_CB 0xCB
+
+// rlc r
+#define OP_CB_RLC_B (REG_B | 0x00)
+#define OP_CB_RLC_C (REG_C | 0x00)
+#define OP_CB_RLC_D (REG_D | 0x00)
+#define OP_CB_RLC_E (REG_E | 0x00)
+#define OP_CB_RLC_H (REG_H | 0x00)
+#define OP_CB_RLC_L (REG_L | 0x00)
+#define OP_CB_RLC_A (REG_A | 0x00)
+
+// rlc (HL)
+#define OP_CB_RLC_ptrHL 0x06
+
+// rrc r
+#define OP_CB_RRC_B (REG_B | 0x08)
+#define OP_CB_RRC_C (REG_C | 0x08)
+#define OP_CB_RRC_D (REG_D | 0x08)
+#define OP_CB_RRC_E (REG_E | 0x08)
+#define OP_CB_RRC_H (REG_H | 0x08)
+#define OP_CB_RRC_L (REG_L | 0x08)
+#define OP_CB_RRC_A (REG_A | 0x08)
+
+// rrc (HL)
+#define OP_CB_RRC_ptrHL 0x0E
+
 // rl r
 #define OP_CB_RL_B (REG_B | 0x10)
 #define OP_CB_RL_C (REG_C | 0x10)
@@ -391,6 +445,9 @@
 #define OP_CB_RL_L (REG_L | 0x10)
 #define OP_CB_RL_A (REG_A | 0x10)
 
+// rl (HL)
+#define OP_CB_RL_ptrHL 0x16
+
 // rr r
 #define OP_CB_RR_B (REG_B | 0x18)
 #define OP_CB_RR_C (REG_C | 0x18)
@@ -412,6 +469,21 @@
 #define OP_CB_SLA_L (REG_L | 0x20)
 #define OP_CB_SLA_A (REG_A | 0x20)
 
+// sla (HL)
+#define OP_CB_SLA_ptrHL 0x26
+
+// sra r
+#define OP_CB_SRA_B (REG_B | 0x28)
+#define OP_CB_SRA_C (REG_C | 0x28)
+#define OP_CB_SRA_D (REG_D | 0x28)
+#define OP_CB_SRA_E (REG_E | 0x28)
+#define OP_CB_SRA_H (REG_H | 0x28)
+#define OP_CB_SRA_L (REG_L | 0x28)
+#define OP_CB_SRA_A (REG_A | 0x28)
+
+// sra (HL)
+#define OP_CB_SRA_ptrHL 0x2E
+
 // swap r
 #define OP_CB_SWAP_B (REG_B | 0x30)
 #define OP_CB_SWAP_C (REG_C | 0x30)
@@ -421,6 +493,9 @@
 #define OP_CB_SWAP_L (REG_L | 0x30)
 #define OP_CB_SWAP_A (REG_A | 0x30)
 
+// swap (HL)
+#define OP_CB_SWAP_ptrHL 0x36
+
 // srl r
 #define OP_CB_SRL_B (REG_B | 0x38)
 #define OP_CB_SRL_C (REG_C | 0x38)
@@ -430,6 +505,9 @@
 #define OP_CB_SRL_L (REG_L | 0x38)
 #define OP_CB_SRL_A (REG_A | 0x38)
 
+// srl (HL)
+#define OP_CB_SRL_ptrHL 0x3E
+
 //------------------------------Single Bit Operation
 // Commands-------------------------
 // bit n,r
@@ -490,6 +568,16 @@
 #define OP_CB_BIT_6_A (REG_A | 0x70)
 #define OP_CB_BIT_7_A (REG_A | 0x78)
 
+// bit n,(HL)
+#define OP_CB_BIT_0_ptrHL (0x46)
+#define OP_CB_BIT_1_ptrHL (0x4E)
+#define OP_CB_BIT_2_ptrHL (0x56)
+#define OP_CB_BIT_3_ptrHL (0x5E)
+#define OP_CB_BIT_4_ptrHL (0x66)
+#define OP_CB_BIT_5_ptrHL (0x6E)
+#define OP_CB_BIT_6_ptrHL (0x76)
+#define OP_CB_BIT_7_ptrHL (0x7E)
+
 // bit n,r
 #define OP_CB_RES_0_B (REG_B | (0x40 + 0x40))
 #define OP_CB_RES_1_B (REG_B | (0x48 + 0x40))
@@ -548,6 +636,84 @@
 #define OP_CB_RES_6_A (REG_A | (0x70 + 0x40))
 #define OP_CB_RES_7_A (REG_A | (0x78 + 0x40))
 
+// res n,(HL)
+#define OP_CB_RES_0_ptrHL (0x46 + 0x40)
+#define OP_CB_RES_1_ptrHL (0x4E + 0x40)
+#define OP_CB_RES_2_ptrHL (0x56 + 0x40)
+#define OP_CB_RES_3_ptrHL (0x5E + 0x40)
+#define OP_CB_RES_4_ptrHL (0x66 + 0x40)
+#define OP_CB_RES_5_ptrHL (0x6E + 0x40)
+#define OP_CB_RES_6_ptrHL (0x76 + 0x40)
+#define OP_CB_RES_7_ptrHL (0x7E + 0x40)
+
+// set n,r
+#define OP_CB_SET_0_B (REG_B | (0x40 + 0x80))
+#define OP_CB_SET_1_B (REG_B | (0x48 + 0x80))
+#define OP_CB_SET_2_B (REG_B | (0x50 + 0x80))
+#define OP_CB_SET_3_B (REG_B | (0x58 + 0x80))
+#define OP_CB_SET_4_B (REG_B | (0x60 + 0x80))
+#define OP_CB_SET_5_B (REG_B | (0x68 + 0x80))
+#define OP_CB_SET_6_B (REG_B | (0x70 + 0x80))
+#define OP_CB_SET_7_B (REG_B | (0x78 + 0x80))
+#define OP_CB_SET_0_C (REG_C | (0x40 + 0x80))
+#define OP_CB_SET_1_C (REG_C | (0x48 + 0x80))
+#define OP_CB_SET_2_C (REG_C | (0x50 + 0x80))
+#define OP_CB_SET_3_C (REG_C | (0x58 + 0x80))
+#define OP_CB_SET_4_C (REG_C | (0x60 + 0x80))
+#define OP_CB_SET_5_C (REG_C | (0x68 + 0x80))
+#define OP_CB_SET_6_C (REG_C | (0x70 + 0x80))
+#define OP_CB_SET_7_C (REG_C | (0x78 + 0x80))
+#define OP_CB_SET_0_D (REG_D | (0x40 + 0x80))
+#define OP_CB_SET_1_D (REG_D | (0x48 + 0x80))
+#define OP_CB_SET_2_D (REG_D | (0x50 + 0x80))
+#define OP_CB_SET_3_D (REG_D | (0x58 + 0x80))
+#define OP_CB_SET_4_D (REG_D | (0x60 + 0x80))
+#define OP_CB_SET_5_D (REG_D | (0x68 + 0x80))
+#define OP_CB_SET_6_D (REG_D | (0x70 + 0x80))
+#define OP_CB_SET_7_D (REG_D | (0x78 + 0x80))
+#define OP_CB_SET_0_E (REG_E | (0x40 + 0x80))
+#define OP_CB_SET_1_E (REG_E | (0x48 + 0x80))
+#define OP_CB_SET_2_E (REG_E | (0x50 + 0x80))
+#define OP_CB_SET_3_E (REG_E | (0x58 + 0x80))
+#define OP_CB_SET_4_E (REG_E | (0x60 + 0x80))
+#define OP_CB_SET_5_E (REG_E | (0x68 + 0x80))
+#define OP_CB_SET_6_E (REG_E | (0x70 + 0x80))
+#define OP_CB_SET_7_E (REG_E | (0x78 + 0x80))
+#define OP_CB_SET_0_H (REG_H | (0x40 + 0x80))
+#define OP_CB_SET_1_H (REG_H | (0x48 + 0x80))
+#define OP_CB_SET_2_H (REG_H | (0x50 + 0x80))
+#define OP_CB_SET_3_H (REG_H | (0x58 + 0x80))
+#define OP_CB_SET_4_H (REG_H | (0x60 + 0x80))
+#define OP_CB_SET_5_H (REG_H | (0x68 + 0x80))
+#define OP_CB_SET_6_H (REG_H | (0x70 + 0x80))
+#define OP_CB_SET_7_H (REG_H | (0x78 + 0x80))
+#define OP_CB_SET_0_L (REG_L | (0x40 + 0x80))
+#define OP_CB_SET_1_L (REG_L | (0x48 + 0x80))
+#define OP_CB_SET_2_L (REG_L | (0x50 + 0x80))
+#define OP_CB_SET_3_L (REG_L | (0x58 + 0x80))
+#define OP_CB_SET_4_L (REG_L | (0x60 + 0x80))
+#define OP_CB_SET_5_L (REG_L | (0x68 + 0x80))
+#define OP_CB_SET_6_L (REG_L | (0x70 + 0x80))
+#define OP_CB_SET_7_L (REG_L | (0x78 + 0x80))
+#define OP_CB_SET_0_A (REG_A | (0x40 + 0x80))
+#define OP_CB_SET_1_A (REG_A | (0x48 + 0x80))
+#define OP_CB_SET_2_A (REG_A | (0x50 + 0x80))
+#define OP_CB_SET_3_A (REG_A | (0x58 + 0x80))
+#define OP_CB_SET_4_A (REG_A | (0x60 + 0x80))
+#define OP_CB_SET_5_A (REG_A | (0x68 + 0x80))
+#define OP_CB_SET_6_A (REG_A | (0x70 + 0x80))
+#define OP_CB_SET_7_A (REG_A | (0x78 + 0x80))
+
+// set n,(HL)
+#define OP_CB_SET_0_ptrHL (0x46 + 0x80)
+#define OP_CB_SET_1_ptrHL (0x4E + 0x80)
+#define OP_CB_SET_2_ptrHL (0x56 + 0x80)
+#define OP_CB_SET_3_ptrHL (0x5E + 0x80)
+#define OP_CB_SET_4_ptrHL (0x66 + 0x80)
+#define OP_CB_SET_5_ptrHL (0x6E + 0x80)
+#define OP_CB_SET_6_ptrHL (0x76 + 0x80)
+#define OP_CB_SET_7_ptrHL (0x7E + 0x80)
+
 //--------------------------------CPU Control
 // Commands--------------------------------
 #define OP_CCF 0x3F
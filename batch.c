@@ -0,0 +1,386 @@
+// batch.c - Runs many independent GB instances over a thread pool
+//
+// Every instance runs the same ROM for a fixed budget of frames (or
+// cycles), optionally driven by its own input script. Instances share
+// nothing but the read only ROM data, so throughput scales with cores.
+//
+// Input scripts are text files of "<frame> <buttons>" lines, buttons being
+// the GB_BUTTON_* bits in hex. The buttons are held from that frame until
+// the next line. Lines starting with # are ignored.
+//
+// Movies recorded by pc_gb --record can be given instead of scripts. They
+// are replayed from power on for their whole length, or --frames if that
+// was given and is shorter. --cycles doesn't apply to them.
+
+#include "GB.h"
+
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct InputEventstruct
+{
+    uint64_t frame;
+    uint8_t  buttons;
+} InputEvent;
+
+typedef struct Instancestruct
+{
+    // Input script or movie, NULL to run without input
+    const char *script;
+    InputEvent *events;
+    uint32_t    eventCount;
+    Movie *     movie;
+
+    // Results
+    bool     ok;
+    uint64_t frames;
+    uint64_t cycles;
+    uint16_t pc;
+} Instance;
+
+// A worker's share of the instances. Owners take from the head, idle
+// workers steal from the tail.
+typedef struct WorkQueuestruct
+{
+    pthread_mutex_t lock;
+    uint32_t        head;
+    uint32_t        tail;
+} WorkQueue;
+
+typedef struct Batchstruct
+{
+    const char *rom;
+    const char *bootRom;
+    uint64_t    frames;
+    uint64_t    cycles;
+    // Whether --frames was given, movies run to their end otherwise
+    bool framesGiven;
+
+    Instance *instances;
+    uint32_t  instanceCount;
+
+    WorkQueue *queues;
+    uint32_t   workerCount;
+} Batch;
+
+typedef struct Workerstruct
+{
+    Batch *  batch;
+    uint32_t index;
+} Worker;
+
+bool LoadScript(Instance *inst)
+{
+    FILE *f = fopen(inst->script, "r");
+    if (f == NULL)
+    {
+        printf("Failed to open input script: %s\n", inst->script);
+        return false;
+    }
+
+    uint32_t magic = 0;
+    if (fread(&magic, sizeof(magic), 1, f) == 1 && magic == GB_MOVIE_MAGIC)
+    {
+        fclose(f);
+        inst->movie = GB_LoadMovie(inst->script);
+        return inst->movie != NULL;
+    }
+    rewind(f);
+
+    uint32_t capacity = 0;
+    char     line[256];
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        unsigned long long frame;
+        unsigned int       buttons;
+
+        if (line[0] == '#' || sscanf(line, "%llu %x", &frame, &buttons) != 2)
+        {
+            continue;
+        }
+
+        if (inst->eventCount == capacity)
+        {
+            capacity     = capacity > 0 ? capacity * 2 : 64;
+            inst->events = realloc(inst->events, capacity * sizeof(InputEvent));
+        }
+
+        inst->events[inst->eventCount].frame   = frame;
+        inst->events[inst->eventCount].buttons = buttons;
+        inst->eventCount += 1;
+    }
+
+    fclose(f);
+    return true;
+}
+
+void RunInstance(Batch *batch, Instance *inst)
+{
+    GB *gb = CreateGB();
+    if (gb == NULL || !GB_LoadRom(gb, batch->rom, batch->bootRom))
+    {
+        DestroyGB(gb);
+        return;
+    }
+
+    if (inst->movie != NULL)
+    {
+        uint32_t frames = GB_GetMovieLength(inst->movie);
+        if (batch->framesGiven && batch->frames < frames)
+        {
+            frames = batch->frames;
+        }
+
+        inst->frames = GB_PlayMovie(gb, inst->movie, frames);
+        inst->ok     = inst->frames == frames && !gb->stopped &&
+                   GB_CheckMovie(gb, inst->movie);
+        inst->cycles = GB_GetCycles(gb);
+        inst->pc     = gb->regs[REG_PC];
+
+        DestroyGB(gb);
+        return;
+    }
+
+    uint32_t nextEvent = 0;
+
+    inst->ok = true;
+    while (inst->ok && inst->frames < batch->frames &&
+           GB_GetCycles(gb) < batch->cycles)
+    {
+        while (nextEvent < inst->eventCount &&
+               inst->events[nextEvent].frame <= inst->frames)
+        {
+            GB_SetButtons(gb, inst->events[nextEvent].buttons);
+            nextEvent += 1;
+        }
+
+        inst->ok = GB_RunFrame(gb);
+        inst->frames += 1;
+    }
+
+    inst->cycles = GB_GetCycles(gb);
+    inst->pc     = gb->regs[REG_PC];
+
+    DestroyGB(gb);
+}
+
+// Takes the next instance from a queue, from the front when it is the
+// worker's own and from the back when stealing. Returns false if empty.
+bool TakeWork(WorkQueue *queue, bool steal, uint32_t *inst)
+{
+    bool found = false;
+
+    pthread_mutex_lock(&queue->lock);
+    if (queue->head < queue->tail)
+    {
+        *inst = steal ? --queue->tail : queue->head++;
+        found = true;
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    return found;
+}
+
+void *WorkerMain(void *arg)
+{
+    Worker * worker = arg;
+    Batch *  batch  = worker->batch;
+    uint32_t inst;
+
+    for (;;)
+    {
+        if (TakeWork(&batch->queues[worker->index], false, &inst))
+        {
+            RunInstance(batch, &batch->instances[inst]);
+            continue;
+        }
+
+        // Own queue is empty, steal from the others
+        bool stole = false;
+        for (uint32_t i = 1; i < batch->workerCount && !stole; ++i)
+        {
+            uint32_t victim = (worker->index + i) % batch->workerCount;
+            stole           = TakeWork(&batch->queues[victim], true, &inst);
+        }
+
+        if (!stole)
+        {
+            break;
+        }
+
+        RunInstance(batch, &batch->instances[inst]);
+    }
+
+    return NULL;
+}
+
+double GetSeconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void PrintUsage()
+{
+    printf("Usage: pc_gb_batch [options] <rom> [input scripts or "
+           "movies...]\n");
+    printf("\t--instances <n>   Instances to run without a script (default "
+           "1 if no scripts are given)\n");
+    printf("\t--threads <n>     Worker threads (default: one per core)\n");
+    printf("\t--frames <n>      Frames to run each instance for (default "
+           "600)\n");
+    printf("\t--cycles <n>      Stop each instance after n clock cycles, "
+           "whichever budget runs out first\n");
+    printf("\t--boot <path>     Boot ROM to run first\n");
+}
+
+int main(int argc, char **argv)
+{
+    Batch batch = {0};
+    batch.frames = 600;
+    batch.cycles = UINT64_MAX;
+
+    uint32_t     instances   = 0;
+    long         threads     = sysconf(_SC_NPROCESSORS_ONLN);
+    const char **scripts     = calloc(argc, sizeof(char *));
+    uint32_t     scriptCount = 0;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--instances") == 0 && i + 1 < argc)
+        {
+            instances = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            threads = atol(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+        {
+            batch.frames      = strtoull(argv[++i], NULL, 10);
+            batch.framesGiven = true;
+        }
+        else if (strcmp(argv[i], "--cycles") == 0 && i + 1 < argc)
+        {
+            batch.cycles = strtoull(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--boot") == 0 && i + 1 < argc)
+        {
+            batch.bootRom = argv[++i];
+        }
+        else if (batch.rom == NULL)
+        {
+            batch.rom = argv[i];
+        }
+        else
+        {
+            scripts[scriptCount++] = argv[i];
+        }
+    }
+
+    if (batch.rom == NULL)
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    if (instances == 0 && scriptCount == 0)
+    {
+        instances = 1;
+    }
+
+    // One instance per script followed by the ones without input
+    batch.instanceCount = scriptCount + instances;
+    batch.instances     = calloc(batch.instanceCount, sizeof(Instance));
+
+    for (uint32_t i = 0; i < scriptCount; ++i)
+    {
+        batch.instances[i].script = scripts[i];
+        if (!LoadScript(&batch.instances[i]))
+        {
+            return 1;
+        }
+    }
+
+    if (threads < 1)
+    {
+        threads = 1;
+    }
+    if (threads > batch.instanceCount)
+    {
+        threads = batch.instanceCount;
+    }
+
+    // Deal the instances out in contiguous ranges
+    batch.workerCount = threads;
+    batch.queues      = calloc(threads, sizeof(WorkQueue));
+
+    for (uint32_t i = 0; i < batch.workerCount; ++i)
+    {
+        pthread_mutex_init(&batch.queues[i].lock, NULL);
+        batch.queues[i].head =
+            (uint64_t)batch.instanceCount * i / batch.workerCount;
+        batch.queues[i].tail =
+            (uint64_t)batch.instanceCount * (i + 1) / batch.workerCount;
+    }
+
+    pthread_t *pool    = calloc(threads, sizeof(pthread_t));
+    Worker *   workers = calloc(threads, sizeof(Worker));
+
+    double start = GetSeconds();
+
+    for (uint32_t i = 0; i < batch.workerCount; ++i)
+    {
+        workers[i].batch = &batch;
+        workers[i].index = i;
+        pthread_create(&pool[i], NULL, WorkerMain, &workers[i]);
+    }
+
+    for (uint32_t i = 0; i < batch.workerCount; ++i)
+    {
+        pthread_join(pool[i], NULL);
+    }
+
+    double elapsed = GetSeconds() - start;
+
+    uint64_t totalFrames = 0;
+    uint32_t failed      = 0;
+
+    for (uint32_t i = 0; i < batch.instanceCount; ++i)
+    {
+        Instance *inst = &batch.instances[i];
+
+        printf("%u\t%s\t%s\tframes=%" PRIu64 "\tcycles=%" PRIu64
+               "\tpc=0x%04X\n",
+               i, inst->script != NULL ? inst->script : "-",
+               inst->ok ? "ok" : "stopped", inst->frames, inst->cycles,
+               inst->pc);
+
+        totalFrames += inst->frames;
+        failed += inst->ok ? 0 : 1;
+
+        free(inst->events);
+        GB_DestroyMovie(inst->movie);
+    }
+
+    printf("%u instances, %u stopped, %ld threads: %" PRIu64
+           " frames in %.3fs (%.1f frames/s)\n",
+           batch.instanceCount, failed, threads, totalFrames, elapsed,
+           totalFrames / elapsed);
+
+    for (uint32_t i = 0; i < batch.workerCount; ++i)
+    {
+        pthread_mutex_destroy(&batch.queues[i].lock);
+    }
+
+    free(workers);
+    free(pool);
+    free(batch.queues);
+    free(batch.instances);
+    free(scripts);
+
+    return 0;
+}
@@ -0,0 +1,428 @@
+// bench.c - Headless throughput benchmark
+//
+// Runs a ROM for a fixed budget of frames (or cycles) without presenting
+// anything, several times over, and reports how fast the core went. Each
+// repeat starts from a fresh reset so the runs are comparable.
+//
+// Render time is measured separately by redrawing the last frame's 144
+// lines from the state the run ended in, the PPU is not timed while the
+// CPU runs.
+//
+// --audio also synthesizes the sound, drained once per frame like a
+// frontend would, so its cost shows up in the results.
+//
+// --synthetic writes a small built in ROM (VRAM and WRAM loops with the LCD
+// on) and benchmarks it, so there is always something to run.
+
+#include "GB.h"
+
+#include <time.h>
+
+#define FORMAT_TEXT 0
+#define FORMAT_JSON 1
+#define FORMAT_CSV 2
+
+// Redraws of the frame per repeat when timing the renderer
+#define RENDER_PASSES 60
+
+// Stereo frames drained per call with --audio
+#define AUDIO_DRAIN_FRAMES 4096
+
+typedef struct Resultstruct
+{
+    double   seconds;
+    uint64_t frames;
+    uint64_t cycles;
+    uint64_t instructions;
+    double   renderSeconds;
+    bool     ok;
+} Result;
+
+typedef struct Benchstruct
+{
+    const char *rom;
+    const char *bootRom;
+    uint64_t    frames;
+    uint64_t    cycles;
+    uint32_t    repeat;
+    uint8_t     format;
+    bool        blockCache;
+    // Sample rate to synthesize the sound at, 0 for none
+    uint32_t sampleRate;
+    // Fail if the best run is slower than this many times real time
+    double minSpeed;
+
+    FILE *out;
+} Bench;
+
+double GetSeconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Fills the VRAM with a pattern and churns through WRAM forever. Runs from
+// 0x150 without a boot ROM or with one, the LCD stays on throughout. Writing
+// 0 to 0xFF50 once booted must leave the cartridge at 0x0000-0x00FF, which
+// the RST $08 called next shows by sending a byte over the serial port.
+bool WriteSyntheticRom(const char *path)
+{
+    static const uint8_t rst08[] = {
+        // 0008: ld a,$4B ; ldh ($01),a ; ld a,$81 ; ldh ($02),a ; ret
+        0x3E, 0x4B, 0xE0, 0x01, 0x3E, 0x81, 0xE0, 0x02, 0xC9,
+    };
+
+    static const uint8_t code[] = {
+        // 0150: ld sp,$FFFE
+        0x31, 0xFE, 0xFF,
+        // 0153: xor a ; ldh ($50),a ; rst $08
+        0xAF, 0xE0, 0x50, 0xCF,
+        // 0157: call $0160 ; call $0180 ; jr $0157
+        0xCD, 0x60, 0x01, 0xCD, 0x80, 0x01, 0x18, 0xF8,
+        0x00,
+        // 0160: ld hl,$8000
+        0x21, 0x00, 0x80,
+        // 0163: ld a,l ; xor h ; ld (hl+),a ; ld a,h ; cp $A0 ; jr nz,$0163
+        0x7D, 0xAC, 0x22, 0x7C, 0xFE, 0xA0, 0x20, 0xF8,
+        // 016B: ret
+        0xC9,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        // 0180: ld hl,$C000 ; ld b,0
+        0x21, 0x00, 0xC0, 0x06, 0x00,
+        // 0185: ld a,(hl) ; add a,l ; add a,b ; ld (hl+),a ; inc b ; ld a,h
+        0x7E, 0x85, 0x80, 0x22, 0x04, 0x7C,
+        // 018B: cp $D0 ; jr nz,$0185 ; ret
+        0xFE, 0xD0, 0x20, 0xF6, 0xC9,
+    };
+
+    static uint8_t rom[0x8000];
+    memset(rom, 0, sizeof(rom));
+
+    memcpy(&rom[0x08], rst08, sizeof(rst08));
+
+    // Entry point: nop ; jp $0150
+    rom[0x100] = 0x00;
+    rom[0x101] = 0xC3;
+    rom[0x102] = 0x50;
+    rom[0x103] = 0x01;
+    memcpy(&rom[0x134], "PCGB BENCH", 10);
+    memcpy(&rom[0x150], code, sizeof(code));
+
+    // Header checksum, checked by the boot ROM
+    uint8_t check = 0;
+    for (int i = 0x134; i <= 0x14C; ++i)
+    {
+        check = check - rom[i] - 1;
+    }
+    rom[0x14D] = check;
+
+    FILE *f = fopen(path, "wb");
+    if (f == NULL)
+    {
+        printf("Failed to write synthetic ROM: %s\n", path);
+        return false;
+    }
+
+    bool ok = fwrite(rom, 1, sizeof(rom), f) == sizeof(rom);
+    fclose(f);
+
+    return ok;
+}
+
+// Times full redraws of the current frame, leaving the GB as it was
+double TimeRender(GB *gb)
+{
+    uint8_t ly         = gb->io[IO_LY - IO_BASE];
+    uint8_t windowLine = gb->windowLine;
+
+    double start = GetSeconds();
+    for (int pass = 0; pass < RENDER_PASSES; ++pass)
+    {
+        for (int line = 0; line < GB_VID_HEIGHT; ++line)
+        {
+            gb->io[IO_LY - IO_BASE] = line;
+            RenderScanline(gb);
+        }
+    }
+    double elapsed = GetSeconds() - start;
+
+    gb->io[IO_LY - IO_BASE] = ly;
+    gb->windowLine          = windowLine;
+
+    return elapsed / RENDER_PASSES;
+}
+
+bool RunBench(Bench *bench, GB *gb, Result *result)
+{
+    static int16_t samples[AUDIO_DRAIN_FRAMES * 2];
+
+    memset(result, 0, sizeof(Result));
+
+    if (!GB_LoadRom(gb, bench->rom, bench->bootRom))
+    {
+        return false;
+    }
+
+    result->ok   = true;
+    double start = GetSeconds();
+
+    while (result->ok && result->frames < bench->frames &&
+           GB_GetCycles(gb) < bench->cycles)
+    {
+        result->ok = GB_RunFrame(gb);
+        result->frames += 1;
+
+        while (GB_ReadSamples(gb, samples, AUDIO_DRAIN_FRAMES) > 0)
+        {
+        }
+    }
+
+    result->seconds       = GetSeconds() - start;
+    result->cycles        = GB_GetCycles(gb);
+    result->instructions  = GB_GetInstructions(gb);
+    result->renderSeconds = TimeRender(gb);
+
+    return true;
+}
+
+double GetSpeed(const Result *result)
+{
+    return result->cycles / result->seconds / CPU_CLOCK;
+}
+
+void PrintResult(Bench *bench, uint32_t run, const Result *result)
+{
+    double ips      = result->instructions / result->seconds;
+    double cps      = result->cycles / result->seconds;
+    double renderUs = result->renderSeconds * 1e6;
+
+    switch (bench->format)
+    {
+        case FORMAT_JSON:
+            fprintf(bench->out,
+                    "%s    {\"run\": %u, \"ok\": %s, \"frames\": %" PRIu64
+                    ", \"cycles\": %" PRIu64 ", \"instructions\": %" PRIu64
+                    ", \"seconds\": %.6f, \"instructions_per_sec\": %.0f, "
+                    "\"cycles_per_sec\": %.0f, \"realtime_multiplier\": %.3f, "
+                    "\"render_us_per_frame\": %.3f}",
+                    run > 0 ? ",\n" : "", run, result->ok ? "true" : "false",
+                    result->frames, result->cycles, result->instructions,
+                    result->seconds, ips, cps, GetSpeed(result), renderUs);
+            break;
+        case FORMAT_CSV:
+            fprintf(bench->out,
+                    "%s,%u,%d,%" PRIu64 ",%" PRIu64 ",%" PRIu64
+                    ",%.6f,%.0f,%.0f,%.3f,%.3f\n",
+                    bench->rom, run, result->ok, result->frames,
+                    result->cycles, result->instructions, result->seconds,
+                    ips, cps, GetSpeed(result), renderUs);
+            break;
+        default:
+            fprintf(bench->out,
+                    "run %u: %" PRIu64 " frames, %" PRIu64
+                    " cycles in %.3fs, %.2f M instructions/s, %.2f M "
+                    "cycles/s, %.2fx real time, %.2f us render/frame%s\n",
+                    run, result->frames, result->cycles, result->seconds,
+                    ips / 1e6, cps / 1e6, GetSpeed(result), renderUs,
+                    result->ok ? "" : " (stopped)");
+            break;
+    }
+}
+
+void PrintUsage()
+{
+    printf("Usage: pc_gb_bench [options] <rom>\n");
+    printf("\t--frames <n>      Frames to run per repeat (default 600)\n");
+    printf("\t--cycles <n>      Stop each repeat after n clock cycles, "
+           "whichever budget runs out first\n");
+    printf("\t--repeat <n>      Number of runs (default 5)\n");
+    printf("\t--format <name>   text, json or csv\n");
+    printf("\t--boot <path>     Boot ROM to run first\n");
+    printf("\t--no-block-cache  Interpret every instruction\n");
+    printf("\t--audio <rate>    Synthesize the sound at rate Hz\n");
+    printf("\t--min-speed <x>   Exit with an error if the best run is "
+           "slower than x times real time\n");
+    printf("\t--output <path>   Write the report to path instead of stdout, "
+           "the core logs to stdout\n");
+    printf("\t--synthetic <path> Write the built in ROM to path and run it\n");
+}
+
+int main(int argc, char **argv)
+{
+    Bench bench = {0};
+    bench.frames     = 600;
+    bench.cycles     = UINT64_MAX;
+    bench.repeat     = 5;
+    bench.format     = FORMAT_TEXT;
+    bench.blockCache = true;
+
+    const char *synthetic = NULL;
+    const char *output    = NULL;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+        {
+            bench.frames = strtoull(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--cycles") == 0 && i + 1 < argc)
+        {
+            bench.cycles = strtoull(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc)
+        {
+            bench.repeat = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc)
+        {
+            const char *name = argv[++i];
+
+            if (strcmp(name, "text") == 0)
+            {
+                bench.format = FORMAT_TEXT;
+            }
+            else if (strcmp(name, "json") == 0)
+            {
+                bench.format = FORMAT_JSON;
+            }
+            else if (strcmp(name, "csv") == 0)
+            {
+                bench.format = FORMAT_CSV;
+            }
+            else
+            {
+                printf("Unknown format: %s\n", name);
+                PrintUsage();
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--boot") == 0 && i + 1 < argc)
+        {
+            bench.bootRom = argv[++i];
+        }
+        else if (strcmp(argv[i], "--no-block-cache") == 0)
+        {
+            bench.blockCache = false;
+        }
+        else if (strcmp(argv[i], "--audio") == 0 && i + 1 < argc)
+        {
+            bench.sampleRate = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--min-speed") == 0 && i + 1 < argc)
+        {
+            bench.minSpeed = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+        {
+            output = argv[++i];
+        }
+        else if (strcmp(argv[i], "--synthetic") == 0 && i + 1 < argc)
+        {
+            synthetic = argv[++i];
+        }
+        else
+        {
+            bench.rom = argv[i];
+        }
+    }
+
+    if (synthetic != NULL)
+    {
+        if (!WriteSyntheticRom(synthetic))
+        {
+            return 1;
+        }
+        bench.rom = synthetic;
+    }
+
+    if (bench.rom == NULL || bench.repeat == 0)
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    bench.out = output != NULL ? fopen(output, "w") : stdout;
+    if (bench.out == NULL)
+    {
+        printf("Failed to open output: %s\n", output);
+        return 1;
+    }
+
+    GB *gb = CreateGB();
+    if (gb == NULL || !GB_SetBlockCache(gb, bench.blockCache) ||
+        !GB_SetAudio(gb, bench.sampleRate))
+    {
+        printf("Failed to create GameBoy\n");
+        DestroyGB(gb);
+        return 1;
+    }
+
+    if (bench.format == FORMAT_JSON)
+    {
+        fprintf(bench.out, "{\n  \"rom\": \"%s\",\n  \"runs\": [\n",
+                bench.rom);
+    }
+    else if (bench.format == FORMAT_CSV)
+    {
+        fprintf(bench.out, "rom,run,ok,frames,cycles,instructions,seconds,"
+                "instructions_per_sec,cycles_per_sec,realtime_multiplier,"
+                "render_us_per_frame\n");
+    }
+
+    Result   result;
+    double   best   = 0.0;
+    bool     ok     = true;
+    uint32_t failed = 0;
+
+    for (uint32_t run = 0; run < bench.repeat; ++run)
+    {
+        if (!RunBench(&bench, gb, &result))
+        {
+            ok = false;
+            break;
+        }
+
+        PrintResult(&bench, run, &result);
+
+        failed += result.ok ? 0 : 1;
+        if (GetSpeed(&result) > best)
+        {
+            best = GetSpeed(&result);
+        }
+    }
+
+    if (bench.format == FORMAT_JSON)
+    {
+        fprintf(bench.out,
+                "\n  ],\n  \"best_realtime_multiplier\": %.3f\n}\n", best);
+    }
+    else if (bench.format == FORMAT_TEXT && ok)
+    {
+        fprintf(bench.out, "best: %.2fx real time\n", best);
+    }
+
+    DestroyGB(gb);
+
+    if (bench.out != stdout)
+    {
+        fclose(bench.out);
+    }
+
+    // A ROM that stops the CPU would benchmark nothing
+    if (!ok || failed > 0)
+    {
+        return 1;
+    }
+
+    if (best < bench.minSpeed)
+    {
+        // Kept off stdout so JSON and CSV output stay parseable
+        fprintf(stderr, "Slower than %.2fx real time\n", bench.minSpeed);
+        return 1;
+    }
+
+    return 0;
+}
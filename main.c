@@ -1,28 +1,1008 @@
+// main.c - SDL frontend for the emulator core
+//
+// Frames are paced to the GB's own rate of about 59.73 Hz and presented once
+// each. Tab toggles turbo, which runs them as fast as possible instead.
+//
+// The sound is handed to the SDL audio callback through a lock free ring.
+// With --audio-sync the ring's fill level paces the frames instead of the
+// timer, so the audio device's clock is the one the emulation follows.
+//
+// --record saves the buttons held in every frame as a movie, --play replays
+// one instead of reading the keyboard. --trace keeps the last instructions
+// run and saves them on exit, for pc_gb_trace to decode. --break and --watch
+// end the run at a breakpoint or a write to a watched address.
+//
+// Battery buffered RAM is kept in a save file next to the ROM, named after
+// it with .sav, unless a movie is played or recorded (movies start from
+// blank RAM).
+//
+// CGB cartridges run as a Game Boy Color with --no-boot or a CGB boot ROM,
+// the default DMG boot ROM runs them the way a DMG would.
+//
+// The window, its events and the renderer stay on the main thread, which is
+// the only one SDL lets use them everywhere. The frames are run on an
+// emulation thread and handed over through a triple buffer, so waiting for
+// vsync or the GPU never holds up the emulation.
+//
+// Define GB_HEADLESS to build without SDL. Frames are then run as fast as
+// possible on the main thread, never displayed, and no sound is synthesized.
+
 #include "GB.h"
 
+#ifndef GB_HEADLESS
+#ifdef WIN32
+#include <SDL2/SDL.h>
+#else
+#include <SDL.h>
+#endif
+#endif
+
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The frame is always drawn at 160x144, the window is scaled by the renderer
+#define RENDER_SCALE_DEFAULT 4
+
+// How the frame is stretched to the window
+#define RENDER_FILTER_NEAREST 0
+#define RENDER_FILTER_LINEAR 1
+// Nearest, but only by whole multiples (letterboxed)
+#define RENDER_FILTER_INTEGER 2
+
+// Frames presented per second at most while in turbo
+#define TURBO_PRESENT_RATE 60
+// The end of the wait for the next frame is spun, sleeping is too coarse
+#define PACING_SPIN_MS 2
+// Falling further behind than this many frames gives up on catching up
+#define PACING_MAX_LAG 4
+
+// Index bit of the middle frame telling a new one was published there
+#define FRAME_FRESH 0x4
+// Longest the main thread waits for a frame before handling events again
+#define EVENT_POLL_MS 5
+
+#define AUDIO_SAMPLE_RATE 48000
+// Stereo frames the audio device asks for at once
+#define AUDIO_DEVICE_FRAMES 512
+// Stereo frames the ring holds, a power of two
+#define AUDIO_RING_FRAMES 8192
+// With audio sync frames wait while the ring holds more than this, about
+// 40 ms of sound
+#define AUDIO_SYNC_FRAMES 2048
+// Waiting for the audio device gives up after this long, in case it stalled
+#define AUDIO_SYNC_TIMEOUT_MS 100
+
+// Instructions --trace keeps, 24 MB worth
+#define TRACE_LENGTH (1 << 20)
+
+typedef struct RenderContextstruct
+{
+#ifndef GB_HEADLESS
+    // Only ever used by the main thread
+    SDL_Window *  window;
+    SDL_Renderer *renderer;
+    SDL_Texture * backbufferTexture;
+
+    // Posted for every published frame, and once the emulation ended
+    SDL_sem *frameReady;
+
+    // Finished frames, the emulation thread draws to frames[back] and the
+    // main thread shows frames[front]. Both trade theirs for the middle one,
+    // which holds FRAME_FRESH while it is the newest and not yet shown.
+    uint32_t     frames[3][GB_VID_WIDTH * GB_VID_HEIGHT];
+    SDL_atomic_t middle;
+    int          back;
+    int          front;
+
+    // The window's input, set by the main thread for the emulation thread
+    SDL_atomic_t buttons;
+    SDL_atomic_t turbo;
+    // Cleared by the main thread once the window was closed, and by the
+    // emulation thread once it ended
+    SDL_atomic_t running;
+#endif
+
+    // Initial window size as a multiple of 160x144
+    uint8_t scale;
+    uint8_t filter;
+    bool    vsync;
+} RenderContext;
+
+// Sound on its way to the audio device. The emulation is the only one
+// adding to the ring and the audio callback the only one taking from it, so
+// each side owns one index and only ever reads the other's.
+typedef struct AudioContextstruct
+{
+#ifndef GB_HEADLESS
+    SDL_AudioDeviceID device;
+
+    // Stereo frames, head is where the next one goes and tail the next one
+    // played. Both count up forever and wrap around the ring.
+    int16_t      ring[AUDIO_RING_FRAMES * 2];
+    SDL_atomic_t head;
+    SDL_atomic_t tail;
+#endif
+} AudioContext;
+
+// Keeps the emulated frames in step with the host clock
+typedef struct FramePacerstruct
+{
+    // Runs unthrottled while set
+    bool turbo;
+    // Paces by the audio ring instead of the timer when set
+    AudioContext *audio;
+
+    // Host performance counter ticks per second and per emulated frame
+    uint64_t frequency;
+    uint64_t frameTicks;
+
+    // When the next frame is due and when the last one was presented
+    uint64_t nextFrame;
+    uint64_t lastPresent;
+} FramePacer;
+
+// Everything the emulation thread runs with. The window is shared with the
+// main thread, the rest is the emulation thread's alone until it ended.
+typedef struct Emulationstruct
+{
+    GB *           gb;
+    RenderContext *ctx;
+    AudioContext * audio;
+    FramePacer     pacer;
+
+    // Replayed if play is set, recorded otherwise unless NULL
+    Movie *movie;
+    bool   play;
+    // Frames to run, or -1 to run until stopped
+    long maxFrames;
+} Emulation;
+
+#ifndef GB_HEADLESS
+bool CreateRenderer(RenderContext *ctx)
+{
+    ctx->renderer = SDL_CreateRenderer(
+        ctx->window, -1,
+        SDL_RENDERER_ACCELERATED |
+            (ctx->vsync ? SDL_RENDERER_PRESENTVSYNC : 0));
+    if (ctx->renderer == NULL)
+    {
+        return false;
+    }
+
+    // The filter is picked up when the texture is created
+    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY,
+                ctx->filter == RENDER_FILTER_LINEAR ? "linear" : "nearest");
+
+    // Keeps the aspect ratio whatever size the window is resized to
+    SDL_RenderSetLogicalSize(ctx->renderer, GB_VID_WIDTH, GB_VID_HEIGHT);
+    SDL_RenderSetIntegerScale(ctx->renderer,
+                              ctx->filter == RENDER_FILTER_INTEGER);
+
+    ctx->backbufferTexture = SDL_CreateTexture(
+        ctx->renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING,
+        GB_VID_WIDTH, GB_VID_HEIGHT);
+
+    return ctx->backbufferTexture != NULL;
+}
+
+void DestroyRenderer(RenderContext *ctx)
+{
+    if (ctx->backbufferTexture != NULL)
+    {
+        SDL_DestroyTexture(ctx->backbufferTexture);
+        ctx->backbufferTexture = NULL;
+    }
+    if (ctx->renderer != NULL)
+    {
+        SDL_DestroyRenderer(ctx->renderer);
+        ctx->renderer = NULL;
+    }
+}
+#endif
+
+void DestroyRenderContext(RenderContext *ctx)
+{
+    if (ctx != NULL)
+    {
+        printf("Destroying Rendering Context\n");
+#ifndef GB_HEADLESS
+        DestroyRenderer(ctx);
+        if (ctx->frameReady != NULL)
+        {
+            SDL_DestroySemaphore(ctx->frameReady);
+            ctx->frameReady = NULL;
+        }
+        if (ctx->window != NULL)
+        {
+            SDL_DestroyWindow(ctx->window);
+            ctx->window = NULL;
+        }
+
+        SDL_Quit();
+#endif
+        free(ctx);
+    }
+}
+
+RenderContext *CreateRenderContext(uint8_t scale, uint8_t filter, bool vsync)
+{
+    RenderContext *ctx = calloc(1, sizeof(RenderContext));
+    if (ctx == NULL)
+    {
+        return NULL;
+    }
+
+    ctx->scale  = scale > 0 ? scale : 1;
+    ctx->filter = filter;
+    ctx->vsync  = vsync;
+
+#ifndef GB_HEADLESS
+    ctx->window = SDL_CreateWindow(
+        "pc_gb", -1080, SDL_WINDOWPOS_CENTERED, GB_VID_WIDTH * ctx->scale,
+        GB_VID_HEIGHT * ctx->scale, SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE);
+
+    if (ctx->window == NULL)
+    {
+        DestroyRenderContext(ctx);
+        return NULL;
+    }
+
+    ctx->frameReady = SDL_CreateSemaphore(0);
+    if (ctx->frameReady == NULL || !CreateRenderer(ctx))
+    {
+        DestroyRenderContext(ctx);
+        return NULL;
+    }
+
+    ctx->back  = 0;
+    ctx->front = 2;
+    SDL_AtomicSet(&ctx->middle, 1);
+    SDL_AtomicSet(&ctx->running, 1);
+#endif
+
+    printf("Created Rendering Context\n");
+    return ctx;
+}
+
+// Hands a finished frame to the main thread, the renderer does the
+// scaling. Never waits, a frame not shown yet is replaced by the new one.
+void PresentFrame(RenderContext *ctx, const uint32_t *framebuffer)
+{
+#ifndef GB_HEADLESS
+    memcpy(ctx->frames[ctx->back], framebuffer, sizeof(ctx->frames[0]));
+
+    ctx->back =
+        SDL_AtomicSet(&ctx->middle, ctx->back | FRAME_FRESH) & ~FRAME_FRESH;
+    SDL_SemPost(ctx->frameReady);
+#endif
+}
+
+// Whether the window is still open, always when headless
+bool IsRunning(RenderContext *ctx)
+{
+#ifndef GB_HEADLESS
+    return SDL_AtomicGet(&ctx->running);
+#else
+    return true;
+#endif
+}
+
+// Tells the main thread the emulation ended
+void EndRun(RenderContext *ctx)
+{
+#ifndef GB_HEADLESS
+    SDL_AtomicSet(&ctx->running, 0);
+    SDL_SemPost(ctx->frameReady);
+#endif
+}
+
+// The buttons held in the window, none when headless
+uint8_t GetHeldButtons(RenderContext *ctx)
+{
+#ifndef GB_HEADLESS
+    return SDL_AtomicGet(&ctx->buttons);
+#else
+    return 0;
+#endif
+}
+
+#ifndef GB_HEADLESS
+// Plays what the ring holds, and silence once it runs dry
+void AudioCallback(void *data, Uint8 *stream, int len)
+{
+    AudioContext *audio  = data;
+    int16_t *     out    = (int16_t *)stream;
+    uint32_t      frames = len / (2 * sizeof(int16_t));
+    uint32_t      tail   = SDL_AtomicGet(&audio->tail);
+    uint32_t      queued = SDL_AtomicGet(&audio->head) - tail;
+    uint32_t      taken  = queued < frames ? queued : frames;
+
+    for (uint32_t i = 0; i < taken; ++i)
+    {
+        uint32_t index = (tail + i) & (AUDIO_RING_FRAMES - 1);
+
+        out[i * 2]     = audio->ring[index * 2];
+        out[i * 2 + 1] = audio->ring[index * 2 + 1];
+    }
+    memset(&out[taken * 2], 0, (frames - taken) * 2 * sizeof(int16_t));
+
+    SDL_AtomicSet(&audio->tail, tail + taken);
+}
+
+uint32_t GetQueuedAudio(AudioContext *audio)
+{
+    return SDL_AtomicGet(&audio->head) - SDL_AtomicGet(&audio->tail);
+}
+#endif
+
+void DestroyAudioContext(AudioContext *audio)
+{
+    if (audio != NULL)
+    {
+#ifndef GB_HEADLESS
+        if (audio->device != 0)
+        {
+            SDL_CloseAudioDevice(audio->device);
+        }
+        SDL_QuitSubSystem(SDL_INIT_AUDIO);
+#endif
+        free(audio);
+    }
+}
+
+// Opens the audio device at sampleRate Hz. Always fails when headless.
+AudioContext *CreateAudioContext(uint32_t sampleRate)
+{
+#ifndef GB_HEADLESS
+    AudioContext *audio = calloc(1, sizeof(AudioContext));
+    if (audio == NULL)
+    {
+        return NULL;
+    }
+
+    if (SDL_InitSubSystem(SDL_INIT_AUDIO) != 0)
+    {
+        free(audio);
+        return NULL;
+    }
+
+    SDL_AudioSpec want = {0};
+    want.freq          = sampleRate;
+    want.format        = AUDIO_S16SYS;
+    want.channels      = 2;
+    want.samples       = AUDIO_DEVICE_FRAMES;
+    want.callback      = AudioCallback;
+    want.userdata      = audio;
+
+    // SDL converts to whatever the device really plays
+    audio->device = SDL_OpenAudioDevice(NULL, 0, &want, NULL, 0);
+    if (audio->device == 0)
+    {
+        DestroyAudioContext(audio);
+        return NULL;
+    }
+
+    SDL_PauseAudioDevice(audio->device, 0);
+    return audio;
+#else
+    return NULL;
+#endif
+}
+
+// Moves the sound of the frames run since the last call to the ring. What
+// doesn't fit is dropped, as is everything while in turbo.
+void QueueAudio(AudioContext *audio, GB *gb, bool turbo)
+{
+#ifndef GB_HEADLESS
+    static int16_t discard[AUDIO_RING_FRAMES * 2];
+
+    uint32_t head  = SDL_AtomicGet(&audio->head);
+    uint32_t space = turbo ? 0 : AUDIO_RING_FRAMES - GetQueuedAudio(audio);
+
+    while (space > 0)
+    {
+        // Up to the end of the ring at once
+        uint32_t index = head & (AUDIO_RING_FRAMES - 1);
+        uint32_t count = AUDIO_RING_FRAMES - index;
+        count          = count < space ? count : space;
+
+        size_t read = GB_ReadSamples(gb, &audio->ring[index * 2], count);
+        head += read;
+        space -= read;
+
+        if (read < count)
+        {
+            break;
+        }
+    }
+    SDL_AtomicSet(&audio->head, head);
+
+    while (GB_ReadSamples(gb, discard, AUDIO_RING_FRAMES) > 0)
+    {
+    }
+#endif
+}
+
+// Waits until the audio device has played the ring down to
+// AUDIO_SYNC_FRAMES, which it does at exactly its own sample rate
+void WaitForAudio(AudioContext *audio)
+{
+#ifndef GB_HEADLESS
+    uint32_t start = SDL_GetTicks();
+
+    while (GetQueuedAudio(audio) > AUDIO_SYNC_FRAMES &&
+           SDL_GetTicks() - start < AUDIO_SYNC_TIMEOUT_MS)
+    {
+        SDL_Delay(1);
+    }
+#endif
+}
+
+uint64_t GetTicks()
+{
+#ifndef GB_HEADLESS
+    return SDL_GetPerformanceCounter();
+#else
+    return 0;
+#endif
+}
+
+void InitFramePacer(FramePacer *pacer, bool turbo, AudioContext *audio)
+{
+    pacer->turbo = turbo;
+    pacer->audio = audio;
+#ifndef GB_HEADLESS
+    pacer->frequency = SDL_GetPerformanceFrequency();
+#endif
+    pacer->frameTicks =
+        (uint64_t)((double)pacer->frequency * PPU_FRAME_CYCLES / CPU_CLOCK);
+    pacer->nextFrame   = GetTicks() + pacer->frameTicks;
+    pacer->lastPresent = 0;
+}
+
+void SetTurbo(FramePacer *pacer, bool turbo)
+{
+    pacer->turbo = turbo;
+
+    // Paced frames start over from now rather than from before the turbo
+    pacer->nextFrame = GetTicks() + pacer->frameTicks;
+}
+
+// Waits until the next frame is due. Sleeps for most of it to leave the
+// core idle and spins for the rest.
+void WaitForNextFrame(FramePacer *pacer)
+{
+#ifndef GB_HEADLESS
+    if (pacer->turbo)
+    {
+        return;
+    }
+
+    if (pacer->audio != NULL)
+    {
+        WaitForAudio(pacer->audio);
+        return;
+    }
+
+    uint64_t now  = GetTicks();
+    uint64_t spin = pacer->frequency * PACING_SPIN_MS / 1000;
+
+    // Frames that took too long (or a stalled host) are dropped from the
+    // schedule instead of being run back to back afterwards
+    if (now > pacer->nextFrame + pacer->frameTicks * PACING_MAX_LAG)
+    {
+        pacer->nextFrame = now;
+    }
+
+    while (now + spin < pacer->nextFrame)
+    {
+        SDL_Delay((pacer->nextFrame - now - spin) * 1000 / pacer->frequency);
+        now = GetTicks();
+    }
+    while (now < pacer->nextFrame)
+    {
+        now = GetTicks();
+    }
+
+    pacer->nextFrame += pacer->frameTicks;
+#endif
+}
+
+// Picks up turbo being toggled in the window
+void UpdateTurbo(FramePacer *pacer, RenderContext *ctx)
+{
+#ifndef GB_HEADLESS
+    bool turbo = SDL_AtomicGet(&ctx->turbo);
+    if (turbo != pacer->turbo)
+    {
+        SetTurbo(pacer, turbo);
+    }
+#endif
+}
+
+// Every paced frame is presented, in turbo only as many as a display shows
+bool ShouldPresent(FramePacer *pacer)
+{
+    if (!pacer->turbo)
+    {
+        return true;
+    }
+
+    uint64_t now = GetTicks();
+    if (now - pacer->lastPresent < pacer->frequency / TURBO_PRESENT_RATE)
+    {
+        return false;
+    }
+
+    pacer->lastPresent = now;
+    return true;
+}
+
+#ifndef GB_HEADLESS
+// Keyboard layout of the joypad
+uint8_t GetButton(SDL_Keycode key)
+{
+    switch (key)
+    {
+        case SDLK_RIGHT:
+            return GB_BUTTON_RIGHT;
+        case SDLK_LEFT:
+            return GB_BUTTON_LEFT;
+        case SDLK_UP:
+            return GB_BUTTON_UP;
+        case SDLK_DOWN:
+            return GB_BUTTON_DOWN;
+        case SDLK_x:
+            return GB_BUTTON_A;
+        case SDLK_z:
+            return GB_BUTTON_B;
+        case SDLK_BACKSPACE:
+        case SDLK_RSHIFT:
+            return GB_BUTTON_SELECT;
+        case SDLK_RETURN:
+            return GB_BUTTON_START;
+    }
+
+    return 0;
+}
+
+// Handles pending window events and tracks the held buttons, ends the run
+// once the window was closed
+void PollEvents(RenderContext *ctx)
+{
+    // Only ever changed here
+    uint8_t buttons = SDL_AtomicGet(&ctx->buttons);
+
+    SDL_Event e;
+    while (SDL_PollEvent(&e))
+    {
+        if (e.type == SDL_QUIT)
+        {
+            SDL_AtomicSet(&ctx->running, 0);
+        }
+        else if (e.type == SDL_KEYDOWN)
+        {
+            if (e.key.keysym.sym == SDLK_TAB && !e.key.repeat)
+            {
+                SDL_AtomicSet(&ctx->turbo, !SDL_AtomicGet(&ctx->turbo));
+            }
+
+            buttons |= GetButton(e.key.keysym.sym);
+        }
+        else if (e.type == SDL_KEYUP)
+        {
+            buttons &= ~GetButton(e.key.keysym.sym);
+        }
+    }
+
+    SDL_AtomicSet(&ctx->buttons, buttons);
+}
+
+// Shows the newest published frame whenever there is one and handles the
+// window's events, until the window is closed or the emulation ended
+void RunWindow(RenderContext *ctx)
+{
+    while (SDL_AtomicGet(&ctx->running))
+    {
+        PollEvents(ctx);
+
+        // Wakes up for the events even while no frames come
+        if (SDL_SemWaitTimeout(ctx->frameReady, EVENT_POLL_MS) != 0 ||
+            (SDL_AtomicGet(&ctx->middle) & FRAME_FRESH) == 0)
+        {
+            continue;
+        }
+
+        ctx->front = SDL_AtomicSet(&ctx->middle, ctx->front) & ~FRAME_FRESH;
+
+        SDL_UpdateTexture(ctx->backbufferTexture, NULL, ctx->frames[ctx->front],
+                          GB_VID_WIDTH * sizeof(uint32_t));
+
+        SDL_RenderClear(ctx->renderer);
+        SDL_RenderCopy(ctx->renderer, ctx->backbufferTexture, NULL, NULL);
+        SDL_RenderPresent(ctx->renderer);
+    }
+}
+#endif
+
+void PrintHit(const DebugHit *hit)
+{
+    const char *what = hit->type == GB_BREAKPOINT  ? "Breakpoint"
+                       : hit->type == GB_WATCH_READ ? "Read"
+                                                    : "Write";
+
+    printf("%s at $%04X: 0x%02X, cycle %" PRIu64 "\n", what, hit->addr,
+           hit->val, hit->cycles);
+}
+
+// Runs the frames and publishes them until the window is closed or the run
+// ends, on a thread of its own unless headless
+int EmulationThread(void *data)
+{
+    Emulation *emu     = data;
+    GB *       gb      = emu->gb;
+    long       frames  = 0;
+    bool       running = true;
+
+    while (running && frames != emu->maxFrames)
+    {
+        running = IsRunning(emu->ctx);
+        UpdateTurbo(&emu->pacer, emu->ctx);
+
+        if (emu->play)
+        {
+            if (frames == GB_GetMovieLength(emu->movie))
+            {
+                break;
+            }
+            GB_SetButtons(gb, GB_GetMovieButtons(emu->movie, frames));
+        }
+        else
+        {
+            uint8_t buttons = GetHeldButtons(emu->ctx);
+
+            GB_SetButtons(gb, buttons);
+            if (emu->movie != NULL && !GB_RecordFrame(emu->movie, buttons))
+            {
+                printf("Failed to record frame %ld\n", frames);
+                running = false;
+            }
+        }
+
+        running = running && GB_RunFrame(gb);
+
+        DebugHit hit;
+        if (GB_GetHit(gb, &hit))
+        {
+            PrintHit(&hit);
+            running = false;
+        }
+
+        if (emu->audio != NULL)
+        {
+            QueueAudio(emu->audio, gb, emu->pacer.turbo);
+        }
+
+        if (ShouldPresent(&emu->pacer))
+        {
+            PresentFrame(emu->ctx, GB_GetFramebuffer(gb));
+        }
+        WaitForNextFrame(&emu->pacer);
+        frames += 1;
+    }
+
+    EndRun(emu->ctx);
+    return 0;
+}
+
+// The ROM's path with its extension replaced by .sav, to be freed
+char *GetSavePath(const char *rom)
+{
+    const char *slash = strrchr(rom, '/');
+    const char *dot   = strrchr(rom, '.');
+    size_t      base  = strlen(rom);
+
+    if (dot != NULL && (slash == NULL || dot > slash))
+    {
+        base = dot - rom;
+    }
+
+    char *path = malloc(base + sizeof(".sav"));
+    if (path != NULL)
+    {
+        memcpy(path, rom, base);
+        memcpy(&path[base], ".sav", sizeof(".sav"));
+    }
+
+    return path;
+}
+
+void PrintUsage()
+{
+    printf("Usage: pc_gb [options] <rom>\n");
+    printf("\t--scale <n>       Initial window size as a multiple of "
+           "160x144 (default %d)\n",
+           RENDER_SCALE_DEFAULT);
+    printf("\t--filter <name>   nearest, linear or integer\n");
+    printf("\t--vsync           Sync presenting frames to the display\n");
+    printf("\t--turbo           Start unthrottled, Tab toggles it\n");
+    printf("\t--no-audio        Don't play (or synthesize) any sound\n");
+    printf("\t--audio-sync      Pace frames by the audio device rather than "
+           "the timer\n");
+    printf("\t--boot <path>     Boot ROM to run first (default DMG_ROM.bin)\n");
+    printf("\t--no-boot         Start the cartridge directly, CGB "
+           "cartridges need this or a CGB boot ROM to run as a CGB\n");
+    printf("\t--save <path>     Save file for battery buffered RAM (default "
+           "the ROM's name with .sav)\n");
+    printf("\t--no-save         Don't keep battery buffered RAM\n");
+    printf("\t--frames <n>      Stop after n frames\n");
+    printf("\t--record <path>   Save the input as a movie on exit\n");
+    printf("\t--play <path>     Replay a movie instead of reading the "
+           "keyboard, stops at its end\n");
+    printf("\t--trace <path>    Save the last %d instructions run on exit\n",
+           TRACE_LENGTH);
+    printf("\t--break <addr>    Stop in front of the instruction at addr "
+           "(hex), may be repeated\n");
+    printf("\t--watch <addr>    Stop after a write to addr (hex), may be "
+           "repeated\n");
+}
 
 int main(int argc, char **argv)
 {
-    if (argc < 2)
+    const char *rom       = NULL;
+    const char *bootRom   = "DMG_ROM.bin";
+    uint8_t     scale     = RENDER_SCALE_DEFAULT;
+    uint8_t     filter    = RENDER_FILTER_NEAREST;
+    long        maxFrames = -1;
+    bool        vsync     = false;
+    bool        turbo     = false;
+    bool        audioOn   = true;
+    bool        audioSync = false;
+    const char *record    = NULL;
+    const char *play      = NULL;
+    const char *trace     = NULL;
+    const char *save      = NULL;
+    bool        saveOn    = true;
+
+    // Set once the GB exists
+    uint16_t *breakpoints     = calloc(argc, sizeof(uint16_t));
+    uint16_t *watchpoints     = calloc(argc, sizeof(uint16_t));
+    int       breakpointCount = 0;
+    int       watchpointCount = 0;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--scale") == 0 && i + 1 < argc)
+        {
+            scale = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+        {
+            const char *name = argv[++i];
+
+            if (strcmp(name, "nearest") == 0)
+            {
+                filter = RENDER_FILTER_NEAREST;
+            }
+            else if (strcmp(name, "linear") == 0)
+            {
+                filter = RENDER_FILTER_LINEAR;
+            }
+            else if (strcmp(name, "integer") == 0)
+            {
+                filter = RENDER_FILTER_INTEGER;
+            }
+            else
+            {
+                printf("Unknown filter: %s\n", name);
+                PrintUsage();
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--vsync") == 0)
+        {
+            vsync = true;
+        }
+        else if (strcmp(argv[i], "--turbo") == 0)
+        {
+            turbo = true;
+        }
+        else if (strcmp(argv[i], "--no-audio") == 0)
+        {
+            audioOn = false;
+        }
+        else if (strcmp(argv[i], "--audio-sync") == 0)
+        {
+            audioSync = true;
+        }
+        else if (strcmp(argv[i], "--boot") == 0 && i + 1 < argc)
+        {
+            bootRom = argv[++i];
+        }
+        else if (strcmp(argv[i], "--no-boot") == 0)
+        {
+            bootRom = NULL;
+        }
+        else if (strcmp(argv[i], "--save") == 0 && i + 1 < argc)
+        {
+            save = argv[++i];
+        }
+        else if (strcmp(argv[i], "--no-save") == 0)
+        {
+            saveOn = false;
+        }
+        else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+        {
+            maxFrames = atol(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+        {
+            record = argv[++i];
+        }
+        else if (strcmp(argv[i], "--play") == 0 && i + 1 < argc)
+        {
+            play = argv[++i];
+        }
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+        {
+            trace = argv[++i];
+        }
+        else if (strcmp(argv[i], "--break") == 0 && i + 1 < argc)
+        {
+            breakpoints[breakpointCount++] = strtoul(argv[++i], NULL, 16);
+        }
+        else if (strcmp(argv[i], "--watch") == 0 && i + 1 < argc)
+        {
+            watchpoints[watchpointCount++] = strtoul(argv[++i], NULL, 16);
+        }
+        else
+        {
+            rom = argv[i];
+        }
+    }
+
+    if (rom == NULL)
     {
         printf("Please provide a rom\n");
+        PrintUsage();
         return 0;
     }
 
-    printf("%s\n", argv[1]);
+    printf("%s\n", rom);
+
+    RenderContext *ctx = CreateRenderContext(scale, filter, vsync);
+    if (ctx == NULL)
+    {
+        printf("Failed to create Rendering Context\n");
+        return 1;
+    }
 
-    GB *gb = CreateGB("");
+    GB *gb = CreateGB();
     if (gb == NULL)
     {
         printf("Failed to create GameBoy\n");
+        DestroyRenderContext(ctx);
         return 1;
     }
 
-    StartGB(gb, argv[1]);
+    if (trace != NULL && !GB_SetTrace(gb, TRACE_LENGTH))
+    {
+        printf("Running without a trace\n");
+        trace = NULL;
+    }
+
+    for (int i = 0; i < breakpointCount; ++i)
+    {
+        GB_SetBreakpoint(gb, breakpoints[i], true);
+    }
+    for (int i = 0; i < watchpointCount; ++i)
+    {
+        GB_SetWatchpoint(gb, watchpoints[i], GB_WATCH_WRITE);
+    }
+
+    // Without somewhere to play it the sound isn't synthesized at all
+    AudioContext *audio = audioOn ? CreateAudioContext(AUDIO_SAMPLE_RATE) : NULL;
+    if (audio != NULL && !GB_SetAudio(gb, AUDIO_SAMPLE_RATE))
+    {
+        DestroyAudioContext(audio);
+        audio = NULL;
+    }
+    if (audioOn && audio == NULL)
+    {
+        printf("Running without sound\n");
+    }
+
+    printf("GB Starting...\n");
+    if (GB_LoadRom(gb, rom, bootRom))
+    {
+        DumpRomInfo(gb);
+
+        if (saveOn && play == NULL && record == NULL && GB_HasBattery(gb))
+        {
+            char *path = save != NULL ? strdup(save) : GetSavePath(rom);
+            if (path == NULL || !GB_SetSaveFile(gb, path))
+            {
+                printf("Running without a save file\n");
+            }
+            free(path);
+        }
+
+        Emulation emu = {0};
+        emu.gb        = gb;
+        emu.ctx       = ctx;
+        emu.audio     = audio;
+        emu.play      = play != NULL;
+        emu.maxFrames = maxFrames;
+
+        // Either replayed or recorded, a movie being played isn't recorded
+        // again
+        if (play != NULL)
+        {
+            emu.movie = GB_LoadMovie(play);
+            if (emu.movie != NULL && !GB_CheckMovie(gb, emu.movie))
+            {
+                printf("Movie doesn't match the loaded cartridge\n");
+                GB_DestroyMovie(emu.movie);
+                emu.movie = NULL;
+            }
+        }
+        else if (record != NULL)
+        {
+            emu.movie = GB_CreateMovie(gb);
+        }
+
+        InitFramePacer(&emu.pacer, turbo, audioSync ? audio : NULL);
+
+        if (play == NULL || emu.movie != NULL)
+        {
+#ifndef GB_HEADLESS
+            SDL_AtomicSet(&ctx->turbo, turbo);
+
+            SDL_Thread *thread =
+                SDL_CreateThread(EmulationThread, "emulation", &emu);
+            if (thread != NULL)
+            {
+                RunWindow(ctx);
+                SDL_WaitThread(thread, NULL);
+            }
+            else
+            {
+                printf("Failed to start the emulation thread\n");
+            }
+#else
+            EmulationThread(&emu);
+#endif
+        }
+
+        DumpCPURegisters(gb);
+#ifdef GB_PROFILE
+        DumpProfile(gb);
+#endif
+
+        if (trace != NULL)
+        {
+            GB_SaveTrace(gb, trace);
+        }
+
+        if (play == NULL && record != NULL && emu.movie != NULL)
+        {
+            GB_SaveMovie(emu.movie, record);
+        }
+        GB_DestroyMovie(emu.movie);
+    }
 
     DestroyGB(gb);
     gb = NULL;
 
+    free(breakpoints);
+    free(watchpoints);
+
+    DestroyAudioContext(audio);
+    audio = NULL;
+
+    DestroyRenderContext(ctx);
+    ctx = NULL;
+
     return 0;
 }
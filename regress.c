@@ -0,0 +1,359 @@
+// regress.c - Golden result regression tests
+//
+// Runs every ROM of a manifest headless for a fixed number of frames and
+// compares a hash of the last frame and of everything sent over the serial
+// port against the hashes recorded for it. Hashes are much cheaper to
+// compare than images, so the whole corpus can run on every build.
+//
+// Manifests are text files of "<rom> <frames> <framebuffer> <serial>"
+// lines, the hashes being the 16 digit hex values GB_Hash gives. A hash of
+// "-" hasn't been recorded yet and the ROM is skipped. Lines starting with
+// # are ignored. ROMs are relative to the manifest unless --roms says
+// otherwise.
+//
+// --record runs the ROMs the same way and writes the hashes they gave
+// back to the manifest, to be reviewed like any other change.
+
+#include "GB.h"
+
+// Longest manifest line and ROM path
+#define LINE_SIZE 1024
+
+// Serial output printed for a failing ROM at most
+#define SERIAL_PRINT_SIZE 512
+
+// Exit code telling CTest that nothing was checked
+#define EXIT_SKIPPED 77
+
+typedef struct Entrystruct
+{
+    // The manifest line as read, kept for lines that aren't entries
+    char line[LINE_SIZE];
+
+    bool     valid;
+    char     rom[LINE_SIZE];
+    uint32_t frames;
+    bool     recorded;
+    uint64_t framebufferHash;
+    uint64_t serialHash;
+} Entry;
+
+typedef struct Regressstruct
+{
+    const char *manifest;
+    const char *roms;
+    const char *bootRom;
+    bool        blockCache;
+    bool        record;
+
+    Entry *  entries;
+    uint32_t entryCount;
+} Regress;
+
+// What a ROM did in its frames
+typedef struct Resultstruct
+{
+    bool     ok;
+    uint64_t framebufferHash;
+    uint64_t serialHash;
+
+    uint8_t *serial;
+    size_t   serialSize;
+} Result;
+
+// The fields are taken from the end, ROM names can have spaces in them
+bool ParseEntry(Entry *entry)
+{
+    char  line[LINE_SIZE];
+    char *fields[3];
+
+    memcpy(line, entry->line, sizeof(line));
+    line[strcspn(line, "\r\n")] = '\0';
+
+    if (line[0] == '#')
+    {
+        return false;
+    }
+
+    for (int i = 2; i >= 0; --i)
+    {
+        char *space = strrchr(line, ' ');
+        if (space == NULL)
+        {
+            return false;
+        }
+
+        fields[i] = space + 1;
+        *space    = '\0';
+    }
+
+    if (line[0] == '\0')
+    {
+        return false;
+    }
+
+    memcpy(entry->rom, line, sizeof(line));
+    entry->frames = strtoul(fields[0], NULL, 10);
+
+    entry->recorded = strcmp(fields[1], "-") != 0 && strcmp(fields[2], "-") != 0;
+    if (entry->recorded)
+    {
+        entry->framebufferHash = strtoull(fields[1], NULL, 16);
+        entry->serialHash      = strtoull(fields[2], NULL, 16);
+    }
+
+    return true;
+}
+
+bool LoadManifest(Regress *regress)
+{
+    FILE *f = fopen(regress->manifest, "r");
+    if (f == NULL)
+    {
+        printf("Failed to open manifest: %s\n", regress->manifest);
+        return false;
+    }
+
+    uint32_t capacity = 0;
+    char     line[LINE_SIZE];
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        if (regress->entryCount == capacity)
+        {
+            capacity = capacity > 0 ? capacity * 2 : 64;
+            regress->entries =
+                realloc(regress->entries, capacity * sizeof(Entry));
+        }
+
+        Entry *entry = &regress->entries[regress->entryCount++];
+        memset(entry, 0, sizeof(Entry));
+        memcpy(entry->line, line, sizeof(line));
+        entry->valid = ParseEntry(entry);
+    }
+
+    fclose(f);
+    return true;
+}
+
+bool SaveManifest(Regress *regress)
+{
+    FILE *f = fopen(regress->manifest, "w");
+    if (f == NULL)
+    {
+        printf("Failed to write manifest: %s\n", regress->manifest);
+        return false;
+    }
+
+    for (uint32_t i = 0; i < regress->entryCount; ++i)
+    {
+        Entry *entry = &regress->entries[i];
+
+        if (!entry->valid || !entry->recorded)
+        {
+            fputs(entry->line, f);
+            continue;
+        }
+
+        fprintf(f, "%s %u %016" PRIx64 " %016" PRIx64 "\n", entry->rom,
+                entry->frames, entry->framebufferHash, entry->serialHash);
+    }
+
+    return fclose(f) == 0;
+}
+
+// ROMs are relative to --roms, or the manifest's directory without it
+void GetRomPath(Regress *regress, const char *rom, char *path)
+{
+    if (rom[0] == '/')
+    {
+        snprintf(path, LINE_SIZE, "%s", rom);
+    }
+    else if (regress->roms != NULL)
+    {
+        snprintf(path, LINE_SIZE, "%s/%s", regress->roms, rom);
+    }
+    else
+    {
+        const char *slash = strrchr(regress->manifest, '/');
+        int         dir   = slash != NULL ? slash - regress->manifest : 1;
+
+        snprintf(path, LINE_SIZE, "%.*s/%s", dir,
+                 slash != NULL ? regress->manifest : ".", rom);
+    }
+}
+
+bool RunEntry(Regress *regress, Entry *entry, Result *result)
+{
+    char path[LINE_SIZE];
+    GetRomPath(regress, entry->rom, path);
+
+    memset(result, 0, sizeof(Result));
+
+    GB *gb = CreateGB();
+    if (gb == NULL || !GB_SetBlockCache(gb, regress->blockCache) ||
+        !GB_LoadRom(gb, path, regress->bootRom))
+    {
+        DestroyGB(gb);
+        return false;
+    }
+
+    size_t capacity = 0;
+
+    result->ok = true;
+    for (uint32_t i = 0; i < entry->frames && result->ok; ++i)
+    {
+        result->ok = GB_RunFrame(gb);
+
+        if (result->serialSize + SERIAL_OUT_SIZE > capacity)
+        {
+            capacity       = capacity * 2 + SERIAL_OUT_SIZE;
+            result->serial = realloc(result->serial, capacity);
+        }
+        result->serialSize += GB_ReadSerial(
+            gb, &result->serial[result->serialSize], SERIAL_OUT_SIZE);
+    }
+
+    // A CPU that stopped early still gives a result, hashed as it stands
+    result->framebufferHash = GB_HashFramebuffer(gb);
+    result->serialHash      = GB_Hash(result->serial, result->serialSize);
+
+    DestroyGB(gb);
+    return true;
+}
+
+void PrintSerial(const Result *result)
+{
+    size_t size = result->serialSize < SERIAL_PRINT_SIZE ? result->serialSize
+                                                         : SERIAL_PRINT_SIZE;
+
+    printf("\tserial: ");
+    for (size_t i = 0; i < size; ++i)
+    {
+        char c = result->serial[i];
+        putchar(c == '\n' || (c >= ' ' && c <= '~') ? c : '.');
+    }
+    printf("%s\n", size < result->serialSize ? "..." : "");
+}
+
+void PrintUsage()
+{
+    printf("Usage: pc_gb_regress [options] <manifest>\n");
+    printf("\t--roms <dir>      Directory the ROMs are relative to (default: "
+           "the manifest's)\n");
+    printf("\t--boot <path>     Boot ROM to run first\n");
+    printf("\t--no-block-cache  Interpret every instruction\n");
+    printf("\t--record          Write the hashes measured to the manifest\n");
+}
+
+int main(int argc, char **argv)
+{
+    Regress regress    = {0};
+    regress.blockCache = true;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--roms") == 0 && i + 1 < argc)
+        {
+            regress.roms = argv[++i];
+        }
+        else if (strcmp(argv[i], "--boot") == 0 && i + 1 < argc)
+        {
+            regress.bootRom = argv[++i];
+        }
+        else if (strcmp(argv[i], "--no-block-cache") == 0)
+        {
+            regress.blockCache = false;
+        }
+        else if (strcmp(argv[i], "--record") == 0)
+        {
+            regress.record = true;
+        }
+        else
+        {
+            regress.manifest = argv[i];
+        }
+    }
+
+    if (regress.manifest == NULL)
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    if (!LoadManifest(&regress))
+    {
+        return 1;
+    }
+
+    uint32_t passed     = 0;
+    uint32_t failed     = 0;
+    uint32_t unrecorded = 0;
+
+    for (uint32_t i = 0; i < regress.entryCount; ++i)
+    {
+        Entry *entry = &regress.entries[i];
+        Result result;
+
+        if (!entry->valid)
+        {
+            continue;
+        }
+
+        if (!entry->recorded && !regress.record)
+        {
+            printf("SKIP %s: not recorded\n", entry->rom);
+            unrecorded += 1;
+            continue;
+        }
+
+        if (!RunEntry(&regress, entry, &result))
+        {
+            printf("FAIL %s: could not be loaded\n", entry->rom);
+            failed += 1;
+            continue;
+        }
+
+        if (regress.record)
+        {
+            printf("RECORD %s: %016" PRIx64 " %016" PRIx64 "%s\n", entry->rom,
+                   result.framebufferHash, result.serialHash,
+                   result.ok ? "" : " (stopped)");
+
+            entry->recorded        = true;
+            entry->framebufferHash = result.framebufferHash;
+            entry->serialHash      = result.serialHash;
+            passed += 1;
+        }
+        else if (result.framebufferHash == entry->framebufferHash &&
+                 result.serialHash == entry->serialHash)
+        {
+            printf("PASS %s\n", entry->rom);
+            passed += 1;
+        }
+        else
+        {
+            printf("FAIL %s: framebuffer %016" PRIx64 " (expected %016" PRIx64
+                   "), serial %016" PRIx64 " (expected %016" PRIx64 ")%s\n",
+                   entry->rom, result.framebufferHash, entry->framebufferHash,
+                   result.serialHash, entry->serialHash,
+                   result.ok ? "" : ", CPU stopped");
+            PrintSerial(&result);
+            failed += 1;
+        }
+
+        free(result.serial);
+    }
+
+    printf("%u %s, %u failed, %u not recorded\n", passed,
+           regress.record ? "recorded" : "passed", failed, unrecorded);
+
+    bool saved = !regress.record || SaveManifest(&regress);
+    free(regress.entries);
+
+    if (failed > 0 || !saved)
+    {
+        return 1;
+    }
+
+    return passed == 0 ? EXIT_SKIPPED : 0;
+}
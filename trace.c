@@ -0,0 +1,109 @@
+// trace.c - Decodes execution traces
+//
+// Prints the instructions of a trace written by GB_SaveTrace (pc_gb
+// --trace), oldest first, disassembled along with the cycle they started at
+// and the registers before they ran. Recording only copies the state into
+// a ring, all the formatting happens here.
+
+#include "GB.h"
+
+void PrintUsage()
+{
+    printf("Usage: pc_gb_trace [options] <trace>\n");
+    printf("\t--last <n>  Print only the last n instructions\n");
+}
+
+void PrintEntry(const TraceEntry *entry)
+{
+    char    text[32];
+    char    bytes[16];
+    uint8_t length = GB_Disassemble(entry->pc, entry->bytes, text, sizeof(text));
+
+    int used = 0;
+    for (uint8_t i = 0; i < length; ++i)
+    {
+        used += snprintf(&bytes[used], sizeof(bytes) - used, "%s%02X",
+                         i > 0 ? " " : "", entry->bytes[i]);
+    }
+
+    printf("%14" PRIu64 " $%04X  %-8s  %-16s AF=%04X BC=%04X DE=%04X "
+           "HL=%04X SP=%04X%s\n",
+           entry->cycles, entry->pc, bytes, text, entry->af, entry->bc,
+           entry->de, entry->hl, entry->sp,
+           (entry->flags & GB_TRACE_IME) ? " IME" : "");
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = NULL;
+    uint64_t    last = UINT64_MAX;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--last") == 0 && i + 1 < argc)
+        {
+            last = strtoull(argv[++i], NULL, 10);
+        }
+        else
+        {
+            path = argv[i];
+        }
+    }
+
+    if (path == NULL)
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)
+    {
+        printf("Failed to open trace: %s\n", path);
+        return 1;
+    }
+
+    TraceHeader header;
+    if (fread(&header, sizeof(TraceHeader), 1, f) != 1 ||
+        header.magic != GB_TRACE_MAGIC)
+    {
+        printf("Not a trace: %s\n", path);
+        fclose(f);
+        return 1;
+    }
+
+    if (header.version != GB_TRACE_VERSION ||
+        header.entrySize != sizeof(TraceEntry))
+    {
+        printf("Unsupported trace version %u: %s\n", header.version, path);
+        fclose(f);
+        return 1;
+    }
+
+    uint64_t skip = header.entryCount > last ? header.entryCount - last : 0;
+    if (fseek(f, skip * sizeof(TraceEntry), SEEK_CUR) != 0)
+    {
+        printf("Truncated trace: %s\n", path);
+        fclose(f);
+        return 1;
+    }
+
+    printf("%" PRIu64 " instructions traced, the last %u kept\n", header.total,
+           header.entryCount);
+
+    TraceEntry entry;
+    for (uint64_t i = skip; i < header.entryCount; ++i)
+    {
+        if (fread(&entry, sizeof(TraceEntry), 1, f) != 1)
+        {
+            printf("Truncated trace: %s\n", path);
+            fclose(f);
+            return 1;
+        }
+
+        PrintEntry(&entry);
+    }
+
+    fclose(f);
+    return 0;
+}